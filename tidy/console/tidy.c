@@ -191,6 +191,9 @@ static const CmdOptDesc cmdopt_defs[] =  {
     { "-quiet",
       "suppress nonessential output",
       "quiet: yes", CmdOptProcDir, "-q", NULL },
+    { "-json",
+      "write errors and warnings as JSON, one per line",
+      "json-messages: yes", CmdOptProcDir, NULL, NULL },
     { "-omit",
       "omit optional end tags",
       "hide-endtags: yes", CmdOptProcDir, NULL, NULL },
@@ -1024,6 +1027,9 @@ int main( int argc, char** argv )
             else if ( strcasecmp(arg, "quiet") == 0 )
                 tidyOptSetBool( tdoc, TidyQuiet, yes );
 
+            else if ( strcasecmp(arg, "json") == 0 )
+                tidyOptSetBool( tdoc, TidyJsonMessages, yes );
+
             else if ( strcasecmp(arg, "help") == 0 ||
                       strcasecmp(arg,    "h") == 0 || *arg == '?' )
             {
@@ -1280,6 +1286,7 @@ int main( int argc, char** argv )
     }
 
     if (!tidyOptGetBool(tdoc, TidyQuiet) &&
+        !tidyOptGetBool(tdoc, TidyJsonMessages) &&
         errout == stderr && !contentErrors)
         fprintf(errout, "\n");
 
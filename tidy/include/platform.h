@@ -66,6 +66,11 @@ extern "C" {
 #define SUPPORT_ACCESSIBILITY_CHECKS 1
 #endif
 
+/* Enable/disable printing the body on several threads, needs POSIX threads */
+#ifndef SUPPORT_PARALLEL_PRINT
+#define SUPPORT_PARALLEL_PRINT 0
+#endif
+
 /* Enable/disable changes by Apple Inc. */
 #ifndef TIDY_APPLE_CHANGES
 #define TIDY_APPLE_CHANGES 1
@@ -400,6 +405,21 @@ extern "C" {
 #define FILENAMES_CASE_SENSITIVE 1
 #endif
 
+/* Enable/disable using documents on several threads at once, needs POSIX
+   threads.  The indexes shared by all documents are then built under
+   pthread_once(); documents themselves must still be used by one thread
+   at a time.  On by default on POSIX platforms and always on with
+   SUPPORT_PARALLEL_PRINT.  Without it the indexes are built on first
+   use behind a plain flag, and only one thread may use Tidy at a time.
+*/
+#ifndef SUPPORT_THREADS
+#if SUPPORT_PARALLEL_PRINT || defined(MAC_OS_X) || defined(LINUX_OS) || defined(BSD_BASED_OS) || defined(SOLARIS_OS) || defined(HPUX_OS) || defined(IRIX_OS) || defined(AIX_OS) || defined(CYGWIN_OS)
+#define SUPPORT_THREADS 1
+#else
+#define SUPPORT_THREADS 0
+#endif
+#endif
+
 
 /*
   Tidy preserves the last modified time for the files it
@@ -113,6 +113,16 @@ opaque_type( TidyNode );
 */
 opaque_type( TidyAttr );
 
+/** @struct TidyMessage
+**  Opaque diagnostic message datatype
+*/
+opaque_type( TidyMessage );
+
+/** @struct TidyProfile
+**  Opaque compiled configuration datatype
+*/
+opaque_type( TidyProfile );
+
 /** @} */
 
 TIDY_STRUCT struct _TidyBuffer;
@@ -186,6 +196,17 @@ int main(int argc, char **argv )
 TIDY_EXPORT TidyDoc TIDY_CALL     tidyCreate(void);
 TIDY_EXPORT void TIDY_CALL        tidyRelease( TidyDoc tdoc );
 
+/** Free the document tree and clear the error and warning
+**  counts, so the same instance can tidy another document.
+**  Options, callbacks, the error sink and application data
+**  are kept, as are the buffers grown by earlier documents;
+**  a loop over many similar documents with one instance soon
+**  runs without allocating them again.
+**  Called from a callback while the document is being parsed
+**  or saved, it does nothing.
+*/
+TIDY_EXPORT void TIDY_CALL        tidyReset( TidyDoc tdoc );
+
 /** Let application store a chunk of data w/ each Tidy instance.
 **  Useful for callbacks.
 */
@@ -235,6 +256,11 @@ TIDY_EXPORT int TIDY_CALL         tidyLoadConfig( TidyDoc tdoc, ctmbstr configFi
 TIDY_EXPORT int TIDY_CALL         tidyLoadConfigEnc( TidyDoc tdoc, ctmbstr configFile,
                                            ctmbstr charenc );
 
+/** Load Tidy configuration settings, written as in a configuration
+**  file, from a buffer in the specified character encoding */
+TIDY_EXPORT int TIDY_CALL         tidyLoadConfigBuffer( TidyDoc tdoc, TidyBuffer* configBuf,
+                                              ctmbstr charenc );
+
 TIDY_EXPORT Bool TIDY_CALL        tidyFileExists( ctmbstr filename );
 
 
@@ -361,6 +387,16 @@ TIDY_EXPORT Bool TIDY_CALL          tidyOptDiffThanSnapshot( TidyDoc tdoc );
 /** Copy current configuration settings from one document to another */
 TIDY_EXPORT Bool TIDY_CALL          tidyOptCopyConfig( TidyDoc tdocTo, TidyDoc tdocFrom );
 
+/** Compile current configuration settings into a read-only profile
+**  that any number of documents may share */
+TIDY_EXPORT TidyProfile TIDY_CALL   tidyOptCompileProfile( TidyDoc tdoc );
+/** Use the settings of a profile without copying them.  A document
+**  takes its own copy only when it changes an option.  The profile
+**  must not be released while a document still uses it */
+TIDY_EXPORT Bool TIDY_CALL          tidyOptApplyProfile( TidyDoc tdoc, TidyProfile tprof );
+/** Release a profile */
+TIDY_EXPORT void TIDY_CALL          tidyOptReleaseProfile( TidyProfile tprof );
+
 /** Get character encoding name.  Used with TidyCharEncoding,
 **  TidyOutCharEncoding, TidyInCharEncoding */
 TIDY_EXPORT ctmbstr TIDY_CALL       tidyOptGetEncName( TidyDoc tdoc, TidyOptionId optId );
@@ -493,6 +529,38 @@ typedef Bool (TIDY_CALL *TidyReportFilter)( TidyDoc tdoc, TidyReportLevel lvl,
 TIDY_EXPORT Bool TIDY_CALL    tidySetReportFilter( TidyDoc tdoc,
                                                   TidyReportFilter filtCallback );
 
+/** Callback to handle diagnostics as they are reported.  The
+**  message is only valid during the call.  Its text is not
+**  formatted unless asked for, so a callback that works from
+**  the code and arguments costs no formatting.  Return true
+**  to proceed with the report filter and output, false to
+**  cancel.
+*/
+typedef Bool (TIDY_CALL *TidyMessageCallback)( TidyDoc tdoc, TidyMessage tmsg );
+
+/** Give Tidy a message callback to use */
+TIDY_EXPORT Bool TIDY_CALL    tidySetMessageCallback( TidyDoc tdoc,
+                                                     TidyMessageCallback msgCallback );
+
+/** Message code: see message.h and access.h, 0 for messages without one */
+TIDY_EXPORT uint TIDY_CALL            tidyMessageCode( TidyMessage tmsg );
+/** Diagnostic level of the message */
+TIDY_EXPORT TidyReportLevel TIDY_CALL tidyMessageLevel( TidyMessage tmsg );
+/** Line of the message, 0 if it has no position */
+TIDY_EXPORT uint TIDY_CALL            tidyMessageLine( TidyMessage tmsg );
+/** Column of the message, 0 if it has no position */
+TIDY_EXPORT uint TIDY_CALL            tidyMessageColumn( TidyMessage tmsg );
+/** Number of arguments of the message */
+TIDY_EXPORT uint TIDY_CALL            tidyMessageArgCount( TidyMessage tmsg );
+/** Argument as given: a tag, attribute or entity name, a value.
+**  For a tag shown as "<name>" this is the element name alone.
+*/
+TIDY_EXPORT ctmbstr TIDY_CALL         tidyMessageArg( TidyMessage tmsg, uint ix );
+/** printf() format the text is made from */
+TIDY_EXPORT ctmbstr TIDY_CALL         tidyMessageFormat( TidyMessage tmsg );
+/** Text of the message, formatted on the first call */
+TIDY_EXPORT ctmbstr TIDY_CALL         tidyMessageText( TidyMessage tmsg );
+
 /** Set error sink to named file */
 TIDY_EXPORT FILE* TIDY_CALL   tidySetErrorFile( TidyDoc tdoc, ctmbstr errfilnam );
 /** Set error sink to given buffer */
@@ -514,6 +582,10 @@ TIDY_EXPORT int TIDY_CALL     tidySetErrorSink( TidyDoc tdoc, TidyOutputSink* si
 ** May be used to set environment-specific allocators
 ** such as used by web server plugins, etc.
 **
+** The allocators are shared by all documents.  Set them
+** before the first document is created; they are read
+** without locking by every thread using Tidy.
+**
 ** @{
 */
 
@@ -602,7 +674,9 @@ TIDY_EXPORT int TIDY_CALL         tidySaveBuffer( TidyDoc tdoc, TidyBuffer* buf
 
 /** Save document to application buffer.  If buffer is not big enough,
 **  ENOMEM will be returned and the necessary buffer size will be placed
-**  in *buflen.
+**  in *buflen; the buffer holds as much of the output as fit.  A NULL
+**  buffer with *buflen of 0 only measures.  A call that does not fit
+**  leaves the options alone, so the retry gives the same output.
 */
 TIDY_EXPORT int TIDY_CALL         tidySaveString( TidyDoc tdoc,
                                                  tmbstr buffer, uint* buflen );
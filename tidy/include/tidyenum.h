@@ -206,7 +206,15 @@ typedef enum
   TidyDropClassesWithPrefix, /* Delete 'class' attributes starting with the specified prefix */
   TidyDropIdsWithPrefix,     /* Delete 'id'    attributes starting with the specified prefix */
   TidySanitizeAgainstXSS,    /* Remove elements and attributes which could assist a cross-site scripting (XSS) attack */
+  TidySanitizeAllowedElements,   /* Elements kept by the XSS sanitizer, default: all but those loading external content */
+  TidySanitizeAllowedAttributes, /* Attributes ("attr" or "element@attr") kept by the XSS sanitizer */
+  TidySanitizeAllowedUrlSchemes, /* URL schemes kept by the XSS sanitizer, default: all but script and file schemes */
 #endif
+  TidyMinify,          /**< Output without line breaks, indentation or wrapping */
+  TidyPrintThreads,    /**< Threads used to print the body */
+  TidyPrintCache,      /**< Keep printed elements for the next save */
+  TidyMuteMessages,    /**< Codes of messages not to report */
+  TidyJsonMessages,    /**< Write diagnostics as JSON, one per line */
   N_TIDY_OPTIONS       /**< Must be last */
 } TidyOptionId;
 
@@ -38,7 +38,6 @@ static AttrCheck CheckScript;
 static AttrCheck CheckName;
 #ifdef TIDY_APPLE_CHANGES
 static AttrCheck CheckClass;
-static AttrCheck CheckStyleAttr;
 #endif
 static AttrCheck CheckId;
 static AttrCheck CheckAlign;
@@ -237,11 +236,7 @@ static const Attribute attribute_defs [] =
   { TidyAttr_SRC,               "src",               VERS_ALL,          CH_URL,       NULL }, /* IMG, FRAME, IFRAME */
   { TidyAttr_STANDBY,           "standby",           VERS_HTML40,       CH_PCDATA,    NULL }, /* OBJECT */
   { TidyAttr_START,             "start",             VERS_ALL,          CH_NUMBER,    NULL }, /* OL */
-#ifdef TIDY_APPLE_CHANGES
-  { TidyAttr_STYLE,             "style",             VERS_HTML40,     CheckStyleAttr, NULL },
-#else
   { TidyAttr_STYLE,             "style",             VERS_HTML40,       CH_PCDATA,    NULL },
-#endif
   { TidyAttr_SUMMARY,           "summary",           VERS_HTML40,       CH_PCDATA,    NULL }, /* TABLE */
   { TidyAttr_TABINDEX,          "tabindex",          VERS_HTML40,       CH_NUMBER,    NULL }, /* fields, OBJECT  and A */
   { TidyAttr_TARGET,            "target",            VERS_HTML40,       CH_TARGET,    NULL }, /* names a frame/window */
@@ -310,19 +305,123 @@ static Bool AttributeIsMarkedForRemoval(AttVal* attval)
 }
 #endif
 
-static uint AttributeVersions(Node* node, AttVal* attval)
+/*
+ Attribute versions of the W3C elements, indexed by tag and
+ attribute id.  The table is filled from the W3CAttrsFor_*
+ lists of attrdict.c by InitAttrVersions(); a zero entry means
+ that the attribute is not listed for the element.  Elements
+ whose attrvers differ from the list the table was built from
+ (or a table not built yet) are looked up linearly.
+*/
+#define ATTRVERS_LISTED 0x80000000u  /* above all VERS_* bits */
+
+#if (ATTRVERS_LISTED & (VERS_ALL|VERS_PROPRIETARY|VERS_XML)) != 0
+#error "ATTRVERS_LISTED must not overlap the VERS_* bits"
+#endif
+
+static uint attrVersionTable[N_TIDY_TAGS][N_TIDY_ATTRIBS];
+static const AttrVersion* attrVersionSource[N_TIDY_TAGS];
+static TidyOnce attrVersionsOnce = TIDY_ONCE_INIT;
+
+static Bool FindAttrVersionLinear( const AttrVersion* attrvers, TidyAttrId id,
+                                   uint* versions )
 {
     uint i;
 
+    for (i = 0; attrvers[i].attribute; ++i)
+    {
+        if (attrvers[i].attribute == id)
+        {
+            *versions = attrvers[i].versions;
+            return yes;
+        }
+    }
+    return no;
+}
+
+/* versions of attribute "id" if listed for element "tag" */
+static Bool FindAttrVersion( const Dict* tag, TidyAttrId id, uint* versions )
+{
+    uint entry;
+
+    if ( (uint)tag->id >= N_TIDY_TAGS || (uint)id >= N_TIDY_ATTRIBS ||
+         attrVersionSource[tag->id] != tag->attrvers )
+        return FindAttrVersionLinear( tag->attrvers, id, versions );
+
+    entry = attrVersionTable[tag->id][id];
+    if ( entry == 0 )
+        return no;
+
+    *versions = entry & ~ATTRVERS_LISTED;
+    return yes;
+}
+
+static void InitAttrVersions(void)
+{
+    uint tid, i;
+
+    for ( tid = TidyTag_UNKNOWN + 1; tid < N_TIDY_TAGS; ++tid )
+    {
+        const Dict* tag = TY_(LookupTagDef)( (TidyTagId)tid );
+        const AttrVersion* attrvers = tag ? tag->attrvers : NULL;
+
+        if ( attrvers == NULL )
+            continue;
+
+        /* versions using the marker bit can't be indexed,
+           such an element keeps to the linear search */
+        for ( i = 0; attrvers[i].attribute; ++i )
+        {
+            if ( attrvers[i].versions & ATTRVERS_LISTED )
+                break;
+        }
+        if ( attrvers[i].attribute )
+            continue;
+
+        for ( i = 0; attrvers[i].attribute; ++i )
+        {
+            uint id = attrvers[i].attribute;
+
+            /* the first entry wins, as with the linear search */
+            if ( id < N_TIDY_ATTRIBS && attrVersionTable[tid][id] == 0 )
+                attrVersionTable[tid][id] =
+                    attrvers[i].versions | ATTRVERS_LISTED;
+        }
+        attrVersionSource[tid] = attrvers;
+    }
+
+#ifdef _DEBUG
+    /* Table and linear search must agree on every pair */
+    for ( tid = TidyTag_UNKNOWN + 1; tid < N_TIDY_TAGS; ++tid )
+    {
+        const Dict* tag = TY_(LookupTagDef)( (TidyTagId)tid );
+
+        if ( tag == NULL || tag->attrvers == NULL )
+            continue;
+
+        for ( i = 0; i < N_TIDY_ATTRIBS; ++i )
+        {
+            uint vtab = 0, vlin = 0;
+            Bool intab = FindAttrVersion( tag, (TidyAttrId)i, &vtab );
+            Bool inlin = FindAttrVersionLinear( tag->attrvers, (TidyAttrId)i, &vlin );
+            assert( intab == inlin && vtab == vlin );
+        }
+    }
+#endif
+}
+
+static uint AttributeVersions(Node* node, AttVal* attval)
+{
+    uint versions;
+
     if (!attval || !attval->dict)
         return VERS_UNKNOWN;
 
     if (!node || !node->tag || !node->tag->attrvers)
         return attval->dict->versions;
 
-    for (i = 0; node->tag->attrvers[i].attribute; ++i)
-        if (node->tag->attrvers[i].attribute == attval->dict->id)
-            return node->tag->attrvers[i].versions;
+    if (FindAttrVersion(node->tag, attval->dict->id, &versions))
+        return versions;
 
     return attval->dict->versions & VERS_ALL
              ? VERS_UNKNOWN
@@ -334,14 +433,13 @@ static uint AttributeVersions(Node* node, AttVal* attval)
 /* return the version of the attribute "id" of element "node" */
 uint TY_(NodeAttributeVersions)( Node* node, TidyAttrId id )
 {
-    uint i;
+    uint versions;
 
     if (!node || !node->tag || !node->tag->attrvers)
         return VERS_UNKNOWN;
 
-    for (i = 0; node->tag->attrvers[i].attribute; ++i)
-        if (node->tag->attrvers[i].attribute == id)
-            return node->tag->attrvers[i].versions;
+    if (FindAttrVersion(node->tag, id, &versions))
+        return versions;
 
     return VERS_UNKNOWN;
 }
@@ -563,6 +661,16 @@ static const struct _colors fancy_colors[] =
 #endif
 
 #if ATTRIBUTE_HASH_LOOKUP
+/*
+ Name index of attribute_defs, shared by all documents.  Bucket
+ heads and chain links are positions in attribute_defs, 0 (the
+ unknown entry) ending a chain.  InitAttrHash() builds it once,
+ later it is only read.
+*/
+static unsigned short attrHashHead[ATTRIBUTE_HASH_SIZE];
+static unsigned short attrHashNext[N_TIDY_ATTRIBS];
+static TidyOnce attrHashOnce = TIDY_ONCE_INIT;
+
 static uint hash(ctmbstr s)
 {
     uint hashval;
@@ -573,61 +681,15 @@ static uint hash(ctmbstr s)
     return hashval % ATTRIBUTE_HASH_SIZE;
 }
 
-static const Attribute *install(TidyAttribImpl * attribs, const Attribute* old)
+static void InitAttrHash(void)
 {
-    AttrHash *np;
-    uint hashval;
-
-    if (old)
-    {
-        np = (AttrHash *)MemAlloc(sizeof(*np));
-        np->attr = old;
-
-        hashval = hash(old->name);
-        np->next = attribs->hashtab[hashval];
-        attribs->hashtab[hashval] = np;
-    }
+    uint ix, h;
 
-    return old;
-}
-
-static void removeFromHash( TidyAttribImpl * attribs, ctmbstr s )
-{
-    uint h = hash(s);
-    AttrHash *p, *prev = NULL;
-    for (p = attribs->hashtab[h]; p && p->attr; p = p->next)
+    for ( ix = N_TIDY_ATTRIBS - 1; ix > 0; --ix )
     {
-        if (TY_(tmbstrcmp)(s, p->attr->name) == 0)
-        {
-            AttrHash* next = p->next;
-            if ( prev )
-                prev->next = next; 
-            else
-                attribs->hashtab[h] = next;
-            MemFree(p);
-            return;
-        }
-        prev = p;
-    }
-}
-
-static void emptyHash( TidyAttribImpl * attribs )
-{
-    AttrHash *dict, *next;
-    uint i;
-
-    for (i = 0; i < ATTRIBUTE_HASH_SIZE; ++i)
-    {
-        dict = attribs->hashtab[i];
-
-        while(dict)
-        {
-            next = dict->next;
-            MemFree(dict);
-            dict = next;
-        }
-
-        attribs->hashtab[i] = NULL;
+        h = hash( attribute_defs[ix].name );
+        attrHashNext[ix] = attrHashHead[h];
+        attrHashHead[h] = (unsigned short) ix;
     }
 }
 #endif
@@ -637,25 +699,23 @@ static const Attribute* lookup(TidyDocImpl* ARG_UNUSED(doc),
                                ctmbstr atnam)
 {
 #ifdef TIDY_APPLE_CHANGES
-    static Attribute unknownEventHandler;
+    static const Attribute unknownEventHandler =
+        { TidyAttr_UNKNOWN, "onunknowneventhandler", VERS_ALL, CH_SCRIPT, NULL };
 #endif
 
-    const Attribute *np;
 #if ATTRIBUTE_HASH_LOOKUP
-    const AttrHash *p;
+    uint ix;
+#else
+    const Attribute *np;
 #endif
 
     if (!atnam)
         return NULL;
 
 #if ATTRIBUTE_HASH_LOOKUP
-    for (p = attribs->hashtab[hash(atnam)]; p && p->attr; p = p->next)
-        if (TY_(tmbstrcmp)(atnam, p->attr->name) == 0)
-            return p->attr;
-
-    for (np = attribute_defs; np && np->name; ++np)
-        if (TY_(tmbstrcmp)(atnam, np->name) == 0)
-            return install(attribs, np);
+    for (ix = attrHashHead[hash(atnam)]; ix != 0; ix = attrHashNext[ix])
+        if (TY_(tmbstrcmp)(atnam, attribute_defs[ix].name) == 0)
+            return &attribute_defs[ix];
 #else
     for (np = attribute_defs; np && np->name; ++np)
         if (TY_(tmbstrcmp)(atnam, np->name) == 0)
@@ -663,12 +723,6 @@ static const Attribute* lookup(TidyDocImpl* ARG_UNUSED(doc),
 #endif
 
 #ifdef TIDY_APPLE_CHANGES
-    if (!unknownEventHandler.name) {
-        unknownEventHandler.name = "onunknowneventhandler";
-        unknownEventHandler.versions = VERS_ALL;
-        unknownEventHandler.attrchk = CH_SCRIPT;
-    }
-
     /* When sanitizing against XSS problems we strip all onfoo-style event handlers to prevent potential
        security problems caused by event handlers that we aren't explicitly aware of, such as was the case
        with <rdar://problem/6507826>. */
@@ -686,6 +740,14 @@ static const Attribute* lookup(TidyDocImpl* ARG_UNUSED(doc),
 AttVal* TY_(AttrGetById)( Node* node, TidyAttrId id )
 {
    AttVal* av;
+   if ( !(node->attrmask & AttrMaskBit(id)) )
+   {
+#ifdef _DEBUG
+       for ( av = node->attributes; av; av = av->next )
+           assert( !AttrIsId(av, id) );
+#endif
+       return NULL;
+   }
    for ( av = node->attributes; av; av = av->next )
    {
      if ( AttrIsId(av, id) )
@@ -737,6 +799,7 @@ AttVal* TY_(RepairAttrValue)(TidyDocImpl* doc, Node* node, ctmbstr name, ctmbstr
 
     if (old)
     {
+        TY_(PrintCacheChanged)( node );
         if (old->value)
             MemFree(old->value);
         if (value)
@@ -847,26 +910,86 @@ static void FreeAnchor(Anchor *a)
     MemFree( a );
 }
 
-/* removes anchor for specific node */
+/* anchors are matched case-insensitively */
+static uint anchorHash( ctmbstr s )
+{
+    uint hashval;
+
+    for (hashval = 0; *s != '\0'; s++)
+        hashval = TY_(ToLower)( (byte)*s ) + 31*hashval;
+
+    return hashval;
+}
+
+static uint anchorNodeHash( Node* node )
+{
+    return (uint)( (size_t)node >> 4 );
+}
+
+/* move all anchors to new tables of the given size */
+static void RehashAnchors( TidyAttribImpl* attribs, uint buckets )
+{
+    Anchor **byName, **byNode, *a, *next;
+    uint i, h;
+
+    byName = (Anchor**) MemAlloc( buckets * sizeof(Anchor*) );
+    byNode = (Anchor**) MemAlloc( buckets * sizeof(Anchor*) );
+    ClearMemory( byName, buckets * sizeof(Anchor*) );
+    ClearMemory( byNode, buckets * sizeof(Anchor*) );
+
+    for ( i = 0; i < attribs->anchor_buckets; ++i )
+    {
+        for ( a = attribs->anchor_hash[i]; a != NULL; a = next )
+        {
+            next = a->next;
+            h = a->hashval & (buckets - 1);
+            a->next = byName[h];
+            byName[h] = a;
+        }
+        for ( a = attribs->anchor_nodes[i]; a != NULL; a = next )
+        {
+            next = a->nextByNode;
+            h = anchorNodeHash( a->node ) & (buckets - 1);
+            a->nextByNode = byNode[h];
+            byNode[h] = a;
+        }
+    }
+
+    MemFree( attribs->anchor_hash );
+    MemFree( attribs->anchor_nodes );
+    attribs->anchor_hash = byName;
+    attribs->anchor_nodes = byNode;
+    attribs->anchor_buckets = buckets;
+}
+
+/* removes all anchors for specific node */
 void TY_(RemoveAnchorByNode)( TidyDocImpl* doc, Node *node )
 {
     TidyAttribImpl* attribs = &doc->attribs;
-    Anchor *delme = NULL, *curr, *prev = NULL;
+    Anchor **link, **nameLink, *curr;
+    uint mask = attribs->anchor_buckets - 1;
+
+    if ( attribs->anchor_count == 0 )
+        return;
 
-    for ( curr=attribs->anchor_list; curr!=NULL; curr=curr->next )
+    link = &attribs->anchor_nodes[ anchorNodeHash(node) & mask ];
+    while ( (curr = *link) != NULL )
     {
-        if ( curr->node == node )
+        if ( curr->node != node )
         {
-            if ( prev )
-                prev->next = curr->next;
-            else
-                attribs->anchor_list = curr->next;
-            delme = curr;
-            break;
+            link = &curr->nextByNode;
+            continue;
         }
-        prev = curr;
+        *link = curr->nextByNode;
+
+        nameLink = &attribs->anchor_hash[ curr->hashval & mask ];
+        while ( *nameLink != curr )
+            nameLink = &(*nameLink)->next;
+        *nameLink = curr->next;
+
+        --attribs->anchor_count;
+        FreeAnchor( curr );
     }
-    FreeAnchor( delme );
 }
 
 /* initialize new anchor */
@@ -876,8 +999,10 @@ static Anchor* NewAnchor( ctmbstr name, Node* node )
 
     a->name = TY_(tmbstrdup)( name );
     a->name = TY_(tmbstrtolower)(a->name);
+    a->hashval = anchorHash( a->name );
     a->node = node;
     a->next = NULL;
+    a->nextByNode = NULL;
 
     return a;
 }
@@ -887,56 +1012,93 @@ static Anchor* AddAnchor( TidyDocImpl* doc, ctmbstr name, Node *node )
 {
     TidyAttribImpl* attribs = &doc->attribs;
     Anchor *a = NewAnchor( name, node );
+    uint h;
 
-    if ( attribs->anchor_list == NULL)
-         attribs->anchor_list = a;
-    else
-    {
-        Anchor *here =  attribs->anchor_list;
-        while (here->next)
-            here = here->next;
-        here->next = a;
-    }
+    if ( attribs->anchor_count >= attribs->anchor_buckets )
+        RehashAnchors( attribs, attribs->anchor_buckets ?
+                       2 * attribs->anchor_buckets : ANCHOR_HASH_SIZE );
+
+    h = a->hashval & (attribs->anchor_buckets - 1);
+    a->next = attribs->anchor_hash[h];
+    attribs->anchor_hash[h] = a;
 
-    return attribs->anchor_list;
+    h = anchorNodeHash( node ) & (attribs->anchor_buckets - 1);
+    a->nextByNode = attribs->anchor_nodes[h];
+    attribs->anchor_nodes[h] = a;
+
+    ++attribs->anchor_count;
+    return a;
 }
 
 /* return node associated with anchor */
 static Node* GetNodeByAnchor( TidyDocImpl* doc, ctmbstr name )
 {
     TidyAttribImpl* attribs = &doc->attribs;
-    Anchor *found;
-    tmbstr lname = TY_(tmbstrdup)(name);
-    lname = TY_(tmbstrtolower)(lname);
+    Anchor *found = NULL;
+    uint hashval;
+
+    if ( attribs->anchor_count == 0 )
+        return NULL;
 
-    for ( found = attribs->anchor_list; found != NULL; found = found->next )
+    hashval = anchorHash( name );
+    for ( found = attribs->anchor_hash[hashval & (attribs->anchor_buckets - 1)];
+          found != NULL; found = found->next )
     {
-        if ( TY_(tmbstrcmp)(found->name, lname) == 0 )
+        if ( found->hashval == hashval &&
+             TY_(tmbstrcasecmp)(found->name, name) == 0 )
             break;
     }
-    
-    MemFree(lname);
+
     if ( found )
         return found->node;
     return NULL;
 }
 
 /* free all anchors */
-void TY_(FreeAnchors)( TidyDocImpl* doc )
+/* free all anchors, keeping the tables at their size */
+void TY_(ClearAnchors)( TidyDocImpl* doc )
 {
     TidyAttribImpl* attribs = &doc->attribs;
-    Anchor* a;
-    while (NULL != (a = attribs->anchor_list) )
+    Anchor *a, *next;
+    uint i;
+
+    if ( attribs->anchor_count == 0 )
+        return;
+
+    for ( i = 0; i < attribs->anchor_buckets; ++i )
     {
-        attribs->anchor_list = a->next;
-        FreeAnchor(a);
+        for ( a = attribs->anchor_hash[i]; a != NULL; a = next )
+        {
+            next = a->next;
+            FreeAnchor( a );
+        }
+        attribs->anchor_hash[i] = NULL;
+        attribs->anchor_nodes[i] = NULL;
     }
+    attribs->anchor_count = 0;
+}
+
+void TY_(FreeAnchors)( TidyDocImpl* doc )
+{
+    TidyAttribImpl* attribs = &doc->attribs;
+
+    TY_(ClearAnchors)( doc );
+    MemFree( attribs->anchor_hash );
+    MemFree( attribs->anchor_nodes );
+    attribs->anchor_hash = NULL;
+    attribs->anchor_nodes = NULL;
+    attribs->anchor_buckets = 0;
+    attribs->anchor_count = 0;
 }
 
 /* public method for inititializing attribute dictionary */
 void TY_(InitAttrs)( TidyDocImpl* doc )
 {
     ClearMemory( &doc->attribs, sizeof(TidyAttribImpl) );
+#if ATTRIBUTE_HASH_LOOKUP
+    TidyRunOnce( &attrHashOnce, InitAttrHash );
+#endif
+    TidyRunOnce( &attrVersionsOnce, InitAttrVersions );
 #ifdef _DEBUG
     {
       /* Attribute ID is index position in Attribute type lookup table */
@@ -958,9 +1120,6 @@ static void FreeDeclaredAttributes( TidyDocImpl* doc )
     while ( NULL != (dict = attribs->declared_attr_list) )
     {
         attribs->declared_attr_list = dict->next;
-#if ATTRIBUTE_HASH_LOOKUP
-        removeFromHash( &doc->attribs, dict->name );
-#endif
         MemFree( dict->name );
         MemFree( dict );
     }
@@ -968,9 +1127,6 @@ static void FreeDeclaredAttributes( TidyDocImpl* doc )
 
 void TY_(FreeAttrTable)( TidyDocImpl* doc )
 {
-#if ATTRIBUTE_HASH_LOOKUP
-    emptyHash( &doc->attribs );
-#endif
     TY_(FreeAnchors)( doc );
     FreeDeclaredAttributes( doc );
 }
@@ -1036,6 +1192,40 @@ static void AppendToStyleAttr( AttVal *styleattr, ctmbstr styleprop )
     }
 }
 
+/* collect the ids of known attributes occurring more than once;
+** attributes without a dictionary id are never duplicates
+*/
+static Bool FindDuplicateAttrIds( Node* node, AttrIdSet* dups )
+{
+    AttrIdSet seen;
+    AttVal* av;
+    Bool found = no;
+
+    ClearMemory( &seen, sizeof(seen) );
+    ClearMemory( dups, sizeof(*dups) );
+
+    for ( av = node->attributes; av != NULL; av = av->next )
+    {
+        TidyAttrId id;
+
+        if ( av->asp != NULL || av->php != NULL || av->dict == NULL )
+            continue;
+
+        id = av->dict->id;
+        if ( id == TidyAttr_UNKNOWN )
+            continue;
+
+        if ( AttrIdSetHas(&seen, id) )
+        {
+            AttrIdSetAdd( dups, id );
+            found = yes;
+        }
+        else
+            AttrIdSetAdd( &seen, id );
+    }
+    return found;
+}
+
 /*
  the same attribute name can't be used
  more than once in each element
@@ -1043,13 +1233,19 @@ static void AppendToStyleAttr( AttVal *styleattr, ctmbstr styleprop )
 void TY_(RepairDuplicateAttributes)( TidyDocImpl* doc, Node *node)
 {
     AttVal *first;
+    AttrIdSet dups;
+
+    /* common case, checked in a single pass */
+    if ( !FindDuplicateAttrIds(node, &dups) )
+        return;
 
     for (first = node->attributes; first != NULL;)
     {
         AttVal *second;
         Bool firstRedefined = no;
 
-        if (!(first->asp == NULL && first->php == NULL))
+        if (!(first->asp == NULL && first->php == NULL) ||
+            first->dict == NULL || !AttrIdSetHas(&dups, first->dict->id))
         {
             first = first->next;
             continue;
@@ -1113,10 +1309,238 @@ void TY_(RepairDuplicateAttributes)( TidyDocImpl* doc, Node *node)
     }
 }
 
+/* Apple Changes:
+   XSS sanitizer policy.  The element and attribute lists of the
+   _sanitize-allowed-* options are compiled to id bitsets once per
+   document, so that each node and attribute costs a bit test.
+   Without the options the policy removes the elements which could
+   load external content, style and script attributes, and URLs
+   with script or file schemes.
+*/
+#ifdef TIDY_APPLE_CHANGES
+static const TidyTagId sanitizeDeniedTags[] =
+{
+    TidyTag_FRAMESET, TidyTag_SCRIPT, TidyTag_IFRAME, TidyTag_OBJECT,
+    TidyTag_FRAME, TidyTag_EMBED, TidyTag_STYLE, TidyTag_LINK,
+    TidyTag_META, TidyTag_APPLET, TidyTag_UNKNOWN
+};
+
+/* the document structure survives any element list */
+static const TidyTagId sanitizeRequiredTags[] =
+{
+    TidyTag_HTML, TidyTag_HEAD, TidyTag_TITLE, TidyTag_BODY, TidyTag_UNKNOWN
+};
+
+#define TagIdSetHas(s, id)  ((s)[(id) >> 3] & (1u << ((id) & 7)))
+#define TagIdSetAdd(s, id)  ((s)[(id) >> 3] |= (byte)(1u << ((id) & 7)))
+
+static Bool IsPolicySeparator( uint c )
+{
+    return ( c == ' ' || c == ',' || c == '\t' || c == '\r' || c == '\n' );
+}
+
+/* copy the next name of a policy list to buf in lower case and
+** return the position after it, NULL at the end of the list.
+** Names which do not fit are returned empty.
+*/
+static ctmbstr NextPolicyName( ctmbstr list, tmbstr buf, uint size )
+{
+    uint len = 0;
+
+    while ( *list && IsPolicySeparator((byte)*list) )
+        ++list;
+    if ( *list == '\0' )
+        return NULL;
+
+    for ( ; *list && !IsPolicySeparator((byte)*list); ++list )
+    {
+        if ( len + 1 < size )
+            buf[len] = (tmbchar) TY_(ToLower)( (byte)*list );
+        ++len;
+    }
+    buf[ len < size ? len : 0 ] = '\0';
+    return list;
+}
+
+/* element id used by the policy; nodes parsed as XML are
+** matched by name
+*/
+static TidyTagId SanitizeTagId( TidyDocImpl* doc, Node* node )
+{
+    if ( node->tag && node->tag->id != TidyTag_UNKNOWN )
+        return node->tag->id;
+    return TY_(LookupTagId)( doc, node->element );
+}
+
+void TY_(InitSanitizePolicy)( TidyDocImpl* doc )
+{
+    SanitizePolicy* policy = &doc->attribs.sanitize;
+    ctmbstr elements = cfgStr( doc, TidySanitizeAllowedElements );
+    ctmbstr attributes = cfgStr( doc, TidySanitizeAllowedAttributes );
+    ctmbstr schemes = cfgStr( doc, TidySanitizeAllowedUrlSchemes );
+    tmbchar name[64];
+    uint ix;
+
+    ClearMemory( policy, sizeof(SanitizePolicy) );
+
+    if ( elements && *elements )
+    {
+        while ( (elements = NextPolicyName(elements, name, sizeof(name))) != NULL )
+        {
+            TidyTagId tid = TY_(LookupTagId)( doc, name );
+            if ( tid != TidyTag_UNKNOWN )
+                TagIdSetAdd( policy->allowedTags, tid );
+        }
+        for ( ix = 0; sanitizeRequiredTags[ix] != TidyTag_UNKNOWN; ++ix )
+            TagIdSetAdd( policy->allowedTags, sanitizeRequiredTags[ix] );
+    }
+    else
+    {
+        for ( ix = 0; ix < N_TIDY_TAGS; ++ix )
+            TagIdSetAdd( policy->allowedTags, ix );
+        for ( ix = 0; sanitizeDeniedTags[ix] != TidyTag_UNKNOWN; ++ix )
+        {
+            uint tid = sanitizeDeniedTags[ix];
+            policy->allowedTags[tid >> 3] &= (byte) ~(1u << (tid & 7));
+        }
+    }
+
+    /* entries are "attr" for any element or "element@attr" */
+    if ( attributes && *attributes )
+    {
+        while ( (attributes = NextPolicyName(attributes, name, sizeof(name))) != NULL )
+        {
+            tmbstr atnam = name;
+            const Attribute* dict;
+            TidyTagId tid = TidyTag_UNKNOWN;
+
+            while ( *atnam && *atnam != '@' )
+                ++atnam;
+            if ( *atnam == '@' )
+            {
+                *atnam++ = '\0';
+                tid = TY_(LookupTagId)( doc, name );
+                if ( tid == TidyTag_UNKNOWN )
+                    continue;
+            }
+            else
+                atnam = name;
+
+            dict = lookup( doc, &doc->attribs, atnam );
+            if ( dict == NULL || dict->id == TidyAttr_UNKNOWN )
+                continue;
+
+            if ( tid != TidyTag_UNKNOWN )
+                AttrIdSetAdd( &policy->allowedTagAttrs[tid], dict->id );
+            else
+                AttrIdSetAdd( &policy->allowedAttrs, dict->id );
+        }
+    }
+    else
+    {
+        /* unknown attributes (TidyAttr_UNKNOWN) are kept, too */
+        for ( ix = 0; ix < N_TIDY_ATTRIBS; ++ix )
+        {
+            const Attribute* dict = &attribute_defs[ ix ];
+            if ( dict->attrchk != CH_SCRIPT && dict->id != TidyAttr_STYLE )
+                AttrIdSetAdd( &policy->allowedAttrs, dict->id );
+        }
+    }
+
+    policy->urlSchemesAllowed = ( schemes && *schemes );
+    policy->urlSchemes = policy->urlSchemesAllowed ? schemes
+                         : "javascript script vbscript file";
+}
+
+Bool TY_(SanitizeAllowsElement)( TidyDocImpl* doc, Node* node )
+{
+    TidyTagId tid;
+
+    if ( !TY_(nodeIsElement)(node) )
+        return yes;
+    tid = SanitizeTagId( doc, node );
+    return TagIdSetHas( doc->attribs.sanitize.allowedTags, tid ) != 0;
+}
+
+/* The content of elements which could load external content is
+** script, style or fallback for the external content, so it is
+** removed with them.  Other elements left out of an element list
+** are replaced by their content.
+*/
+Bool TY_(SanitizeDropsContent)( TidyDocImpl* doc, Node* node )
+{
+    TidyTagId tid = SanitizeTagId( doc, node );
+    uint ix;
+
+    for ( ix = 0; sanitizeDeniedTags[ix] != TidyTag_UNKNOWN; ++ix )
+    {
+        if ( sanitizeDeniedTags[ix] == tid )
+            return yes;
+    }
+    return no;
+}
+
+static Bool SanitizeAllowsAttribute( TidyDocImpl* doc, Node* node, AttVal* attval )
+{
+    const SanitizePolicy* policy = &doc->attribs.sanitize;
+    TidyAttrId atid = AttrId( attval );
+
+    /* event handlers, including unknown on* ones, are never kept */
+    if ( attval->dict && attval->dict->attrchk == CH_SCRIPT )
+        return no;
+
+    if ( AttrIdSetHas(&policy->allowedAttrs, atid) )
+        return yes;
+    return AttrIdSetHas( &policy->allowedTagAttrs[SanitizeTagId(doc, node)], atid ) != 0;
+}
+
+/* Browsers ignore leading blanks and controls of a URL and any tab
+** or newline within its scheme, so "java&#9;script:" is javascript.
+** URLs without a scheme are always allowed.
+*/
+static Bool SanitizeAllowsUrl( TidyDocImpl* doc, ctmbstr url )
+{
+    const SanitizePolicy* policy = &doc->attribs.sanitize;
+    ctmbstr list = policy->urlSchemes;
+    tmbchar scheme[32], name[32];
+    uint len = 0;
+
+    while ( *url && (byte)*url <= ' ' )
+        ++url;
+
+    for ( ; *url != ':'; ++url )
+    {
+        uint c = (byte)*url;
+
+        if ( c == '\t' || c == '\r' || c == '\n' )
+            continue;
+        if ( !TY_(IsLetter)(c) && !TY_(IsDigit)(c) &&
+             c != '+' && c != '-' && c != '.' )
+            return yes;
+        if ( len + 1 >= sizeof(scheme) )
+            return !policy->urlSchemesAllowed;
+        scheme[len++] = (tmbchar) TY_(ToLower)( c );
+    }
+    if ( len == 0 )
+        return yes;
+    scheme[len] = '\0';
+
+    while ( (list = NextPolicyName(list, name, sizeof(name))) != NULL )
+    {
+        if ( TY_(tmbstrcmp)(name, scheme) == 0 )
+            return policy->urlSchemesAllowed;
+    }
+    return !policy->urlSchemesAllowed;
+}
+#endif
+
 /* ignore unknown attributes for proprietary elements */
 const Attribute* TY_(CheckAttribute)( TidyDocImpl* doc, Node *node, AttVal *attval )
 {
     const Attribute* attribute = attval->dict;
+#ifdef TIDY_APPLE_CHANGES
+    Bool sanitize = cfgBool(doc, TidySanitizeAgainstXSS);
+#endif
 
     if ( attribute != NULL )
     {
@@ -1132,11 +1556,18 @@ const Attribute* TY_(CheckAttribute)( TidyDocImpl* doc, Node *node, AttVal *attv
 
         TY_(ConstrainVersion)(doc, AttributeVersions(node, attval));
         
+#ifdef TIDY_APPLE_CHANGES
+        if (sanitize && !SanitizeAllowsAttribute(doc, node, attval))
+            MarkAttributeForRemoval( attval );
+        else
+#endif
         if (attribute->attrchk)
             attribute->attrchk( doc, node, attval );
     }
-
 #ifdef TIDY_APPLE_CHANGES
+    else if (sanitize && !SanitizeAllowsAttribute(doc, node, attval))
+        MarkAttributeForRemoval( attval );
+
     if (AttributeIsMarkedForRemoval(attval))
     {
         TY_(RemoveAttribute)( doc, node, attval );
@@ -1308,24 +1739,13 @@ void TY_(CheckUrl)( TidyDocImpl* doc, Node *node, AttVal *attval)
 
 /* Apple Changes:
    2007-02-01 iccir If TidySanitizeAgainstXSS is set, remove any URL attribute which contains embedded scripts
+                    (the schemes are checked by the sanitizer policy)
 */
 #ifdef TIDY_APPLE_CHANGES
-    if (cfgBool(doc, TidySanitizeAgainstXSS))
+    if (cfgBool(doc, TidySanitizeAgainstXSS) && !SanitizeAllowsUrl(doc, p))
     {
-        c = p[0];
-        
-        /* Check first character as an optimization. */
-        if (c != 'h' && c != 'H')
-        {
-            if (tmbstrncasecmp(p, "javascript:", 11) == 0 ||
-                tmbstrncasecmp(p, "script:",     7)  == 0 ||
-                tmbstrncasecmp(p, "vbscript:",   9)  == 0 ||
-                tmbstrncasecmp(p, "file:",       5)  == 0)
-            {
-                MarkAttributeForRemoval( attval );
-                return;
-            }
-        }
+        MarkAttributeForRemoval( attval );
+        return;
     }
 #endif
 
@@ -1390,19 +1810,12 @@ void CheckAction( TidyDocImpl* doc, Node *node, AttVal *attval)
 
 /* Apple Changes:
    2007-01-31 iccir If TidySanitizeAgainstXSS is set, remove all on* (onBlur, onClick, etc) attributes
+                    (done by the sanitizer policy in TY_(CheckAttribute) now)
 */
-#ifdef TIDY_APPLE_CHANGES
-void CheckScript( TidyDocImpl* doc, Node *node, AttVal *attval )
-{
-    if ( cfgBool(doc, TidySanitizeAgainstXSS) )
-        MarkAttributeForRemoval( attval );
-}
-#else
 void CheckScript( TidyDocImpl* ARG_UNUSED(doc), Node* ARG_UNUSED(node),
                   AttVal* ARG_UNUSED(attval))
 {
 }
-#endif
 
 Bool TY_(IsValidHTMLID)(ctmbstr id)
 {
@@ -1513,14 +1926,14 @@ void CheckName( TidyDocImpl* doc, Node *node, AttVal *attval)
 
     if ( TY_(IsAnchorElement)(doc, node) )
     {
-        if (cfgBool(doc, TidyXmlOut) && !IsValidNMTOKEN(attval->value))
+        if (cfgFlag(doc, OF_XML_OUT) && !IsValidNMTOKEN(attval->value))
             TY_(ReportAttrError)( doc, node, attval, BAD_ATTRIBUTE_VALUE);
 
         if ((old = GetNodeByAnchor(doc, attval->value)) &&  old != node)
         {
             TY_(ReportAttrError)( doc, node, attval, ANCHOR_NOT_UNIQUE);
         }
-        else
+        else if ( old == NULL )
             AddAnchor( doc, attval->value, node );
     }
 }
@@ -1528,6 +1941,7 @@ void CheckName( TidyDocImpl* doc, Node *node, AttVal *attval)
 /* Apple Changes:
    2007-01-30 iccir Add support for dropping 'class' attributes with a certain prefix
    2007-02-02 iccir When a style attribute is encountered, remove it if TidySanitizeAgainstXSS is set
+                    (done by the sanitizer policy in TY_(CheckAttribute) now)
 */
 #ifdef TIDY_APPLE_CHANGES
 void CheckClass( TidyDocImpl* doc, Node *node, AttVal *attval)
@@ -1545,12 +1959,6 @@ void CheckClass( TidyDocImpl* doc, Node *node, AttVal *attval)
         }
     }
 }
-
-void CheckStyleAttr( TidyDocImpl* doc, Node *node, AttVal *attval)
-{
-    if ( cfgBool(doc, TidySanitizeAgainstXSS) )
-        MarkAttributeForRemoval( attval );
-}
 #endif
 
 void CheckId( TidyDocImpl* doc, Node *node, AttVal *attval )
@@ -1595,7 +2003,7 @@ void CheckId( TidyDocImpl* doc, Node *node, AttVal *attval )
     {
         TY_(ReportAttrError)( doc, node, attval, ANCHOR_NOT_UNIQUE);
     }
-    else
+    else if ( old == NULL )
         AddAnchor( doc, attval->value, node );
 }
 
@@ -31,18 +31,28 @@ struct _Attribute
 
 
 /*
- Anchor/Node linked list
+ Anchor/Node hash table.  Each anchor is chained twice,
+ by its (lower case) name and by its node.
 */
 
 struct _Anchor
 {
-    struct _Anchor *next;
+    struct _Anchor *next;       /* same name bucket */
+    struct _Anchor *nextByNode; /* same node bucket */
     Node *node;
     char *name;
+    uint hashval;               /* hash of name */
 };
 
 typedef struct _Anchor Anchor;
 
+/* initial number of anchor buckets, a power of 2. The table
+** is doubled whenever it holds more anchors than buckets.
+*/
+#if !defined(ANCHOR_HASH_SIZE)
+#define ANCHOR_HASH_SIZE 64u
+#endif
+
 #if !defined(ATTRIBUTE_HASH_LOOKUP)
 #define ATTRIBUTE_HASH_LOOKUP 1
 #endif
@@ -52,26 +62,45 @@ enum
 {
     ATTRIBUTE_HASH_SIZE=178u
 };
+#endif
 
-struct _AttrHash
+/* bit per TidyAttrId */
+typedef struct _AttrIdSet
 {
-    Attribute const*  attr;
-    struct _AttrHash* next;
-};
+    byte bits[ (N_TIDY_ATTRIBS + 7) / 8 ];
+} AttrIdSet;
+
+#define AttrIdSetHas(s, id)  ((s)->bits[(id) >> 3] & (1u << ((id) & 7)))
+#define AttrIdSetAdd(s, id)  ((s)->bits[(id) >> 3] |= (byte)(1u << ((id) & 7)))
 
-typedef struct _AttrHash AttrHash;
+#ifdef TIDY_APPLE_CHANGES
+/*
+ XSS sanitizer policy, compiled from the _sanitize-allowed-*
+ options by InitSanitizePolicy() before the attribute checks.
+*/
+typedef struct _SanitizePolicy
+{
+    byte       allowedTags[ (N_TIDY_TAGS + 7) / 8 ]; /* bit per TidyTagId */
+    AttrIdSet  allowedAttrs;                 /* kept on any element */
+    AttrIdSet  allowedTagAttrs[N_TIDY_TAGS]; /* kept on one element */
+    ctmbstr    urlSchemes;                   /* scheme names */
+    Bool       urlSchemesAllowed;            /* allowlist, else denylist */
+} SanitizePolicy;
 #endif
 
 struct _TidyAttribImpl
 {
     /* anchor/node lookup */
-    Anchor*    anchor_list;
+    Anchor**   anchor_hash;     /* by name */
+    Anchor**   anchor_nodes;    /* by node */
+    uint       anchor_buckets;
+    uint       anchor_count;
 
     /* Declared literal attributes */
     Attribute* declared_attr_list;
 
-#if ATTRIBUTE_HASH_LOOKUP
-    AttrHash*  hashtab[ATTRIBUTE_HASH_SIZE];
+#ifdef TIDY_APPLE_CHANGES
+    SanitizePolicy sanitize;
 #endif
 };
 
@@ -99,6 +128,17 @@ Bool TY_(IsUrl)( TidyDocImpl* doc, ctmbstr attrname );
 
 Bool TY_(IsScript)( TidyDocImpl* doc, ctmbstr attrname );
 
+#ifdef TIDY_APPLE_CHANGES
+/* compile the XSS sanitizer policy from the current options */
+void TY_(InitSanitizePolicy)( TidyDocImpl* doc );
+
+/* should the XSS sanitizer keep this element? */
+Bool TY_(SanitizeAllowsElement)( TidyDocImpl* doc, Node* node );
+
+/* does the XSS sanitizer drop the content of this element with it? */
+Bool TY_(SanitizeDropsContent)( TidyDocImpl* doc, Node* node );
+#endif
+
 /* may id or name serve as anchor? */
 Bool TY_(IsAnchorElement)( TidyDocImpl* doc, Node* node );
 
@@ -121,10 +161,11 @@ Bool TY_(IsCSS1Selector)( ctmbstr buf );
 Bool TY_(IsValidHTMLID)(ctmbstr id);
 Bool TY_(IsValidXMLID)(ctmbstr id);
 
-/* removes anchor for specific node */
+/* removes all anchors for specific node */
 void TY_(RemoveAnchorByNode)( TidyDocImpl* doc, Node *node );
 
-/* free all anchors */
+/* free all anchors, ClearAnchors() keeps the tables for reuse */
+void TY_(ClearAnchors)( TidyDocImpl* doc );
 void TY_(FreeAnchors)( TidyDocImpl* doc );
 
 
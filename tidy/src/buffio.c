@@ -95,26 +95,49 @@ void TIDY_CALL tidyBufClear( TidyBuffer* buf )
    buf->allocated is bigger than allocSize+1 so that a trailing null byte is
    always available.
 */
+static Bool GrowBuffer( TidyBuffer* buf, uint allocSize, uint chunkSize )
+{
+    byte* bp;
+    uint allocAmt = chunkSize;
+
+    if ( 0 == allocAmt )
+        allocAmt = 256;
+    if ( buf->allocated > 0 )
+        allocAmt = buf->allocated;
+    while ( allocAmt < allocSize+1 )
+        allocAmt *= 2;
+
+    bp = (byte*)MemRealloc( buf->bp, allocAmt );
+    if ( bp == NULL )
+        return no;
+    ClearMemory( bp + buf->allocated, allocAmt - buf->allocated );
+    buf->bp = bp;
+    buf->allocated = allocAmt;
+    return yes;
+}
+
 void TIDY_CALL tidyBufCheckAlloc( TidyBuffer* buf, uint allocSize, uint chunkSize )
 {
     assert( buf != NULL );
-    if ( 0 == chunkSize )
-        chunkSize = 256;
+    if ( allocSize+1 > buf->allocated )
+        GrowBuffer( buf, allocSize, chunkSize );
+}
+
+/* Room for allocSize bytes and the trailing null byte, in a single
+** allocation rather than by doubling.  New memory is cleared, as it
+** is by tidyBufCheckAlloc().
+*/
+void TY_(BufReserve)( TidyBuffer* buf, uint allocSize )
+{
+    assert( buf != NULL );
     if ( allocSize+1 > buf->allocated )
     {
-        byte* bp;
-        uint allocAmt = chunkSize;
-        if ( buf->allocated > 0 )
-            allocAmt = buf->allocated;
-        while ( allocAmt < allocSize+1 )
-            allocAmt *= 2;
-
-        bp = (byte*)MemRealloc( buf->bp, allocAmt );
+        byte* bp = (byte*)MemRealloc( buf->bp, allocSize+1 );
         if ( bp != NULL )
         {
-            ClearMemory( bp + buf->allocated, allocAmt - buf->allocated );
+            ClearMemory( bp + buf->allocated, allocSize+1 - buf->allocated );
             buf->bp = bp;
-            buf->allocated = allocAmt;
+            buf->allocated = allocSize+1;
         }
     }
 }
@@ -144,17 +167,23 @@ void TIDY_CALL tidyBufAppend( TidyBuffer* buf, void* vp, uint size )
     assert( buf != NULL );
     if ( vp != NULL && size > 0 )
     {
-        tidyBufCheckAlloc( buf, buf->size + size, 0 );
+        if ( buf->size + size + 1 > buf->allocated &&
+             !GrowBuffer(buf, buf->size + size, 0) )
+            return;
         memcpy( buf->bp + buf->size, vp, size );
         buf->size += size;
+        buf->bp[ buf->size ] = 0;
     }
 }
 
 void TIDY_CALL tidyBufPutByte( TidyBuffer* buf, byte bv )
 {
     assert( buf != NULL );
-    tidyBufCheckAlloc( buf, buf->size + 1, 0 );
+    if ( buf->size + 2 > buf->allocated &&
+         !GrowBuffer(buf, buf->size + 1, 0) )
+        return;
     buf->bp[ buf->size++ ] = bv;
+    buf->bp[ buf->size ] = 0;
 }
 
 
@@ -2253,231 +2253,6 @@ void TY_(VerifyHTTPEquiv)(TidyDocImpl* pDoc, Node *head)
     }
 }
 
-void TY_(DropComments)(TidyDocImpl* doc, Node* node)
-{
-    Node* next;
-
-    while (node)
-    {
-        next = node->next;
-
-        if (node->type == CommentTag)
-        {
-            TY_(RemoveNode)(node);
-            TY_(FreeNode)(doc, node);
-            node = next;
-            continue;
-        }
-
-        if (node->content)
-            TY_(DropComments)(doc, node->content);
-
-        node = next;
-    }
-}
-
-void TY_(DropFontElements)(TidyDocImpl* doc, Node* node, Node **ARG_UNUSED(pnode))
-{
-    Node* next;
-
-    while (node)
-    {
-        next = node->next;
-
-        if (nodeIsFONT(node))
-        {
-            DiscardContainer(doc, node, &next);
-            node = next;
-            continue;
-        }
-
-        if (node->content)
-            TY_(DropFontElements)(doc, node->content, &next);
-
-        node = next;
-    }
-}
-
-void TY_(WbrToSpace)(TidyDocImpl* doc, Node* node)
-{
-    Node* next;
-
-    while (node)
-    {
-        next = node->next;
-
-        if (nodeIsWBR(node))
-        {
-            Node* text;
-            text = TY_(NewLiteralTextNode)(doc->lexer, " ");
-            TY_(InsertNodeAfterElement)(node, text);
-            TY_(RemoveNode)(node);
-            TY_(FreeNode)(doc, node);
-            node = next;
-            continue;
-        }
-
-        if (node->content)
-            TY_(WbrToSpace)(doc, node->content);
-
-        node = next;
-   }
-}
-
-/*
-  Filters from Word and PowerPoint often use smart
-  quotes resulting in character codes between 128
-  and 159. Unfortunately, the corresponding HTML 4.0
-  entities for these are not widely supported. The
-  following converts dashes and quotation marks to
-  the nearest ASCII equivalent. My thanks to
-  Andrzej Novosiolov for his help with this code.
-
-  Note: The old code in the pretty printer applied
-  this to all node types and attribute values while
-  this routine applies it only to text nodes. First,
-  Microsoft Office products rarely put the relevant
-  characters into these tokens, second support for
-  them is much better now and last but not least, it
-  can be harmful to replace these characters since
-  US-ASCII quote marks are often used as syntax
-  characters, a simple
-
-    <a onmouseover="alert('&#x2018;')">...</a>
-
-  would be broken if the U+2018 is replaced by "'".
-  The old code would neither take care whether the
-  quote mark is already used as delimiter,
-
-    <p title='&#x2018;'>...</p>
-
-  got
-  
-    <p title='''>...</p>
-
-  Since browser support is much better nowadays and
-  high-quality typography is better than ASCII it'd
-  be probably a good idea to drop the feature...
-*/
-void TY_(DowngradeTypography)(TidyDocImpl* doc, Node* node)
-{
-    Node* next;
-    Lexer* lexer = doc->lexer;
-
-    while (node)
-    {
-        next = node->next;
-
-        if (TY_(nodeIsText)(node))
-        {
-            uint i, c;
-            tmbstr p = lexer->lexbuf + node->start;
-
-            for (i = node->start; i < node->end; ++i)
-            {
-                uint utf8BytesRead = 1, utf8BytesWritten = 0;
-                tmbchar tempbuf[10] = {0};
-                tmbstr result = NULL;
-                c = (unsigned char) lexer->lexbuf[i];
-
-                if (c > 0x7F)
-                    utf8BytesRead += TY_(GetUTF8)(lexer->lexbuf + i, &c);
-
-                if (c >= 0x2013 && c <= 0x201E)
-                {
-                    switch (c)
-                    {
-                    case 0x2013: /* en dash */
-                    case 0x2014: /* em dash */
-                        c = '-';
-                        break;
-                    case 0x2018: /* left single  quotation mark */
-                    case 0x2019: /* right single quotation mark */
-                    case 0x201A: /* single low-9 quotation mark */
-                        c = '\'';
-                        break;
-                    case 0x201C: /* left double  quotation mark */
-                    case 0x201D: /* right double quotation mark */
-                    case 0x201E: /* double low-9 quotation mark */
-                        c = '"';
-                        break;
-                    }
-                }
-
-                result = TY_(PutUTF8)(&tempbuf[0], c);
-                utf8BytesWritten = (result > &tempbuf[0]) ? (uint)(result - &tempbuf[0]) : 0;
-                if ( utf8BytesWritten == 0 ) {
-                    (lexer->lexbuf + i)[0] = (tmbchar) c;
-                    ++p;
-                }
-                else if ( utf8BytesRead >= utf8BytesWritten ) {
-                    memmove(&(lexer->lexbuf + i)[0], &tempbuf[0], utf8BytesWritten);
-                    i += utf8BytesRead - 1; /* Offset ++i in for loop. */
-                    p += utf8BytesWritten;
-                } else {
-                    /* Error; keep this byte and move to the next. */
-                    if ( c != 0xFFFD && utf8BytesRead != utf8BytesWritten ) {
-#if 1 && defined(_DEBUG)
-                        fprintf(stderr, ">>> utf8BytesRead = %u, utf8BytesWritten = %u\n", utf8BytesRead, utf8BytesWritten);
-                        fprintf(stderr, ">>> i = %d, c = %u\n", i, c);
-#endif
-                        assert( utf8BytesRead == utf8BytesWritten ); /* Can't extend buffer. */
-                    }
-                    ++p;
-                }
-            }
-
-            intptr_t pos = (p > lexer->lexbuf) ? (p - lexer->lexbuf) : 0;
-            node->end = (pos >= node->start && pos <= node->end) ? (uint)pos : node->end;
-        }
-
-        if (node->content)
-            TY_(DowngradeTypography)(doc, node->content);
-
-        node = next;
-    }
-}
-
-void TY_(ReplacePreformattedSpaces)(TidyDocImpl* doc, Node* node)
-{
-    Node* next;
-
-    while (node)
-    {
-        next = node->next;
-
-        if (node->tag && node->tag->parser == TY_(ParsePre))
-        {
-            TY_(NormalizeSpaces)(doc->lexer, node->content);
-            node = next;
-            continue;
-        }
-
-        if (node->content)
-            TY_(ReplacePreformattedSpaces)(doc, node->content);
-
-        node = next;
-    }
-}
-
-void TY_(ConvertCDATANodes)(TidyDocImpl* doc, Node* node)
-{
-    Node* next;
-
-    while (node)
-    {
-        next = node->next;
-
-        if (node->type == CDATATag)
-            node->type = TextNode;
-
-        if (node->content)
-            TY_(ConvertCDATANodes)(doc, node->content);
-
-        node = next;
-    }
-}
-
 /*
   FixLanguageInformation ensures that the document contains (only)
   the attributes for language information desired by the output
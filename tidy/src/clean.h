@@ -71,13 +71,7 @@ void TY_(FixBrakes)( TidyDocImpl* pDoc, Node *pParent );
 
 void TY_(VerifyHTTPEquiv)( TidyDocImpl* pDoc, Node *pParent );
 
-void TY_(DropComments)(TidyDocImpl* doc, Node* node);
-void TY_(DropFontElements)(TidyDocImpl* doc, Node* node, Node **pnode);
-void TY_(WbrToSpace)(TidyDocImpl* doc, Node* node);
-void TY_(DowngradeTypography)(TidyDocImpl* doc, Node* node);
-void TY_(ReplacePreformattedSpaces)(TidyDocImpl* doc, Node* node);
 void TY_(NormalizeSpaces)(Lexer *lexer, Node *node);
-void TY_(ConvertCDATANodes)(TidyDocImpl* doc, Node* node);
 
 void TY_(FixAnchors)(TidyDocImpl* doc, Node *node, Bool wantName, Bool wantId);
 void TY_(FixXhtmlNamespace)(TidyDocImpl* doc, Bool wantXmlns);
@@ -57,6 +57,7 @@
 void TY_(InitConfig)( TidyDocImpl* doc )
 {
     ClearMemory( &doc->config, sizeof(TidyConfigImpl) );
+    doc->config.value = doc->config.own;
     TY_(ResetConfigToDefault)( doc );
 }
 
@@ -192,6 +193,9 @@ static ParseProperty ParseString;
 /* a space or comma separated list of tag names */
 static ParseProperty ParseTagNames;
 
+/* a space or comma separated list of message codes */
+static ParseProperty ParseMuteCodes;
+
 /* RAW, ASCII, LATIN0, LATIN1, UTF8, ISO2022, MACROMAN, 
    WIN1252, IBM858, UTF16LE, UTF16BE, UTF16, BIG5, SHIFTJIS
 */
@@ -309,17 +313,122 @@ static const TidyOptionImpl option_defs[] =
   { TidyDropClassesWithPrefix,   MU, "_drop-classes-with-prefix",   ST, 0,               ParseString,       NULL,            NULL },
   { TidyDropIdsWithPrefix,       MU, "_drop-ids-with-prefix",       ST, 0,               ParseString,       NULL,            NULL },
   { TidySanitizeAgainstXSS,      MU, "_sanitize-against-xss",       BL, no,              ParseBool,         boolPicks,       NULL },
+  { TidySanitizeAllowedElements, MU, "_sanitize-allowed-elements",  ST, 0,               ParseString,       NULL,            NULL },
+  { TidySanitizeAllowedAttributes, MU, "_sanitize-allowed-attributes", ST, 0,            ParseString,       NULL,            NULL },
+  { TidySanitizeAllowedUrlSchemes, MU, "_sanitize-allowed-url-schemes", ST, 0,           ParseString,       NULL,            NULL },
 #endif
+  { TidyMinify,                  PP, "minify",                      BL, no,              ParseBool,         boolPicks,       NULL },
+  { TidyPrintThreads,            PP, "print-threads",               IN, 0,               ParseInt,          NULL,            NULL },
+  { TidyPrintCache,              PP, "print-cache",                 BL, no,              ParseBool,         boolPicks,       NULL },
+  { TidyMuteMessages,            DG, "mute",                        ST, 0,               ParseMuteCodes,    NULL,            NULL },
+  { TidyJsonMessages,            DG, "json-messages",               BL, no,              ParseBool,         boolPicks,       NULL },
   { N_TIDY_OPTIONS,              XX, NULL,                          XY, 0,               NULL,              NULL,            NULL }
 };
 
-/* Should only be called by options set by name
-** thus, it is cheaper to do a few scans than set
-** up every option in a hash table.
+/*
+ Name index of option_defs, shared by all documents.  It is a
+ perfect hash: the case folded hash of a name picks a bucket, and
+ the seed of the bucket, chosen when the index is built, picks a
+ slot that no other name has.  So a lookup compares one name.
+ Slots hold positions in option_defs plus one, 0 when free.
+ InitOptionHash() builds it once, later it is only read.
+*/
+#define OPTION_HASH_BUCKETS   64u
+#define OPTION_HASH_SLOTS    256u   /* multiplier below yields 8 bits */
+#define OPTION_HASH_SEEDS    256u   /* seeds to try for a bucket */
+
+static unsigned short optHashSlot[ OPTION_HASH_SLOTS ];
+static unsigned char optHashSeed[ OPTION_HASH_BUCKETS ];
+static Bool optHashPerfect = no;
+static TidyOnce optHashOnce = TIDY_ONCE_INIT;
+
+static uint OptionNameHash( ctmbstr s )
+{
+    uint hashval;
+
+    for ( hashval = 0; *s != '\0'; s++ )
+        hashval = TY_(ToLower)( (byte)*s ) + 31*hashval;
+
+    return hashval;
+}
+
+static uint OptionHashSlot( uint hashval, uint seed )
+{
+    return ( (hashval ^ (seed * 0x9E3779B9u)) * 2654435761u ) >> 24;
+}
+
+static void InitOptionHash(void)
+{
+    unsigned short* slot = optHashSlot;
+    unsigned char* seed = optHashSeed;
+    uint hashval[ N_TIDY_OPTIONS ], count[ OPTION_HASH_BUCKETS ];
+    uint ix, b, size, maxsize = 0;
+    Bool perfect = yes;
+
+    ClearMemory( count, sizeof(count) );
+    for ( ix = 0; ix < N_TIDY_OPTIONS; ++ix )
+    {
+        hashval[ix] = OptionNameHash( option_defs[ix].name );
+        b = hashval[ix] % OPTION_HASH_BUCKETS;
+        if ( ++count[b] > maxsize )
+            maxsize = count[b];
+    }
+
+    /* place the fullest buckets first, while most slots are free */
+    for ( size = maxsize; perfect && size > 0; --size )
+    {
+        for ( b = 0; perfect && b < OPTION_HASH_BUCKETS; ++b )
+        {
+            uint s;
+            if ( count[b] != size )
+                continue;
+            for ( s = 0; s < OPTION_HASH_SEEDS; ++s )
+            {
+                unsigned short used[ OPTION_HASH_SLOTS ];
+                memcpy( used, slot, sizeof(used) );
+                for ( ix = 0; ix < N_TIDY_OPTIONS; ++ix )
+                {
+                    uint h;
+                    if ( hashval[ix] % OPTION_HASH_BUCKETS != b )
+                        continue;
+                    h = OptionHashSlot( hashval[ix], s );
+                    if ( used[h] != 0 )
+                        break;
+                    used[h] = (unsigned short)( ix + 1 );
+                }
+                if ( ix == N_TIDY_OPTIONS )
+                {
+                    memcpy( slot, used, sizeof(used) );
+                    seed[b] = (unsigned char) s;
+                    break;
+                }
+            }
+            perfect = ( s < OPTION_HASH_SEEDS );
+        }
+    }
+
+    optHashPerfect = perfect;
+}
+
+/* Called for options set by name: from config files, the
+** command line, tidyOptParseValue() and the like.
 */
 const TidyOptionImpl* TY_(lookupOption)( ctmbstr s )
 {
     const TidyOptionImpl* np = option_defs;
+
+    TidyRunOnce( &optHashOnce, InitOptionHash );
+    if ( optHashPerfect )
+    {
+        uint hashval = OptionNameHash( s );
+        uint seed = optHashSeed[ hashval % OPTION_HASH_BUCKETS ];
+        uint ix = optHashSlot[ OptionHashSlot(hashval, seed) ];
+        if ( ix > 0 && TY_(tmbstrcasecmp)(s, option_defs[ix-1].name) == 0 )
+            return option_defs + ix - 1;
+        return NULL;
+    }
+
+    /* no perfect hash found: scan */
     for ( /**/; np < option_defs + N_TIDY_OPTIONS; ++np )
     {
         if ( TY_(tmbstrcasecmp)(s, np->name) == 0 )
@@ -362,15 +471,73 @@ static void CopyOptionValue( const TidyOptionImpl* option,
 }
 
 
+/* Gives the document its own copy of the values of a profile
+** before one of them is changed.  Returns the values to write to.
+*/
+static TidyOptionValue* OwnConfig( TidyDocImpl* doc )
+{
+    TidyConfigImpl* cfg = &doc->config;
+    if ( cfg->profile )
+    {
+        uint ixVal;
+        const TidyOptionImpl* option = option_defs;
+        const TidyOptionValue* shared = &cfg->profile->value[ 0 ];
+        for ( ixVal=0; ixVal < N_TIDY_OPTIONS; ++option, ++ixVal )
+        {
+            assert( ixVal == (uint) option->id );
+            CopyOptionValue( option, &cfg->own[ixVal], &shared[ixVal] );
+        }
+        cfg->value = cfg->own;
+        cfg->profile = NULL;
+    }
+    return cfg->value;
+}
+
+/* Resolves the options of the hot paths into doc->optflags */
+static void AdjustOptionFlags( TidyDocImpl* doc )
+{
+    TidyOptionFlags* of = &doc->optflags;
+    uint flags = 0;
+
+    if ( cfgBool(doc, TidyXmlTags) )
+        flags |= OF_XML_TAGS;
+    if ( cfgBool(doc, TidyXmlOut) )
+        flags |= OF_XML_OUT;
+    if ( cfgBool(doc, TidyXhtmlOut) )
+        flags |= OF_XHTML_OUT;
+    if ( cfgBool(doc, TidyNumEntities) )
+        flags |= OF_NUM_ENTITIES;
+    if ( cfgBool(doc, TidyQuoteAmpersand) )
+        flags |= OF_QUOTE_AMP;
+    if ( cfgBool(doc, TidyQuoteMarks) )
+        flags |= OF_QUOTE_MARKS;
+    if ( cfgBool(doc, TidyQuoteNbsp) )
+        flags |= OF_QUOTE_NBSP;
+    if ( cfgBool(doc, TidyPunctWrap) )
+        flags |= OF_PUNCT_WRAP;
+    if ( cfgBool(doc, TidyLiteralAttribs) )
+        flags |= OF_LITERAL_ATTRS;
+
+    of->flags = flags;
+    of->tabsize = (uint) cfg( doc, TidyTabSize );
+    of->wraplen = (uint) cfg( doc, TidyWrapLen );
+    of->outenc = (uint) cfg( doc, TidyOutCharEncoding );
+}
+
 static Bool SetOptionValue( TidyDocImpl* doc, TidyOptionId optId, ctmbstr val )
 {
    const TidyOptionImpl* option = &option_defs[ optId ];
    Bool status = ( optId < N_TIDY_OPTIONS );
    if ( status )
    {
+      TidyOptionValue* value = &doc->config.value[ optId ];
       assert( option->id == optId && option->type == TidyString );
-      FreeOptionValue( option, &doc->config.value[ optId ] );
-      doc->config.value[ optId ].p = TY_(tmbstrdup)( val );
+      if ( value->p == val ||
+           ( value->p && val && TY_(tmbstrcmp)(value->p, val) == 0 ) )
+          return status;
+      value = &OwnConfig( doc )[ optId ];
+      FreeOptionValue( option, value );
+      value->p = TY_(tmbstrdup)( val );
    }
    return status;
 }
@@ -381,7 +548,11 @@ Bool TY_(SetOptionInt)( TidyDocImpl* doc, TidyOptionId optId, ulong val )
    if ( status )
    {
        assert( option_defs[ optId ].type == TidyInteger );
-       doc->config.value[ optId ].v = val;
+       if ( doc->config.value[ optId ].v != val )
+       {
+           OwnConfig( doc )[ optId ].v = val;
+           AdjustOptionFlags( doc );
+       }
    }
    return status;
 }
@@ -392,7 +563,11 @@ Bool TY_(SetOptionBool)( TidyDocImpl* doc, TidyOptionId optId, Bool val )
    if ( status )
    {
        assert( option_defs[ optId ].type == TidyBoolean );
-       doc->config.value[ optId ].v = val;
+       if ( doc->config.value[ optId ].v != (ulong) val )
+       {
+           OwnConfig( doc )[ optId ].v = val;
+           AdjustOptionFlags( doc );
+       }
    }
    return status;
 }
@@ -414,6 +589,28 @@ static Bool OptionValueEqDefault( const TidyOptionImpl* option,
         val->v == option->dflt;
 }
 
+/* Sets the bits of doc->muted from the mute option */
+static void AdjustMuted( TidyDocImpl* doc )
+{
+    ctmbstr codes = cfgStr( doc, TidyMuteMessages );
+
+    ClearMemory( doc->muted, sizeof(doc->muted) );
+    while ( codes && *codes )
+    {
+        uint code = 0;
+
+        if ( !TY_(IsDigit)(*codes) )
+        {
+            ++codes;
+            continue;
+        }
+        while ( TY_(IsDigit)(*codes) )
+            code = *codes++ - '0' + (10 * code);
+        if ( code < N_MESSAGE_CODES )
+            doc->muted[ code/32 ] |= ( 1u << (code%32) );
+    }
+}
+
 Bool TY_(ResetOptionToDefault)( TidyDocImpl* doc, TidyOptionId optId )
 {
     Bool status = ( optId > 0 && optId < N_TIDY_OPTIONS );
@@ -421,10 +618,15 @@ Bool TY_(ResetOptionToDefault)( TidyDocImpl* doc, TidyOptionId optId )
     {
         TidyOptionValue dflt;
         const TidyOptionImpl* option = option_defs + optId;
-        TidyOptionValue* value = &doc->config.value[ optId ];
         assert( optId == option->id );
         GetOptionDefault( option, &dflt );
-        CopyOptionValue( option, value, &dflt );
+        if ( !OptionValueEqDefault(option, &doc->config.value[optId]) )
+        {
+            CopyOptionValue( option, &OwnConfig(doc)[optId], &dflt );
+            AdjustOptionFlags( doc );
+        }
+        if ( optId == TidyMuteMessages )
+            AdjustMuted( doc );
     }
     return status;
 }
@@ -492,8 +694,9 @@ static void ReparseTagDecls( TidyDocImpl* doc, uint changedUserTags  )
 #define REPARSE_USERTAGS(USERTAGOPTION,USERTAGTYPE) \
     if ( changedUserTags & USERTAGTYPE ) \
     { \
-        TY_(FreeDeclaredTags)( doc, USERTAGTYPE ); \
+        TY_(RetireDeclaredTags)( doc, USERTAGTYPE ); \
         ReparseTagType( doc, USERTAGOPTION ); \
+        TY_(PurgeRetiredTags)( doc ); \
     }
     REPARSE_USERTAGS(TidyInlineTags,tagtype_inline);
     REPARSE_USERTAGS(TidyBlockTags,tagtype_block);
@@ -505,7 +708,10 @@ void TY_(ResetConfigToDefault)( TidyDocImpl* doc )
 {
     uint ixVal;
     const TidyOptionImpl* option = option_defs;
-    TidyOptionValue* value = &doc->config.value[ 0 ];
+    TidyOptionValue* value = doc->config.own;
+
+    doc->config.value = doc->config.own;
+    doc->config.profile = NULL;
     for ( ixVal=0; ixVal < N_TIDY_OPTIONS; ++option, ++ixVal )
     {
         TidyOptionValue dflt;
@@ -514,16 +720,25 @@ void TY_(ResetConfigToDefault)( TidyDocImpl* doc )
         CopyOptionValue( option, &value[ixVal], &dflt );
     }
     TY_(FreeDeclaredTags)( doc, tagtype_null );
+    AdjustMuted( doc );
+    AdjustOptionFlags( doc );
 }
 
 void TY_(TakeConfigSnapshot)( TidyDocImpl* doc )
 {
     uint ixVal;
     const TidyOptionImpl* option = option_defs;
-    const TidyOptionValue* value = &doc->config.value[ 0 ];
+    const TidyOptionValue* value;
     TidyOptionValue* snap  = &doc->config.snapshot[ 0 ];
 
     AdjustConfig( doc );  /* Make sure it's consistent */
+
+    /* Values still shared with a profile are the snapshot */
+    doc->config.snapprofile = doc->config.profile;
+    if ( doc->config.profile )
+        return;
+
+    value = doc->config.value;
     for ( ixVal=0; ixVal < N_TIDY_OPTIONS; ++option, ++ixVal )
     {
         assert( ixVal == (uint) option->id );
@@ -535,12 +750,21 @@ void TY_(ResetConfigToSnapshot)( TidyDocImpl* doc )
 {
     uint ixVal;
     const TidyOptionImpl* option = option_defs;
-    TidyOptionValue* value = &doc->config.value[ 0 ];
+    TidyOptionValue* value = doc->config.value;
     const TidyOptionValue* snap  = &doc->config.snapshot[ 0 ];
     uint changedUserTags;
-    Bool needReparseTagsDecls = NeedReparseTagDecls( doc, value, snap,
-                                                     &changedUserTags );
+    Bool needReparseTagsDecls;
+
+    if ( doc->config.snapprofile )
+    {
+        TY_(ApplyProfile)( doc, doc->config.snapprofile );
+        return;
+    }
 
+    needReparseTagsDecls = NeedReparseTagDecls( doc, value, snap,
+                                                &changedUserTags );
+    value = doc->config.value = doc->config.own;
+    doc->config.profile = NULL;
     for ( ixVal=0; ixVal < N_TIDY_OPTIONS; ++option, ++ixVal )
     {
         assert( ixVal == (uint) option->id );
@@ -548,6 +772,8 @@ void TY_(ResetConfigToSnapshot)( TidyDocImpl* doc )
     }
     if ( needReparseTagsDecls )
         ReparseTagDecls( doc, changedUserTags );
+    AdjustMuted( doc );
+    AdjustOptionFlags( doc );
 }
 
 void TY_(CopyConfig)( TidyDocImpl* docTo, TidyDocImpl* docFrom )
@@ -556,13 +782,21 @@ void TY_(CopyConfig)( TidyDocImpl* docTo, TidyDocImpl* docFrom )
     {
         uint ixVal;
         const TidyOptionImpl* option = option_defs;
-        const TidyOptionValue* from = &docFrom->config.value[ 0 ];
-        TidyOptionValue* to   = &docTo->config.value[ 0 ];
+        const TidyOptionValue* from = docFrom->config.value;
+        TidyOptionValue* to;
         uint changedUserTags;
-        Bool needReparseTagsDecls = NeedReparseTagDecls( docTo, to, from,
-                                                         &changedUserTags );
+        Bool needReparseTagsDecls;
 
         TY_(TakeConfigSnapshot)( docTo );
+        if ( docFrom->config.profile )
+        {
+            TY_(ApplyProfile)( docTo, docFrom->config.profile );
+            return;
+        }
+
+        needReparseTagsDecls = NeedReparseTagDecls( docTo, docTo->config.value,
+                                                    from, &changedUserTags );
+        to = OwnConfig( docTo );
         for ( ixVal=0; ixVal < N_TIDY_OPTIONS; ++option, ++ixVal )
         {
             assert( ixVal == (uint) option->id );
@@ -574,6 +808,102 @@ void TY_(CopyConfig)( TidyDocImpl* docTo, TidyDocImpl* docFrom )
     }
 }
 
+/* Compiles the current, adjusted, option values into a profile.
+** The profile is released with FreeProfile() once no document
+** uses it any more.
+*/
+TidyProfileImpl* TY_(CompileProfile)( TidyDocImpl* doc )
+{
+    uint ixVal;
+    const TidyOptionImpl* option = option_defs;
+    const TidyOptionValue* value;
+    TidyProfileImpl* profile = (TidyProfileImpl*) MemAlloc( sizeof(TidyProfileImpl) );
+
+    ClearMemory( profile, sizeof(TidyProfileImpl) );
+    AdjustConfig( doc );  /* Make sure it's consistent */
+    value = doc->config.value;
+    for ( ixVal=0; ixVal < N_TIDY_OPTIONS; ++option, ++ixVal )
+    {
+        assert( ixVal == (uint) option->id );
+        CopyOptionValue( option, &profile->value[ixVal], &value[ixVal] );
+    }
+    return profile;
+}
+
+/* Makes the document use the values of the profile, without copying
+** them.  Only the declarations of user tags, when the profile or the
+** document has any, are made again.
+*/
+void TY_(ApplyProfile)( TidyDocImpl* doc, const TidyProfileImpl* profile )
+{
+    TidyConfigImpl* cfg = &doc->config;
+    TidyOptionValue* shared = (TidyOptionValue*) profile->value;
+    uint changedUserTags = tagtype_null;
+
+    if ( cfg->value == shared )
+        return;
+
+    if ( cfg->defined_tags || shared[TidyInlineTags].p ||
+         shared[TidyBlockTags].p || shared[TidyEmptyTags].p ||
+         shared[TidyPreTags].p )
+        NeedReparseTagDecls( doc, cfg->value, shared, &changedUserTags );
+
+    cfg->value = shared;
+    cfg->profile = profile;
+    if ( changedUserTags )
+    {
+        /* Declaring the tags sets the same values again */
+        ReparseTagDecls( doc, changedUserTags );
+        cfg->value = shared;
+        cfg->profile = profile;
+    }
+    AdjustMuted( doc );
+    AdjustOptionFlags( doc );
+}
+
+void TY_(FreeProfile)( TidyProfileImpl* profile )
+{
+    uint ixVal;
+    const TidyOptionImpl* option = option_defs;
+
+    for ( ixVal=0; ixVal < N_TIDY_OPTIONS; ++option, ++ixVal )
+        FreeOptionValue( option, &profile->value[ixVal] );
+    MemFree( profile );
+}
+
+/* Tells whether the current values differ from those in vals, and
+** copies them there.  vals holds N_TIDY_OPTIONS values, cleared
+** before first use and released with FreeConfigCopy().
+*/
+Bool TY_(UpdateConfigCopy)( TidyDocImpl* doc, TidyOptionValue* vals )
+{
+    uint ixVal;
+    const TidyOptionImpl* option = option_defs;
+    const TidyOptionValue* value = &doc->config.value[ 0 ];
+    Bool changed = no;
+
+    for ( ixVal=0; ixVal < N_TIDY_OPTIONS; ++option, ++ixVal )
+    {
+        assert( ixVal == (uint) option->id );
+        if ( !OptionValueIdentical(option, &vals[ixVal], &value[ixVal]) )
+        {
+            CopyOptionValue( option, &vals[ixVal], &value[ixVal] );
+            changed = yes;
+        }
+    }
+    return changed;
+}
+
+void TY_(FreeConfigCopy)( TidyOptionValue* vals )
+{
+    uint ixVal;
+    const TidyOptionImpl* option = option_defs;
+
+    for ( ixVal=0; ixVal < N_TIDY_OPTIONS; ++option, ++ixVal )
+        FreeOptionValue( option, &vals[ixVal] );
+    MemFree( vals );
+}
+
 
 #ifdef _DEBUG
 
@@ -776,99 +1106,106 @@ int TY_(ParseConfigFile)( TidyDocImpl* doc, ctmbstr file )
     return TY_(ParseConfigFileEnc)( doc, file, "ascii" );
 }
 
-/* open the file and parse its contents
+/* parse the properties read from the input source
 */
-int TY_(ParseConfigFileEnc)( TidyDocImpl* doc, ctmbstr file, ctmbstr charenc )
+static void ParseConfigStream( TidyDocImpl* doc, StreamIn* in )
 {
-    uint opterrs = doc->optionErrors;
-    tmbstr fname = (tmbstr) ExpandTilde( file );
     TidyConfigImpl* cfg = &doc->config;
-    FILE* fin = fopen( fname, "r" );
-    int enc = TY_(CharEncodingId)( charenc );
-
-    if ( fin == NULL || enc < 0 )
+    tchar c;
+    cfg->cfgIn = in;
+    c = FirstChar( cfg );
+   
+    for ( c = SkipWhite(cfg); c != EndOfStream; c = NextProperty(cfg) )
     {
-        TY_(FileError)( doc, fname, TidyConfig );
-        return -1;
-    }
-    else
-    {
-        tchar c;
-        cfg->cfgIn = TY_(FileInput)( doc, fin, enc );
-        c = FirstChar( cfg );
-       
-        for ( c = SkipWhite(cfg); c != EndOfStream; c = NextProperty(cfg) )
-        {
-            uint ix = 0;
-            tmbchar name[ TIDY_MAX_NAME ] = {0};
+        uint ix = 0;
+        tmbchar name[ TIDY_MAX_NAME ] = {0};
 
-            /* // or # start a comment */
-            if ( c == '/' || c == '#' )
-                continue;
+        /* // or # start a comment */
+        if ( c == '/' || c == '#' )
+            continue;
 
-            while ( ix < sizeof(name)-1 && c != '\n' && c != EndOfStream && c != ':' )
-            {
-                name[ ix++ ] = (tmbchar) c;  /* Option names all ASCII */
-                c = AdvanceChar( cfg );
-            }
+        while ( ix < sizeof(name)-1 && c != '\n' && c != EndOfStream && c != ':' )
+        {
+            name[ ix++ ] = (tmbchar) c;  /* Option names all ASCII */
+            c = AdvanceChar( cfg );
+        }
 
-            if ( c == ':' )
+        if ( c == ':' )
+        {
+            const TidyOptionImpl* option = TY_(lookupOption)( name );
+            c = AdvanceChar( cfg );
+            if ( option )
+                option->parser( doc, option );
+            else
             {
-                const TidyOptionImpl* option = TY_(lookupOption)( name );
-                c = AdvanceChar( cfg );
-                if ( option )
-                    option->parser( doc, option );
-                else
+                if (NULL != doc->pOptCallback)
                 {
-                    if (NULL != doc->pOptCallback)
-                    {
-                        TidyConfigImpl* cfg = &doc->config;
-                        tmbchar buf[8192];
-                        uint i = 0;
-                        tchar delim = 0;
-                        Bool waswhite = yes;
+                    TidyConfigImpl* cfg = &doc->config;
+                    tmbchar buf[8192];
+                    uint i = 0;
+                    tchar delim = 0;
+                    Bool waswhite = yes;
 
-                        tchar c = SkipWhite( cfg );
+                    tchar c = SkipWhite( cfg );
 
-                        if ( c == '"' || c == '\'' )
-                        {
-                            delim = c;
-                            c = AdvanceChar( cfg );
-                        }
+                    if ( c == '"' || c == '\'' )
+                    {
+                        delim = c;
+                        c = AdvanceChar( cfg );
+                    }
 
-                        while ( i < sizeof(buf)-2 && c != EndOfStream && c != '\r' && c != '\n' )
-                        {
-                            if ( delim && c == delim )
-                                break;
+                    while ( i < sizeof(buf)-2 && c != EndOfStream && c != '\r' && c != '\n' )
+                    {
+                        if ( delim && c == delim )
+                            break;
 
-                            if ( TY_(IsWhite)(c) )
+                        if ( TY_(IsWhite)(c) )
+                        {
+                            if ( waswhite )
                             {
-                                if ( waswhite )
-                                {
-                                    c = AdvanceChar( cfg );
-                                    continue;
-                                }
-                                c = ' ';
+                                c = AdvanceChar( cfg );
+                                continue;
                             }
-                            else
-                                waswhite = no;
-
-                            buf[i++] = (tmbchar) c;
-                            c = AdvanceChar( cfg );
+                            c = ' ';
                         }
-                        buf[i] = '\0';
-                        if (no == (*doc->pOptCallback)( name, buf ))
-                            TY_(ReportUnknownOption)( doc, name );
+                        else
+                            waswhite = no;
+
+                        buf[i++] = (tmbchar) c;
+                        c = AdvanceChar( cfg );
                     }
-                    else
+                    buf[i] = '\0';
+                    if (no == (*doc->pOptCallback)( name, buf ))
                         TY_(ReportUnknownOption)( doc, name );
                 }
+                else
+                    TY_(ReportUnknownOption)( doc, name );
             }
         }
+    }
+    cfg->cfgIn = NULL;
+}
 
-        TY_(freeFileSource)(&cfg->cfgIn->source, yes);
-        TY_(freeStreamIn)( cfg->cfgIn );
-        cfg->cfgIn = NULL;
+/* open the file and parse its contents
+*/
+int TY_(ParseConfigFileEnc)( TidyDocImpl* doc, ctmbstr file, ctmbstr charenc )
+{
+    uint opterrs = doc->optionErrors;
+    tmbstr fname = (tmbstr) ExpandTilde( file );
+    FILE* fin = fopen( fname, "r" );
+    int enc = TY_(CharEncodingId)( charenc );
+
+    if ( fin == NULL || enc < 0 )
+    {
+        TY_(FileError)( doc, fname, TidyConfig );
+        return -1;
+    }
+    else
+    {
+        StreamIn* in = TY_(FileInput)( doc, fin, enc );
+        ParseConfigStream( doc, in );
+        TY_(freeFileSource)(&in->source, yes);
+        TY_(freeStreamIn)( in );
     }
 
     if ( fname != (tmbstr) file )
@@ -880,6 +1217,30 @@ int TY_(ParseConfigFileEnc)( TidyDocImpl* doc, ctmbstr file, ctmbstr charenc )
     return (doc->optionErrors > opterrs ? 1 : 0); 
 }
 
+/* parse config file contents held in memory, from buf->next on
+*/
+int TY_(ParseConfigBufferEnc)( TidyDocImpl* doc, TidyBuffer* buf, ctmbstr charenc )
+{
+    uint opterrs = doc->optionErrors;
+    int enc = TY_(CharEncodingId)( charenc );
+    StreamIn* in;
+
+    if ( enc < 0 )
+    {
+        TY_(ReportBadArgument)( doc, "char-encoding" );
+        return -1;
+    }
+
+    in = TY_(BufferInput)( doc, buf, enc );
+    ParseConfigStream( doc, in );
+    TY_(freeStreamIn)( in );
+
+    AdjustConfig( doc );
+
+    /* any new config errors? If so, return warning status. */
+    return (doc->optionErrors > opterrs ? 1 : 0); 
+}
+
 /* returns false if unknown option, missing parameter,
 ** or option doesn't use parameter
 */
@@ -1062,6 +1423,9 @@ void AdjustConfig( TidyDocImpl* doc )
         TY_(SetOptionBool)( doc, TidyQuoteAmpersand, yes );
         TY_(SetOptionBool)( doc, TidyHideEndTags, no );
     }
+
+    AdjustMuted( doc );
+    AdjustOptionFlags( doc );
 }
 
 /* unsigned integers */
@@ -1205,24 +1569,16 @@ Bool ParseCSS1Selector( TidyDocImpl* doc, const TidyOptionImpl* option )
 }
 
 /* Coordinates Config update and Tags data */
-static void DeclareUserTag( TidyDocImpl* doc, TidyOptionId optId,
+/* declare a tag and append it to the option value, which is
+** set once all the names are read rather than copied for each
+*/
+static void DeclareUserTag( TidyDocImpl* doc, TidyBuffer* names,
                             UserTagType tagType, ctmbstr name )
 {
-  ctmbstr prvval = cfgStr( doc, optId );
-  tmbstr catval = NULL;
-  ctmbstr theval = name;
-  if ( prvval )
-  {
-    size_t len = TY_(tmbstrlen)(name) + TY_(tmbstrlen)(prvval) + 3;
-    catval = TY_(tmbstrndup)( prvval, len );
-    TY_(tmbstrcat)( catval, ", " );
-    TY_(tmbstrcat)( catval, name );
-    theval = catval;
-  }
+  if ( names->size > 0 )
+    tidyBufAppend( names, (void*) ", ", 2 );
+  tidyBufAppend( names, (void*) name, TY_(tmbstrlen)(name) );
   TY_(DefineTag)( doc, tagType, name );
-  SetOptionValue( doc, optId, theval );
-  if ( catval )
-    MemFree( catval );
 }
 
 /* a space or comma separated list of tag names */
@@ -1233,6 +1589,7 @@ Bool ParseTagNames( TidyDocImpl* doc, const TidyOptionImpl* option )
     uint i = 0, nTags = 0;
     uint c = SkipWhite( cfg );
     UserTagType ttyp = tagtype_null;
+    TidyBuffer names;
 
     switch ( option->id )
     {
@@ -1246,8 +1603,9 @@ Bool ParseTagNames( TidyDocImpl* doc, const TidyOptionImpl* option )
     }
 
     SetOptionValue( doc, option->id, NULL );
-    TY_(FreeDeclaredTags)( doc, ttyp );
+    TY_(RetireDeclaredTags)( doc, ttyp );
     cfg->defined_tags |= ttyp;
+    tidyBufInit( &names );
 
     do
     {
@@ -1299,20 +1657,77 @@ Bool ParseTagNames( TidyDocImpl* doc, const TidyOptionImpl* option )
             continue;        /* there is a trailing space on the line. */
             
         /* add tag to dictionary */
-        DeclareUserTag( doc, option->id, ttyp, buf );
+        DeclareUserTag( doc, &names, ttyp, buf );
         i = 0;
         ++nTags;
     }
     while ( c != EndOfStream );
 
     if ( i > 0 )
-      DeclareUserTag( doc, option->id, ttyp, buf );
+      DeclareUserTag( doc, &names, ttyp, buf );
+
+    if ( names.size > 0 )
+    {
+        tidyBufPutByte( &names, 0 );
+        SetOptionValue( doc, option->id, (ctmbstr) names.bp );
+    }
+    tidyBufFree( &names );
+
+    /* tags no longer declared */
+    TY_(PurgeRetiredTags)( doc );
     return ( nTags > 0 );
 }
 
 /* a string including whitespace */
 /* munges whitespace sequences */
 
+/* a space or comma separated list of message codes */
+Bool ParseMuteCodes( TidyDocImpl* doc, const TidyOptionImpl* option )
+{
+    TidyConfigImpl* cfg = &doc->config;
+    tmbchar buf[8192];
+    uint i = 0;
+    tchar c = SkipWhite( cfg );
+
+    buf[0] = '\0';
+    while ( c != EndOfStream && c != '\r' && c != '\n' )
+    {
+        uint code = 0;
+        Bool digits = no;
+
+        if ( c == ' ' || c == '\t' || c == ',' )
+        {
+            c = AdvanceChar( cfg );
+            continue;
+        }
+
+        while ( TY_(IsDigit)(c) )
+        {
+            if ( code < N_MESSAGE_CODES )
+                code = c - '0' + (10 * code);
+            digits = yes;
+            c = AdvanceChar( cfg );
+        }
+
+        if ( !digits || code == 0 || code >= N_MESSAGE_CODES ||
+             !(c == EndOfStream || TY_(IsWhite)(c) || c == ',') )
+        {
+            TY_(ReportBadArgument)( doc, option->name );
+            return no;
+        }
+
+        if ( i < sizeof(buf)-8 )
+        {
+            TY_(tmbsnprintf)( buf+i, sizeof(buf)-i, i > 0 ? ", %u" : "%u", code );
+            i += TY_(tmbstrlen)( buf+i );
+        }
+    }
+
+    SetOptionValue( doc, option->id, i > 0 ? buf : NULL );
+    AdjustMuted( doc );
+    return yes;
+}
+
 Bool ParseString( TidyDocImpl* doc, const TidyOptionImpl* option )
 {
     TidyConfigImpl* cfg = &doc->config;
@@ -1501,9 +1916,9 @@ Bool ParseRepeatAttr( TidyDocImpl* doc, const TidyOptionImpl* option )
     buf[i] = '\0';
 
     if ( TY_(tmbstrcasecmp)(buf, "keep-first") == 0 )
-        cfg->value[ TidyDuplicateAttrs ].v = TidyKeepFirst;
+        TY_(SetOptionInt)( doc, TidyDuplicateAttrs, TidyKeepFirst );
     else if ( TY_(tmbstrcasecmp)(buf, "keep-last") == 0 )
-        cfg->value[ TidyDuplicateAttrs ].v = TidyKeepLast;
+        TY_(SetOptionInt)( doc, TidyDuplicateAttrs, TidyKeepLast );
     else
     {
         TY_(ReportBadArgument)( doc, option->name );
@@ -1602,11 +2017,26 @@ static int  WriteOptionPick( const TidyOptionImpl* option, ulong ival, StreamOut
     return -1;
 }
 
+/* Compares values rather than pointers, so that a document with
+** its own copy of the snapshot's profile or strings is unchanged.
+*/
 Bool  TY_(ConfigDiffThanSnapshot)( TidyDocImpl* doc )
 {
-  int diff = memcmp( &doc->config.value, &doc->config.snapshot,
-                     N_TIDY_OPTIONS * sizeof(uint) );
-  return ( diff != 0 );
+  const TidyOptionValue* snap = doc->config.snapshot;
+  uint ixVal;
+
+  if ( doc->config.snapprofile )
+    snap = doc->config.snapprofile->value;
+  if ( doc->config.value == snap )
+    return no;
+
+  for ( ixVal = 0; ixVal < N_TIDY_OPTIONS; ++ixVal )
+  {
+    if ( !OptionValueIdentical(&option_defs[ixVal],
+                               &doc->config.value[ixVal], &snap[ixVal]) )
+      return yes;
+  }
+  return no;
 }
 
 Bool  TY_(ConfigDiffThanDefault)( TidyDocImpl* doc )
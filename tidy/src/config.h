@@ -54,11 +54,46 @@ typedef union
   char *p;  /* Value for TidyString */
 } TidyOptionValue;
 
+/* A compiled configuration: adjusted option values that any number
+** of documents may share.  It is never written to; a document that
+** changes an option first takes its own copy of the values.
+*/
+typedef struct _TidyProfileImpl
+{
+    TidyOptionValue value[ N_TIDY_OPTIONS + 1 ];
+} TidyProfileImpl;
+
+/* Options read in the per character loops of the lexer and the
+** printer.  AdjustConfig() and every change of an option resolve
+** them into doc->optflags, so those loops read a field instead.
+*/
+#define OF_XML_TAGS        1u   /* input-xml */
+#define OF_XML_OUT         2u   /* output-xml */
+#define OF_XHTML_OUT       4u   /* output-xhtml */
+#define OF_NUM_ENTITIES    8u   /* numeric-entities */
+#define OF_QUOTE_AMP      16u   /* quote-ampersand */
+#define OF_QUOTE_MARKS    32u   /* quote-marks */
+#define OF_QUOTE_NBSP     64u   /* quote-nbsp */
+#define OF_PUNCT_WRAP    128u   /* punctuation-wrap */
+#define OF_LITERAL_ATTRS 256u   /* literal-attributes */
+
+typedef struct _TidyOptionFlags
+{
+    uint flags;       /* OF_* */
+    uint tabsize;     /* tab-size */
+    uint wraplen;     /* wrap */
+    uint outenc;      /* output-encoding */
+} TidyOptionFlags;
+
 typedef struct _tidy_config
 {
-    TidyOptionValue value[ N_TIDY_OPTIONS + 1 ];     /* current config values */
+    TidyOptionValue* value;                          /* current config values, own or shared */
+    TidyOptionValue own[ N_TIDY_OPTIONS + 1 ];       /* values of this document */
     TidyOptionValue snapshot[ N_TIDY_OPTIONS + 1 ];  /* Snapshot of values to be restored later */
 
+    const TidyProfileImpl* profile;      /* shared values in use, or NULL */
+    const TidyProfileImpl* snapprofile;  /* shared values in the snapshot, or NULL */
+
     /* track what tags user has defined to eliminate unnecessary searches */
     uint  defined_tags;
 
@@ -101,9 +136,18 @@ void TY_(ResetConfigToSnapshot)( TidyDocImpl* doc );
 
 void TY_(CopyConfig)( TidyDocImpl* docTo, TidyDocImpl* docFrom );
 
+TidyProfileImpl* TY_(CompileProfile)( TidyDocImpl* doc );
+void TY_(ApplyProfile)( TidyDocImpl* doc, const TidyProfileImpl* profile );
+void TY_(FreeProfile)( TidyProfileImpl* profile );
+
+Bool TY_(UpdateConfigCopy)( TidyDocImpl* doc, TidyOptionValue* vals );
+void TY_(FreeConfigCopy)( TidyOptionValue* vals );
+
 int  TY_(ParseConfigFile)( TidyDocImpl* doc, ctmbstr cfgfil );
 int  TY_(ParseConfigFileEnc)( TidyDocImpl* doc,
                               ctmbstr cfgfil, ctmbstr charenc );
+int  TY_(ParseConfigBufferEnc)( TidyDocImpl* doc,
+                                TidyBuffer* buf, ctmbstr charenc );
 
 int  TY_(SaveConfigFile)( TidyDocImpl* doc, ctmbstr cfgfil );
 int  TY_(SaveConfigSink)( TidyDocImpl* doc, TidyOutputSink* sink );
@@ -150,4 +194,7 @@ ctmbstr TY_(_cfgGetString)( TidyDocImpl* doc, TidyOptionId optId );
 
 #endif /* _DEBUG */
 
+/* Tells whether any of the OF_* options in of is set */
+#define cfgFlag(doc, of)        ( ((doc)->optflags.flags & (of)) != 0 )
+
 #endif /* __CONFIG_H__ */
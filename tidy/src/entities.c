@@ -16,6 +16,7 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include "entities.h"
 #include "tidy-int.h"
 #include "tmbstr.h"
@@ -392,21 +393,48 @@ Bool TY_(EntityInfo)( ctmbstr name, Bool isXml, uint* code, uint* versions )
 }
 
 
+/*
+ Positions in entities[] ordered by character code, for the
+ printer's lookups by code; no code appears twice in the table.
+ Built once, later it is only read.
+*/
+#define N_ENTITIES  ( sizeof(entities)/sizeof(entities[0]) - 1 )
+
+static byte entityByCode[ N_ENTITIES ];
+static TidyOnce entityByCodeOnce = TIDY_ONCE_INIT;
+
+static void InitEntityByCode(void)
+{
+    byte* order = entityByCode;
+    uint ix, jx;
+
+    for ( ix = 0; ix < N_ENTITIES; ++ix )
+    {
+        uint code = entities[ix].code;
+        for ( jx = ix; jx > 0 && entities[ order[jx-1] ].code > code; --jx )
+            order[jx] = order[jx-1];
+        order[jx] = (byte) ix;
+    }
+}
+
 ctmbstr TY_(EntityName)( uint ch, uint versions )
 {
-    ctmbstr entnam = NULL;
-    const entity *ep;
+    uint lo = 0, hi = N_ENTITIES;
 
-    for ( ep = entities; ep->name != NULL; ++ep )
+    TidyRunOnce( &entityByCodeOnce, InitEntityByCode );
+    while ( lo < hi )
     {
+        uint mid = (lo + hi) / 2;
+        const entity *ep = &entities[ entityByCode[mid] ];
+
         if ( ep->code == ch )
-        {
-            if ( ep->versions & versions )
-                entnam = ep->name;
-            break; /* Found code. Stop search. */
-        }
+            return ( ep->versions & versions ) ? ep->name : NULL;
+        if ( ep->code < ch )
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    return entnam;
+    return NULL;
 }
 
 /*
@@ -85,6 +85,12 @@ typedef struct _IStack IStack;
 struct _Lexer;
 typedef struct _Lexer Lexer;
 
+struct _TidyPrintKept;
+typedef struct _TidyPrintKept TidyPrintKept;
+
+struct _TidyMessageImpl;
+typedef struct _TidyMessageImpl TidyMessageImpl;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
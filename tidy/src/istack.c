@@ -276,6 +276,7 @@ Node *TY_(InsertedToken)( TidyDocImpl* doc )
     node->element = TY_(tmbstrdup)(istack->element);
     node->tag = istack->tag;
     node->attributes = TY_(DupAttrs)( doc, istack->attributes );
+    TY_(UpdateAttrMask)( node );
 
     /* advance lexer to next item on the stack */
     n = (uint)(lexer->insert - &(lexer->istack[0]));
@@ -63,7 +63,41 @@ static void AddAttrToList( AttVal** list, AttVal* av );
 
 /* used to classify characters for lexical purposes */
 #define MAP(c) ((unsigned)c < 128 ? lexmap[(unsigned)c] : 0)
-static uint lexmap[128];
+
+/* constant, so that it is shared by all documents and threads */
+#define NL  (newline|white)
+#define WH  white
+#define NC  namechar
+#define DG  (digit|namechar)
+#define LC  (lowercase|letter|namechar)
+#define UC  (uppercase|letter|namechar)
+
+static const uint lexmap[128] =
+{
+     0,  0,  0,  0,  0,  0,  0,  0,  /* 0x00 */
+     0, WH, NL,  0, NL, NL,  0,  0,  /* 0x08 \t \n \f \r */
+     0,  0,  0,  0,  0,  0,  0,  0,  /* 0x10 */
+     0,  0,  0,  0,  0,  0,  0,  0,  /* 0x18 */
+    WH,  0,  0,  0,  0,  0,  0,  0,  /* 0x20  !"#$%&' */
+     0,  0,  0,  0,  0, NC, NC,  0,  /* 0x28 ()*+,-./ */
+    DG, DG, DG, DG, DG, DG, DG, DG,  /* 0x30 01234567 */
+    DG, DG, NC,  0,  0,  0,  0,  0,  /* 0x38 89:;<=>? */
+     0, UC, UC, UC, UC, UC, UC, UC,  /* 0x40 @ABCDEFG */
+    UC, UC, UC, UC, UC, UC, UC, UC,  /* 0x48 HIJKLMNO */
+    UC, UC, UC, UC, UC, UC, UC, UC,  /* 0x50 PQRSTUVW */
+    UC, UC, UC,  0,  0,  0,  0, NC,  /* 0x58 XYZ[\]^_ */
+     0, LC, LC, LC, LC, LC, LC, LC,  /* 0x60 `abcdefg */
+    LC, LC, LC, LC, LC, LC, LC, LC,  /* 0x68 hijklmno */
+    LC, LC, LC, LC, LC, LC, LC, LC,  /* 0x70 pqrstuvw */
+    LC, LC, LC,  0,  0,  0,  0,  0   /* 0x78 xyz{|}~ */
+};
+
+#undef NL
+#undef WH
+#undef NC
+#undef DG
+#undef LC
+#undef UC
 
 #define IsValidXMLAttrName(name) TY_(IsValidXMLID)(name)
 #define IsValidXMLElemName(name) TY_(IsValidXMLID)(name)
@@ -642,22 +676,25 @@ static tmbchar LastChar( tmbstr str )
     #define StartEndTag 4
 */
 
+static void InitLexer( TidyDocImpl* doc, Lexer* lexer )
+{
+    ClearMemory( lexer, sizeof(Lexer) );
+
+    lexer->lines = 1;
+    lexer->columns = 1;
+    lexer->state = LEX_CONTENT;
+
+    lexer->versions = (VERS_ALL|VERS_PROPRIETARY);
+    lexer->doctype = VERS_UNKNOWN;
+    lexer->root = &doc->root;
+}
+
 Lexer* TY_(NewLexer)( TidyDocImpl* doc )
 {
     Lexer* lexer = (Lexer*) MemAlloc( sizeof(Lexer) );
 
     if ( lexer != NULL )
-    {
-        ClearMemory( lexer, sizeof(Lexer) );
-
-        lexer->lines = 1;
-        lexer->columns = 1;
-        lexer->state = LEX_CONTENT;
-
-        lexer->versions = (VERS_ALL|VERS_PROPRIETARY);
-        lexer->doctype = VERS_UNKNOWN;
-        lexer->root = &doc->root;
-    }
+        InitLexer( doc, lexer );
     return lexer;
 }
 
@@ -667,23 +704,55 @@ static Bool EndOfInput( TidyDocImpl* doc )
     return ( !doc->docIn->pushed && TY_(IsEOF)(doc->docIn) );
 }
 
-void TY_(FreeLexer)( TidyDocImpl* doc )
+/* frees what the lexer holds of the last document */
+static void ReleaseLexerState( TidyDocImpl* doc, Lexer* lexer )
+{
+    TY_(FreeStyles)( doc );
+
+    /* See GetToken() */
+    if ( lexer->pushed || lexer->itoken )
+    {
+        if (lexer->pushed)
+            TY_(FreeNode)( doc, lexer->itoken );
+        TY_(FreeNode)( doc, lexer->token );
+    }
+
+    while ( lexer->istacksize > 0 )
+        TY_(PopInline)( doc, NULL );
+}
+
+/* Ready the lexer for another document.  The character buffer
+** and the inline stack keep their size, so a document reused
+** for many similar inputs soon stops growing them.
+*/
+void TY_(ClearLexer)( TidyDocImpl* doc )
 {
     Lexer *lexer = doc->lexer;
     if ( lexer )
     {
-        TY_(FreeStyles)( doc );
-
-        /* See GetToken() */
-        if ( lexer->pushed || lexer->itoken )
-        {
-            if (lexer->pushed)
-                TY_(FreeNode)( doc, lexer->itoken );
-            TY_(FreeNode)( doc, lexer->token );
-        }
+        tmbstr lexbuf = lexer->lexbuf;
+        uint lexlength = lexer->lexlength;
+        IStack* istack = lexer->istack;
+        uint istacklength = lexer->istacklength;
+
+        ReleaseLexerState( doc, lexer );
+        InitLexer( doc, lexer );
+
+        lexer->lexbuf = lexbuf;
+        lexer->lexlength = lexlength;
+        lexer->istack = istack;
+        lexer->istacklength = istacklength;
+        if ( lexbuf )
+            lexbuf[0] = '\0';
+    }
+}
 
-        while ( lexer->istacksize > 0 )
-            TY_(PopInline)( doc, NULL );
+void TY_(FreeLexer)( TidyDocImpl* doc )
+{
+    Lexer *lexer = doc->lexer;
+    if ( lexer )
+    {
+        ReleaseLexerState( doc, lexer );
 
         MemFree( lexer->istack );
         MemFree( lexer->lexbuf );
@@ -804,7 +873,7 @@ static void ParseEntity( TidyDocImpl* doc, GetTokenMode mode )
 {
     uint start;
     Bool first = yes, semicolon = no, found = no;
-    Bool isXml = cfgBool( doc, TidyXmlTags );
+    Bool isXml = cfgFlag( doc, OF_XML_TAGS );
     uint c, ch, startcol, entver = 0;
     Lexer* lexer = doc->lexer;
 
@@ -857,9 +926,8 @@ static void ParseEntity( TidyDocImpl* doc, GetTokenMode mode )
     ** Tidy's content model bit mask.
     */
     if ( TY_(tmbstrcmp)(lexer->lexbuf+start, "&apos") == 0
-         && !cfgBool(doc, TidyXmlOut)
-         && !lexer->isvoyager
-         && !cfgBool(doc, TidyXhtmlOut) )
+         && !cfgFlag(doc, OF_XML_OUT | OF_XHTML_OUT)
+         && !lexer->isvoyager )
         TY_(ReportEntityError)( doc, APOS_UNDEFINED, lexer->lexbuf+start, 39 );
 
     /* Lookup entity code and version
@@ -906,7 +974,7 @@ static void ParseEntity( TidyDocImpl* doc, GetTokenMode mode )
                               ampersand in the lexer.
 */
 #ifdef TIDY_APPLE_CHANGES
-                if ( cfg(doc, TidyOutCharEncoding) != RAW )
+                if ( doc->optflags.outenc != RAW )
                 {
 #endif
                 if ( c1 )
@@ -936,7 +1004,7 @@ static void ParseEntity( TidyDocImpl* doc, GetTokenMode mode )
         else /* naked & */
 #ifdef TIDY_APPLE_CHANGES
         {
-            if ( (cfg(doc, TidyOutCharEncoding) == RAW && cfgBool(doc, TidyQuoteAmpersand)) )
+            if ( (doc->optflags.outenc == RAW && cfgFlag(doc, OF_QUOTE_AMP)) )
                 AddStringToLexer( lexer, "amp;" );
 #endif
             TY_(ReportEntityError)( doc, UNESCAPED_AMPERSAND,
@@ -956,7 +1024,7 @@ static void ParseEntity( TidyDocImpl* doc, GetTokenMode mode )
         }
 
 #ifdef TIDY_APPLE_CHANGES
-        if ( cfg(doc, TidyOutCharEncoding) == RAW )
+        if ( doc->optflags.outenc == RAW )
         {
             AddCharToLexer( lexer, ';' );
         }
@@ -968,7 +1036,7 @@ static void ParseEntity( TidyDocImpl* doc, GetTokenMode mode )
             ch = ' ';
         TY_(AddCharToLexer)( lexer, ch );
 
-        if ( ch == '&' && !cfgBool(doc, TidyQuoteAmpersand) )
+        if ( ch == '&' && !cfgFlag(doc, OF_QUOTE_AMP) )
             AddStringToLexer( lexer, "amp;" );
 
         /* Detect extended vs. basic entities */
@@ -983,7 +1051,7 @@ static tmbchar ParseTagName( TidyDocImpl* doc )
 {
     Lexer *lexer = doc->lexer;
     uint c = lexer->lexbuf[ lexer->txtstart ];
-    Bool xml = cfgBool(doc, TidyXmlTags);
+    Bool xml = cfgFlag(doc, OF_XML_TAGS);
 
     /* fold case of first character in buffer */
     if (!xml && TY_(IsUpper)(c))
@@ -1052,6 +1120,7 @@ Node *TY_(CloneNode)( TidyDocImpl* doc, Node *element )
         node->tag        = element->tag;
         node->element    = TY_(tmbstrdup)( element->element );
         node->attributes = TY_(DupAttrs)( doc, element->attributes );
+        node->attrmask   = element->attrmask;
     }
     return node;
 }
@@ -1076,6 +1145,7 @@ void TY_(FreeAttrs)( TidyDocImpl* doc, Node *node )
         node->attributes = av->next;
         TY_(FreeAttribute)( doc, av );
     }
+    node->attrmask = 0;
 }
 
 /* doesn't repair attribute list linkage */
@@ -1088,6 +1158,21 @@ void TY_(FreeAttribute)( TidyDocImpl* doc, AttVal *av )
     MemFree( av );
 }
 
+/* recompute node's attribute mask from its attribute list
+*/
+void TY_(UpdateAttrMask)( Node *node )
+{
+    AttVal *av;
+    uint mask = 0;
+
+    for ( av = node->attributes; av; av = av->next )
+    {
+        if ( av->dict )
+            mask |= AttrMaskBit( av->dict->id );
+    }
+    node->attrmask = mask;
+}
+
 /* detach attribute from node
 */
 void TY_(DetachAttribute)( Node *node, AttVal *attr )
@@ -1106,6 +1191,8 @@ void TY_(DetachAttribute)( Node *node, AttVal *attr )
         }
         prev = av;
     }
+    TY_(UpdateAttrMask)( node );
+    TY_(PrintCacheChanged)( node );
 }
 
 /* detach attribute from node then free it
@@ -1129,6 +1216,7 @@ void TY_(FreeNode)( TidyDocImpl* doc, Node *node )
 
         TY_(FreeAttrs)( doc, node );
         TY_(FreeNode)( doc, node->content );
+        TY_(FreePrintCache)( node );
         MemFree( node->element );
 #ifdef TIDY_STORE_ORIGINAL_TEXT
         if (node->otext)
@@ -2416,6 +2504,7 @@ static Node* GetTokenFromStream( TidyDocImpl* doc, GetTokenMode mode )
                     lexer->token->type = StartEndTag;
 
                 lexer->token->attributes = attributes;
+                TY_(UpdateAttrMask)( lexer->token );
                 lexer->lexsize = lexer->txtend = lexer->txtstart;
 
                 /* swallow newline following start tag */
@@ -2721,6 +2810,7 @@ static Node* GetTokenFromStream( TidyDocImpl* doc, GetTokenMode mode )
                         lexer->waswhite = no;
                         lexer->token = XmlDeclToken(doc);
                         lexer->token->attributes = attributes;
+                        TY_(UpdateAttrMask)( lexer->token );
                         return lexer->token;
                     }
 
@@ -2749,6 +2839,7 @@ static Node* GetTokenFromStream( TidyDocImpl* doc, GetTokenMode mode )
                 lexer->waswhite = no;
                 lexer->token = XmlDeclToken(doc);
                 lexer->token->attributes = attributes;
+                TY_(UpdateAttrMask)( lexer->token );
                 return lexer->token;
 
             case LEX_SECTION: /* seen "<![" so look for "]>" */
@@ -2860,25 +2951,6 @@ static Node* GetTokenFromStream( TidyDocImpl* doc, GetTokenMode mode )
     return NULL;
 }
 
-static void MapStr( ctmbstr str, uint code )
-{
-    while ( *str )
-    {
-        uint i = (byte) *str++;
-        lexmap[i] |= code;
-    }
-}
-
-void TY_(InitMap)(void)
-{
-    MapStr("\r\n\f", newline|white);
-    MapStr(" \t", white);
-    MapStr("-.:_", namechar);
-    MapStr("0123456789", digit|namechar);
-    MapStr("abcdefghijklmnopqrstuvwxyz", lowercase|letter|namechar);
-    MapStr("ABCDEFGHIJKLMNOPQRSTUVWXYZ", uppercase|letter|namechar);
-}
-
 /*
  parser for ASP within start tags
 
@@ -3093,7 +3165,7 @@ static tmbstr  ParseAttribute( TidyDocImpl* doc, Bool *isempty,
         /* what should be done about non-namechar characters? */
         /* currently these are incorporated into the attr name */
 
-        if ( !cfgBool(doc, TidyXmlTags) && TY_(IsUpper)(c) )
+        if ( !cfgFlag(doc, OF_XML_TAGS) && TY_(IsUpper)(c) )
             c = TY_(ToLower)(c);
 
         TY_(AddCharToLexer)( lexer, c );
@@ -3225,7 +3297,7 @@ static tmbstr ParseValue( TidyDocImpl* doc, ctmbstr name,
      embed element with script attributes where newlines
      are significant and must be preserved
     */
-    if ( cfgBool(doc, TidyLiteralAttribs) )
+    if ( cfgFlag(doc, OF_LITERAL_ATTRS) )
         munge = no;
 
  /* skip white space before the '=' */
@@ -3556,12 +3628,18 @@ static void AddAttrToList( AttVal** list, AttVal* av )
 void TY_(InsertAttributeAtEnd)( Node *node, AttVal *av )
 {
     AddAttrToList(&node->attributes, av);
+    if ( av->dict )
+        node->attrmask |= AttrMaskBit( av->dict->id );
+    TY_(PrintCacheChanged)( node );
 }
 
 void TY_(InsertAttributeAtStart)( Node *node, AttVal *av )
 {
     av->next = node->attributes;
     node->attributes = av;
+    if ( av->dict )
+        node->attrmask |= AttrMaskBit( av->dict->id );
+    TY_(PrintCacheChanged)( node );
 }
 
 /* swallows closing '>' */
@@ -301,6 +301,7 @@ struct _Node
     Node*       last;
 
     AttVal*     attributes;
+    uint        attrmask;       /* may-have bits of attribute ids */
     const Dict* was;            /* old tag when it was changed */
     const Dict* tag;            /* tag's dictionary definition */
 
@@ -317,16 +318,28 @@ struct _Node
     Bool        implicit;       /* true if inferred */
     Bool        linebreak;      /* true if followed by a line break */
 
+    TidyPrintKept* printcache;  /* output kept from printing it */
+    Bool        printkept;      /* output is part of some kept output */
+
 #ifdef TIDY_STORE_ORIGINAL_TEXT
     tmbstr      otext;
 #endif
 };
 
 
+/*
+  Node.attrmask has bit AttrMaskBit(id) set for every attribute
+  with a dictionary entry on the node, so a clear bit proves that
+  no such attribute is present.  Ids sharing a bit and attributes
+  removed without UpdateAttrMask() only cost a list walk.
+*/
+#define AttrMaskBit(id)  (1u << ((uint)(id) & 31u))
+
 /*
   The following are private to the lexer
-  Use NewLexer() to create a lexer, and
-  FreeLexer() to free it.
+  Use NewLexer() to create a lexer,
+  ClearLexer() to reuse it for another document,
+  and FreeLexer() to free it.
 */
 
 struct _Lexer
@@ -421,6 +434,7 @@ uint TY_(ToLower)(uint c);
 uint TY_(ToUpper)(uint c);
 
 Lexer* TY_(NewLexer)( TidyDocImpl* doc );
+void TY_(ClearLexer)( TidyDocImpl* doc );
 void TY_(FreeLexer)( TidyDocImpl* doc );
 
 /* store character c as UTF-8 encoded byte stream */
@@ -451,6 +465,9 @@ void TY_(FreeAttrs)( TidyDocImpl* doc, Node *node );
 /* doesn't repair attribute list linkage */
 void TY_(FreeAttribute)( TidyDocImpl* doc, AttVal *av );
 
+/* recompute node's attribute mask from its attribute list */
+void TY_(UpdateAttrMask)( Node *node );
+
 /* detach attribute from node */
 void TY_(DetachAttribute)( Node *node, AttVal *attr );
 
@@ -529,8 +546,6 @@ typedef enum
 
 Node* TY_(GetToken)( TidyDocImpl* doc, GetTokenMode mode );
 
-void TY_(InitMap)(void);
-
 
 /* create a new attribute */
 AttVal* TY_(NewAttribute)(void);
@@ -295,14 +295,47 @@ static struct _msgfmt
   { 0,                                             NULL                                                                       }
 };
 
+/*
+ Positions in msgFormat[] ordered by code, for GetFormatFromCode.
+ A code listed twice has the same format both times.
+ Built once, later it is only read.
+*/
+#define N_MSGFORMATS  ( sizeof(msgFormat)/sizeof(msgFormat[0]) - 1 )
+
+static uint msgByCode[ N_MSGFORMATS ];
+static TidyOnce msgByCodeOnce = TIDY_ONCE_INIT;
+
+static void InitMsgByCode(void)
+{
+    uint* order = msgByCode;
+    uint ix, jx;
+
+    for ( ix = 0; ix < N_MSGFORMATS; ++ix )
+    {
+        uint code = msgFormat[ix].code;
+        for ( jx = ix; jx > 0 && msgFormat[ order[jx-1] ].code > code; --jx )
+            order[jx] = order[jx-1];
+        order[jx] = ix;
+    }
+}
+
 static ctmbstr GetFormatFromCode(uint code)
 {
-    uint i;
+    uint lo = 0, hi = N_MSGFORMATS;
 
-    for (i = 0; msgFormat[i].fmt; ++i)
-        if (msgFormat[i].code == code)
-            return msgFormat[i].fmt;
+    TidyRunOnce( &msgByCodeOnce, InitMsgByCode );
+    while ( lo < hi )
+    {
+        uint mid = ( lo + hi ) / 2;
+        const struct _msgfmt* mf = &msgFormat[ msgByCode[mid] ];
 
+        if ( mf->code == code )
+            return mf->fmt;
+        if ( mf->code < code )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
     return NULL;
 }
 
@@ -351,6 +384,8 @@ static const TidyOptionId TidyAsciiCharsLinks[] =
   { TidyMakeClean, TidyUnknownOption };
 static const TidyOptionId TidyNumEntitiesLinks[] =
   { TidyDoctype, TidyUnknownOption };
+static const TidyOptionId TidyMinifyLinks[] =
+  { TidyIndentContent, TidyWrapLen, TidyVertSpace, TidyUnknownOption };
 
 /* Documentation of options */
 static const TidyOptionDoc option_docs[] =
@@ -879,6 +914,46 @@ static const TidyOptionDoc option_docs[] =
    "some CSS markup to avoid indentation to the right. "
    , NULL
   },
+  {TidyMinify,
+   "This option specifies if Tidy should write the markup as compactly as "
+   "possible, without the line breaks and indentation it otherwise adds. "
+   "Line breaks in preformatted content, scripts and comments are kept. "
+   "When set, indent, indent-attributes, wrap and vertical-space have no "
+   "effect on the output. "
+   , TidyMinifyLinks
+  },
+  {TidyPrintThreads,
+   "This option specifies the number of threads Tidy uses to print the "
+   "content of the body. Blocks in the body are printed side by side and "
+   "the output is the same as without threads. 0 or 1 prints on the "
+   "calling thread. Only available when Tidy is built with "
+   "SUPPORT_PARALLEL_PRINT, and then the memory allocator must be thread "
+   "safe. "
+   , NULL
+  },
+  {TidyPrintCache,
+   "This option specifies if Tidy should keep the printed output of block "
+   "elements with the document, so that saving it again copies the output "
+   "of elements that did not change instead of printing them. Changes made "
+   "with the library's node and attribute functions, or by cleaning the "
+   "document, are noticed. It uses memory about the size of the output and "
+   "only pays off when a document is saved more than once. "
+   , NULL
+  },
+  {TidyMuteMessages,
+   "This option specifies the codes of messages Tidy should not report, "
+   "separated by spaces or commas. Muted messages are neither shown nor "
+   "counted. The codes are those a message callback gets from "
+   "tidyMessageCode(). "
+   , NULL
+  },
+  {TidyJsonMessages,
+   "This option specifies if Tidy should write diagnostics as JSON Lines: "
+   "one object per message, with its code, level, line, column, element, "
+   "attribute and text. The summaries and other general information "
+   "are left out, so that every line of the error output is a message. "
+   , NULL
+  },
   {N_TIDY_OPTIONS,
    NULL
    , NULL
@@ -980,113 +1055,329 @@ static char* ReportPosition(TidyDocImpl* doc, int line, int col, char* buf, size
     return buf + TY_(tmbstrlen)( buf );
 }
 
+static char* TagToString(Node* tag, char* buf, size_t count)
+{
+    *buf = 0;
+    if (tag)
+    {
+        if (TY_(nodeIsElement)(tag))
+            TY_(tmbsnprintf)(buf, count, "<%s>", tag->element);
+        else if (tag->type == EndTag)
+            TY_(tmbsnprintf)(buf, count, "</%s>", tag->element);
+        else if (tag->type == DocTypeTag)
+            TY_(tmbsnprintf)(buf, count, "<!DOCTYPE>");
+        else if (tag->type == TextNode)
+            TY_(tmbsnprintf)(buf, count, "plain text");
+        else if (tag->type == XmlDecl)
+            TY_(tmbsnprintf)(buf, count, "XML declaration");
+        else if (tag->element)
+            TY_(tmbsnprintf)(buf, count, "%s", tag->element);
+    }
+    return buf + TY_(tmbstrlen)(buf);
+}
+
+static void NtoS(int n, tmbstr str)
+{
+    tmbchar buf[40];
+    int i;
+
+    for (i = 0;; ++i)
+    {
+        buf[i] = (tmbchar)( (n % 10) + '0' );
+
+        n = n / 10;
+
+        if (n == 0)
+            break;
+    }
+
+    n = i;
+
+    while (i >= 0)
+    {
+        str[n-i] = buf[i];
+        --i;
+    }
+
+    str[n+1] = '\0';
+}
+
+/* Code muted with the mute option: not reported, not counted */
+#define MUTED( doc, code ) ( (code) < N_MESSAGE_CODES && \
+        ((doc)->muted[ (code)/32 ] & (1u << ((code)%32))) != 0 )
+
+/* Starts a message at the given line/column */
+static void initMessage( TidyMessageImpl* msg, TidyDocImpl* doc,
+                         TidyReportLevel level, int line, int col,
+                         uint code, ctmbstr fmt )
+{
+    msg->doc = doc;
+    msg->code = code;
+    msg->level = level;
+    msg->line = line;
+    msg->column = col;
+    msg->format = fmt;
+    msg->nargs = 0;
+    msg->tagargs = 0;
+    msg->node = NULL;
+    msg->attribute = NULL;
+    msg->text = NULL;
+}
+
+/* Starts a message at current Lexer line/column */
+static void initMessageLexer( TidyMessageImpl* msg, TidyDocImpl* doc,
+                              TidyReportLevel level, uint code, ctmbstr fmt )
+{
+    int line = ( doc->lexer ? doc->lexer->lines : 0 );
+    int col  = ( doc->lexer ? doc->lexer->columns : 0 );
+
+    initMessage( msg, doc, level, line, col, code, fmt );
+}
+
+/* Starts a message at node line/column */
+static void initMessageNode( TidyMessageImpl* msg, TidyDocImpl* doc,
+                             TidyReportLevel level, Node* node,
+                             uint code, ctmbstr fmt )
+{
+    int line = ( node ? node->line :
+                 ( doc->lexer ? doc->lexer->lines : 0 ) );
+    int col  = ( node ? node->column :
+                 ( doc->lexer ? doc->lexer->columns : 0 ) );
+
+    initMessage( msg, doc, level, line, col, code, fmt );
+    msg->node = node;
+}
+
+static void messageArg( TidyMessageImpl* msg, ctmbstr arg )
+{
+    assert( msg->nargs < sizeof(msg->args)/sizeof(msg->args[0]) );
+    msg->args[ msg->nargs ] = arg;
+    msg->tags[ msg->nargs ] = NULL;
+    msg->nargs++;
+}
+
+/* An argument shown as "<tag>", "</tag>", "plain text" etc. */
+static void messageTag( TidyMessageImpl* msg, Node* tag )
+{
+    assert( msg->nargs < sizeof(msg->tags)/sizeof(msg->tags[0]) );
+    msg->args[ msg->nargs ] = NULL;
+    msg->tags[ msg->nargs ] = tag;
+    msg->tagargs |= ( 1u << msg->nargs );
+    msg->nargs++;
+}
+
+ctmbstr TY_(MessageText)( TidyMessageImpl* msg )
+{
+    if ( !msg->text )
+    {
+        char tagdesc[ 3 ][ 256 ];
+        ctmbstr args[ 3 ] = { NULL, NULL, NULL };
+        uint ix;
+
+        for ( ix = 0; ix < msg->nargs; ++ix )
+        {
+            args[ix] = msg->args[ix];
+            if ( msg->tagargs & (1u << ix) )
+            {
+                TagToString( msg->tags[ix], tagdesc[ix], sizeof(tagdesc[ix]) );
+                args[ix] = tagdesc[ix];
+            }
+        }
+
+        msg->textbuf[0] = '\0';
+        if ( msg->format )
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wformat-nonliteral"
+            TY_(tmbsnprintf)( msg->textbuf, sizeof(msg->textbuf), msg->format,
+                              args[0], args[1], args[2] );
+#pragma clang diagnostic pop
+        msg->text = msg->textbuf;
+    }
+    return msg->text;
+}
+
+static ctmbstr JsonLevel( TidyReportLevel level )
+{
+  switch ( level )
+  {
+  case TidyInfo:        return "info";
+  case TidyWarning:     return "warning";
+  case TidyConfig:      return "config";
+  case TidyAccess:      return "access";
+  case TidyError:       return "error";
+  case TidyBadDocument: return "document";
+  case TidyFatal:       return "fatal";
+  }
+  return "";
+}
+
+static tmbstr JsonAppend( tmbstr cp, tmbstr end, ctmbstr s )
+{
+    while ( *s && cp < end )
+        *cp++ = *s++;
+    return cp;
+}
+
+/* Appends s as a JSON string, or null.  A string that does
+** not fit is cut at a character boundary.
+*/
+static tmbstr JsonString( tmbstr cp, tmbstr end, ctmbstr s )
+{
+    static const char hex[] = "0123456789abcdef";
+    tmbstr start = cp;
+
+    if ( !s )
+        return JsonAppend( cp, end, "null" );
+    if ( end - cp < 2 )
+        return cp;
+
+    *cp++ = '"';
+    for ( ; *s && end - cp > 7; ++s )
+    {
+        uint c = (byte) *s;
+        if ( c == '"' || c == '\\' )
+        {
+            *cp++ = '\\';
+            *cp++ = (tmbchar) c;
+        }
+        else if ( c == '\n' )
+        {
+            *cp++ = '\\';
+            *cp++ = 'n';
+        }
+        else if ( c < 0x20 )
+        {
+            cp = JsonAppend( cp, end, "\\u00" );
+            *cp++ = hex[ c >> 4 ];
+            *cp++ = hex[ c & 0xF ];
+        }
+        else
+            *cp++ = (tmbchar) c;
+    }
+
+    /* don't leave half a UTF-8 sequence */
+    if ( ((byte) *s & 0xC0) == 0x80 )
+    {
+        while ( cp > start + 1 && ((byte) cp[-1] & 0xC0) == 0x80 )
+            --cp;
+        if ( cp > start + 1 )
+            --cp;
+    }
+    *cp++ = '"';
+    return cp;
+}
+
+/* Writes the message as a line of JSON */
+static void messageJson( TidyMessageImpl* msg )
+{
+    tmbchar line[ 4096 ];
+    tmbchar num[ 16 ];
+    tmbstr end = line + sizeof(line) - 3;  /* room for "}\n" and NUL */
+    ctmbstr element = ( msg->node ? msg->node->element : NULL );
+    tmbstr cp = line;
+
+    cp = JsonAppend( cp, end, "{\"code\":" );
+    NtoS( (int) msg->code, num );
+    cp = JsonAppend( cp, end, num );
+    cp = JsonAppend( cp, end, ",\"level\":\"" );
+    cp = JsonAppend( cp, end, JsonLevel(msg->level) );
+    cp = JsonAppend( cp, end, "\",\"line\":" );
+    NtoS( msg->line, num );
+    cp = JsonAppend( cp, end, num );
+    cp = JsonAppend( cp, end, ",\"column\":" );
+    NtoS( msg->column, num );
+    cp = JsonAppend( cp, end, num );
+    /* names take at most 256 bytes, the text has the rest */
+    cp = JsonAppend( cp, end, ",\"element\":" );
+    cp = JsonString( cp, cp + 256, element );
+    cp = JsonAppend( cp, end, ",\"attribute\":" );
+    cp = JsonString( cp, cp + 256, msg->attribute );
+    cp = JsonAppend( cp, end, ",\"text\":" );
+    cp = JsonString( cp, end, TY_(MessageText)(msg) );
+    *cp++ = '}';
+    *cp++ = '\n';
+    *cp = '\0';
+
+    /* through WriteChar(), like the text of other messages, so
+       that errout's encoding and newline apply */
+    for ( cp = line; *cp; ++cp )
+    {
+        uint c = (byte) *cp;
+        if ( c > 0x7F )
+            cp += TY_(GetUTF8)( cp, &c );
+        TY_(WriteChar)( c, msg->doc->errout );
+    }
+}
+
 /* General message writing routine.
 ** Each message is a single warning, error, etc.
 ** 
 ** This routine will keep track of counts and,
-** if the caller has set a filter, it will be 
-** called.  The new preferred way of handling
+** if the caller has set a message callback or
+** a filter, they will be called.  The text is
+** only formatted when the filter or the output
+** needs it.  The new preferred way of handling
 ** Tidy diagnostics output is either a) define
 ** a new output sink or b) install a message
-** filter routine.
+** callback or filter routine.
 */
-
-static void messagePos( TidyDocImpl* doc, TidyReportLevel level,
-                        int line, int col, ctmbstr msg, va_list args ) TIDY_ATTRIBUTE_PRINTF(5, 0);
-
-static void messagePos( TidyDocImpl* doc, TidyReportLevel level,
-                        int line, int col, ctmbstr msg, va_list args )
+static void messageOut( TidyMessageImpl* msg )
 {
-    char messageBuf[ 2048 ];
-    Bool go = UpdateCount( doc, level );
+    TidyDocImpl* doc = msg->doc;
+    TidyDoc tdoc = tidyImplToDoc( doc );
+    Bool go = UpdateCount( doc, msg->level );
 
-    if ( go )
-    {
-        TY_(tmbvsnprintf)(messageBuf, sizeof(messageBuf), msg, args);
-        if ( doc->mssgFilt )
-        {
-            TidyDoc tdoc = tidyImplToDoc( doc );
-            go = doc->mssgFilt( tdoc, level, line, col, messageBuf );
-        }
-    }
+    if ( go && doc->mssgCallback )
+        go = doc->mssgCallback( tdoc, tidyImplToMessage(msg) );
 
-    if ( go )
+    if ( go && doc->mssgFilt )
+        go = doc->mssgFilt( tdoc, msg->level, msg->line, msg->column,
+                            TY_(MessageText)(msg) );
+
+    if ( go && cfgBool(doc, TidyJsonMessages) )
+        messageJson( msg );
+    else if ( go )
     {
         char buf[ 64 ];
         const char *cp;
-        if ( line > 0 && col > 0 )
+        if ( msg->line > 0 && msg->column > 0 )
         {
-            ReportPosition(doc, line, col, buf, sizeof(buf));
+            ReportPosition(doc, msg->line, msg->column, buf, sizeof(buf));
             for ( cp = buf; *cp; ++cp )
                 TY_(WriteChar)( *cp, doc->errout );
         }
 
-        LevelPrefix( level, buf, sizeof(buf) );
+        LevelPrefix( msg->level, buf, sizeof(buf) );
         for ( cp = buf; *cp; ++cp )
             TY_(WriteChar)( *cp, doc->errout );
 
-        for ( cp = messageBuf; *cp; ++cp )
+        for ( cp = TY_(MessageText)(msg); *cp; ++cp )
             TY_(WriteChar)( *cp, doc->errout );
         TY_(WriteChar)( '\n', doc->errout );
     }
 }
 
-/* Reports error at current Lexer line/column. */ 
-static
-void message( TidyDocImpl* doc, TidyReportLevel level, ctmbstr msg, ... ) TIDY_ATTRIBUTE_PRINTF(3, 4);
-
-/* Reports error at node line/column. */ 
-static
-void messageNode( TidyDocImpl* doc, TidyReportLevel level,
-                  Node* node, ctmbstr msg, ... ) TIDY_ATTRIBUTE_PRINTF(4, 5);
-
-/* Reports error at given line/column. */ 
-static
-void messageLexer( TidyDocImpl* doc, TidyReportLevel level, 
-                   ctmbstr msg, ... ) TIDY_ATTRIBUTE_PRINTF(3, 4);
-
-/* For general reporting.  Emits nothing if --quiet yes */
-static
-void tidy_out( TidyDocImpl* doc, ctmbstr msg, ... ) TIDY_ATTRIBUTE_PRINTF(2, 3);
-
-
-void message( TidyDocImpl* doc, TidyReportLevel level, ctmbstr msg, ... )
-{
-    va_list args;
-    va_start( args, msg );
-    messagePos( doc, level, 0, 0, msg, args );
-    va_end( args );
-}
-
-
-void messageLexer( TidyDocImpl* doc, TidyReportLevel level, ctmbstr msg, ... )
+/* A message without a code, at no position */
+static void message( TidyDocImpl* doc, TidyReportLevel level,
+                     ctmbstr fmt, ctmbstr arg )
 {
-    int line = ( doc->lexer ? doc->lexer->lines : 0 );
-    int col  = ( doc->lexer ? doc->lexer->columns : 0 );
-
-    va_list args;
-    va_start( args, msg );
-    messagePos( doc, level, line, col, msg, args );
-    va_end( args );
+    TidyMessageImpl msg;
+    initMessage( &msg, doc, level, 0, 0, 0, fmt );
+    if ( arg )
+        messageArg( &msg, arg );
+    messageOut( &msg );
 }
 
-void messageNode( TidyDocImpl* doc, TidyReportLevel level, Node* node,
-                  ctmbstr msg, ... )
-{
-    int line = ( node ? node->line :
-                 ( doc->lexer ? doc->lexer->lines : 0 ) );
-    int col  = ( node ? node->column :
-                 ( doc->lexer ? doc->lexer->columns : 0 ) );
+/* For general reporting.  Emits nothing if --quiet yes
+** or --json-messages yes
+*/
+static
+void tidy_out( TidyDocImpl* doc, ctmbstr msg, ... ) TIDY_ATTRIBUTE_PRINTF(2, 3);
 
-    va_list args;
-    va_start( args, msg );
-    messagePos( doc, level, line, col, msg, args );
-    va_end( args );
-}
 
 void tidy_out( TidyDocImpl* doc, ctmbstr msg, ... )
 {
-    if ( !cfgBool(doc, TidyQuiet) )
+    if ( !cfgBool(doc, TidyQuiet) && !cfgBool(doc, TidyJsonMessages) )
     {
         ctmbstr cp;
         char buf[ 2048 ];
@@ -1122,27 +1413,6 @@ void TY_(FileError)( TidyDocImpl* doc, ctmbstr file, TidyReportLevel level )
     message( doc, level, "Can't open \"%s\"\n", file );
 }
 
-static char* TagToString(Node* tag, char* buf, size_t count)
-{
-    *buf = 0;
-    if (tag)
-    {
-        if (TY_(nodeIsElement)(tag))
-            TY_(tmbsnprintf)(buf, count, "<%s>", tag->element);
-        else if (tag->type == EndTag)
-            TY_(tmbsnprintf)(buf, count, "</%s>", tag->element);
-        else if (tag->type == DocTypeTag)
-            TY_(tmbsnprintf)(buf, count, "<!DOCTYPE>");
-        else if (tag->type == TextNode)
-            TY_(tmbsnprintf)(buf, count, "plain text");
-        else if (tag->type == XmlDecl)
-            TY_(tmbsnprintf)(buf, count, "XML declaration");
-        else if (tag->element)
-            TY_(tmbsnprintf)(buf, count, "%s", tag->element);
-    }
-    return buf + TY_(tmbstrlen)(buf);
-}
-
 /* lexer is not defined when this is called */
 void TY_(ReportUnknownOption)( TidyDocImpl* doc, ctmbstr option )
 {
@@ -1158,115 +1428,117 @@ void TY_(ReportBadArgument)( TidyDocImpl* doc, ctmbstr option )
              "missing or malformed argument for option: %s", option );
 }
 
-static void NtoS(int n, tmbstr str)
-{
-    tmbchar buf[40];
-    int i;
-
-    for (i = 0;; ++i)
-    {
-        buf[i] = (tmbchar)( (n % 10) + '0' );
-
-        n = n / 10;
-
-        if (n == 0)
-            break;
-    }
-
-    n = i;
-
-    while (i >= 0)
-    {
-        str[n-i] = buf[i];
-        --i;
-    }
-
-    str[n+1] = '\0';
-}
-
 void TY_(ReportEncodingWarning)(TidyDocImpl* doc, uint code, uint encoding)
 {
+    TidyMessageImpl msg;
+
     switch(code)
     {
     case ENCODING_MISMATCH:
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-nonliteral"
-        messageLexer(doc, TidyWarning, GetFormatFromCode(code), 
-                     TY_(CharEncodingName)(doc->docIn->encoding),
-                     TY_(CharEncodingName)(encoding));
-#pragma clang diagnostic pop
         doc->badChars |= BC_ENCODING_MISMATCH;
+        if ( MUTED(doc, code) )
+            break;
+        initMessageLexer( &msg, doc, TidyWarning, code, GetFormatFromCode(code) );
+        messageArg( &msg, TY_(CharEncodingName)(doc->docIn->encoding) );
+        messageArg( &msg, TY_(CharEncodingName)(encoding) );
+        messageOut( &msg );
         break;
     }
 }
 
 void TY_(ReportEncodingError)(TidyDocImpl* doc, uint code, uint c, Bool discarded)
 {
+    TidyMessageImpl msg;
     char buf[ 32 ] = {'\0'};
 
     ctmbstr action = discarded ? "discarding" : "replacing";
     ctmbstr fmt = GetFormatFromCode(code);
+    Bool muted = MUTED( doc, code );
 
     /* An encoding mismatch is currently treated as a non-fatal error */
     switch (code)
     {
     case VENDOR_SPECIFIC_CHARS:
-        NtoS(c, buf);
+        if ( !muted )
+            NtoS(c, buf);
         doc->badChars |= BC_VENDOR_SPECIFIC_CHARS;
         break;
 
     case INVALID_SGML_CHARS:
-        NtoS(c, buf);
+        if ( !muted )
+            NtoS(c, buf);
         doc->badChars |= BC_INVALID_SGML_CHARS;
         break;
 
     case INVALID_UTF8:
-        TY_(tmbsnprintf)(buf, sizeof(buf), "U+%04X", c);
+        if ( !muted )
+            TY_(tmbsnprintf)(buf, sizeof(buf), "U+%04X", c);
         doc->badChars |= BC_INVALID_UTF8;
         break;
 
 #if SUPPORT_UTF16_ENCODINGS
     case INVALID_UTF16:
-        TY_(tmbsnprintf)(buf, sizeof(buf), "U+%04X", c);
+        if ( !muted )
+            TY_(tmbsnprintf)(buf, sizeof(buf), "U+%04X", c);
         doc->badChars |= BC_INVALID_UTF16;
         break;
 #endif
 
     case INVALID_NCR:
-        NtoS(c, buf);
+        if ( !muted )
+            NtoS(c, buf);
         doc->badChars |= BC_INVALID_NCR;
         break;
     }
 
-    if (fmt)
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-nonliteral"
-        messageLexer( doc, TidyWarning, fmt, action, buf );
-#pragma clang diagnostic pop
+    if (fmt && !muted)
+    {
+        initMessageLexer( &msg, doc, TidyWarning, code, fmt );
+        messageArg( &msg, action );
+        messageArg( &msg, buf );
+        messageOut( &msg );
+    }
 }
 
 void TY_(ReportEntityError)( TidyDocImpl* doc, uint code, ctmbstr entity,
                              int ARG_UNUSED(c) )
 {
+    TidyMessageImpl msg;
     ctmbstr entityname = ( entity ? entity : "NULL" );
-    ctmbstr fmt = GetFormatFromCode(code);
+    ctmbstr fmt;
+
+    if ( MUTED(doc, code) )
+        return;
 
+    fmt = GetFormatFromCode(code);
     if (fmt)
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-nonliteral"
-        messageLexer( doc, TidyWarning, fmt, entityname );
-#pragma clang diagnostic pop
+    {
+        initMessageLexer( &msg, doc, TidyWarning, code, fmt );
+        messageArg( &msg, entityname );
+        messageOut( &msg );
+    }
 }
 
 void TY_(ReportAttrError)(TidyDocImpl* doc, Node *node, AttVal *av, uint code)
 {
+    TidyMessageImpl msg;
     char const *name = "NULL", *value = "NULL";
-    char tagdesc[64];
-    ctmbstr fmt = GetFormatFromCode(code);
+    ctmbstr fmt;
 
-    assert( fmt != NULL );
+    if ( MUTED(doc, code) )
+    {
+        if ( code == MISSING_IMAGEMAP )
+            doc->badAccess |= MISSING_IMAGE_MAP;
+        else if ( code == UNEXPECTED_END_OF_FILE_ATTR )
+        {
+            doc->lexer->lines   = doc->docIn->curline;
+            doc->lexer->columns = doc->docIn->curcol;
+        }
+        return;
+    }
 
-    TagToString(node, tagdesc, sizeof(tagdesc));
+    fmt = GetFormatFromCode(code);
+    assert( fmt != NULL );
 
     if (av)
     {
@@ -1276,8 +1548,10 @@ void TY_(ReportAttrError)(TidyDocImpl* doc, Node *node, AttVal *av, uint code)
             value = av->value;
     }
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-nonliteral"
+    initMessageNode( &msg, doc, TidyWarning, node, code, fmt );
+    msg.attribute = ( av ? av->attribute : NULL );
+    messageTag( &msg, node );
+
     switch (code)
     {
     case UNKNOWN_ATTRIBUTE:
@@ -1286,13 +1560,14 @@ void TY_(ReportAttrError)(TidyDocImpl* doc, Node *node, AttVal *av, uint code)
     case XML_ATTRIBUTE_VALUE:
     case PROPRIETARY_ATTRIBUTE:
     case JOINING_ATTRIBUTE:
-        messageNode(doc, TidyWarning, node, fmt, tagdesc, name);
+        messageArg( &msg, name );
         break;
 
     case BAD_ATTRIBUTE_VALUE:
     case BAD_ATTRIBUTE_VALUE_REPLACED:
     case INVALID_ATTRIBUTE:
-        messageNode(doc, TidyWarning, node, fmt, tagdesc, name, value);
+        messageArg( &msg, name );
+        messageArg( &msg, value );
         break;
 
     case UNEXPECTED_QUOTEMARK:
@@ -1307,47 +1582,55 @@ void TY_(ReportAttrError)(TidyDocImpl* doc, Node *node, AttVal *av, uint code)
     case UNEXPECTED_GT:
     case INVALID_XML_ID:
     case UNEXPECTED_EQUALSIGN:
-        messageNode(doc, TidyWarning, node, fmt, tagdesc);
         break;
 
     case XML_ID_SYNTAX:
     case PROPRIETARY_ATTR_VALUE:
     case ANCHOR_NOT_UNIQUE:
     case ATTR_VALUE_NOT_LCASE:
-        messageNode(doc, TidyWarning, node, fmt, tagdesc, value);
+        messageArg( &msg, value );
         break;
 
 
     case MISSING_IMAGEMAP:
-        messageNode(doc, TidyWarning, node, fmt, tagdesc);
         doc->badAccess |= MISSING_IMAGE_MAP;
         break;
 
     case REPEATED_ATTRIBUTE:
-        messageNode(doc, TidyWarning, node, fmt, tagdesc, value, name);
+        messageArg( &msg, value );
+        messageArg( &msg, name );
         break;
 
     case UNEXPECTED_END_OF_FILE_ATTR:
         /* on end of file adjust reported position to end of input */
         doc->lexer->lines   = doc->docIn->curline;
         doc->lexer->columns = doc->docIn->curcol;
-        messageLexer(doc, TidyWarning, fmt, tagdesc);
+        msg.line   = doc->lexer->lines;
+        msg.column = doc->lexer->columns;
         break;
+
+    default:
+        return;
     }
-#pragma clang diagnostic pop
+
+    messageOut( &msg );
 }
 
 void TY_(ReportMissingAttr)( TidyDocImpl* doc, Node* node, ctmbstr name )
 {
-    char tagdesc[ 64 ];
-    ctmbstr fmt = GetFormatFromCode(MISSING_ATTRIBUTE);
+    TidyMessageImpl msg;
+    ctmbstr fmt;
+
+    if ( MUTED(doc, MISSING_ATTRIBUTE) )
+        return;
 
+    fmt = GetFormatFromCode(MISSING_ATTRIBUTE);
     assert( fmt != NULL );
-    TagToString(node, tagdesc, sizeof(tagdesc));
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-nonliteral"
-    messageNode( doc, TidyWarning, node, fmt, tagdesc, name );
-#pragma clang diagnostic pop
+    initMessageNode( &msg, doc, TidyWarning, node, MISSING_ATTRIBUTE, fmt );
+    msg.attribute = name;
+    messageTag( &msg, node );
+    messageArg( &msg, name );
+    messageOut( &msg );
 }
 
 #if SUPPORT_ACCESSIBILITY_CHECKS
@@ -1384,113 +1667,121 @@ void TY_(DisplayHTMLTableAlgorithm)( TidyDocImpl* doc )
 
 void TY_(ReportAccessWarning)( TidyDocImpl* doc, Node* node, uint code )
 {
-    ctmbstr fmt = GetFormatFromCode(code);
+    TidyMessageImpl msg;
+    ctmbstr fmt;
     doc->badAccess = yes;
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-nonliteral"
-#pragma clang diagnostic ignored "-Wformat-security"
-    messageNode( doc, TidyAccess, node, fmt );
-#pragma clang diagnostic pop
+    if ( MUTED(doc, code) )
+        return;
+    fmt = GetFormatFromCode(code);
+    initMessageNode( &msg, doc, TidyAccess, node, code, fmt );
+    messageOut( &msg );
 }
 
 void TY_(ReportAccessError)( TidyDocImpl* doc, Node* node, uint code )
 {
-    ctmbstr fmt = GetFormatFromCode(code);
+    TidyMessageImpl msg;
+    ctmbstr fmt;
     doc->badAccess = yes;
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-nonliteral"
-#pragma clang diagnostic ignored "-Wformat-security"
-    messageNode( doc, TidyAccess, node, fmt );
-#pragma clang diagnostic pop
+    if ( MUTED(doc, code) )
+        return;
+    fmt = GetFormatFromCode(code);
+    initMessageNode( &msg, doc, TidyAccess, node, code, fmt );
+    messageOut( &msg );
 }
 
 #endif /* SUPPORT_ACCESSIBILITY_CHECKS */
 
 void TY_(ReportWarning)(TidyDocImpl* doc, Node *element, Node *node, uint code)
 {
+    TidyMessageImpl msg;
     Node* rpt = (element ? element : node);
-    ctmbstr fmt = GetFormatFromCode(code);
-    char nodedesc[256] = { 0 };
-    char elemdesc[256] = { 0 };
+    ctmbstr fmt;
 
+    if ( MUTED(doc, code) )
+        return;
+
+    fmt = GetFormatFromCode(code);
     assert( fmt != NULL );
 
-    TagToString(node, nodedesc, sizeof(nodedesc));
+    initMessageNode( &msg, doc, TidyWarning, rpt, code, fmt );
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-nonliteral"
     switch (code)
     {
     case NESTED_QUOTATION:
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-security"
-        messageNode(doc, TidyWarning, rpt, fmt);
-#pragma clang diagnostic pop
         break;
 
     case OBSOLETE_ELEMENT:
-        TagToString(element, elemdesc, sizeof(elemdesc));
-        messageNode(doc, TidyWarning, rpt, fmt, elemdesc, nodedesc);
+        messageTag( &msg, element );
+        messageTag( &msg, node );
         break;
 
     case NESTED_EMPHASIS:
-        messageNode(doc, TidyWarning, rpt, fmt, nodedesc);
+        messageTag( &msg, node );
         break;
     case COERCE_TO_ENDTAG_WARN:
-        messageNode(doc, TidyWarning, rpt, fmt, node->element, node->element);
+        messageArg( &msg, node->element );
+        messageArg( &msg, node->element );
         break;
+
+    default:
+        return;
     }
-#pragma clang diagnostic pop
+
+    messageOut( &msg );
 }
 
 void TY_(ReportNotice)(TidyDocImpl* doc, Node *element, Node *node, uint code)
 {
+    TidyMessageImpl msg;
     Node* rpt = ( element ? element : node );
-    ctmbstr fmt = GetFormatFromCode(code);
-    char nodedesc[256] = { 0 };
-    char elemdesc[256] = { 0 };
+    ctmbstr fmt;
 
-    assert( fmt != NULL );
+    if ( MUTED(doc, code) )
+        return;
 
-    TagToString(node, nodedesc, sizeof(nodedesc));
+    fmt = GetFormatFromCode(code);
+    assert( fmt != NULL );
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-nonliteral"
     switch (code)
     {
     case TRIM_EMPTY_ELEMENT:
-        TagToString(element, elemdesc, sizeof(nodedesc));
-        messageNode(doc, TidyWarning, element, fmt, elemdesc);
+        initMessageNode( &msg, doc, TidyWarning, element, code, fmt );
+        messageTag( &msg, element );
         break;
 
     case REPLACING_ELEMENT:
-        TagToString(element, elemdesc, sizeof(elemdesc));
-        messageNode(doc, TidyWarning, rpt, fmt, elemdesc, nodedesc);
+        initMessageNode( &msg, doc, TidyWarning, rpt, code, fmt );
+        messageTag( &msg, element );
+        messageTag( &msg, node );
         break;
+
+    default:
+        return;
     }
-#pragma clang diagnostic pop
+
+    messageOut( &msg );
 }
 
 void TY_(ReportError)(TidyDocImpl* doc, Node *element, Node *node, uint code)
 {
-    char nodedesc[ 256 ] = {0};
-    char elemdesc[ 256 ] = {0};
+    TidyMessageImpl msg;
     Node* rpt = ( element ? element : node );
-    ctmbstr fmt = GetFormatFromCode(code);
+    ctmbstr fmt;
 
-    assert( fmt != NULL );
+    if ( MUTED(doc, code) )
+        return;
 
-    TagToString(node, nodedesc, sizeof(nodedesc));
+    fmt = GetFormatFromCode(code);
+    assert( fmt != NULL );
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-nonliteral"
     switch ( code )
     {
     case MISSING_STARTTAG:
     case UNEXPECTED_ENDTAG:
     case TOO_MANY_ELEMENTS:
     case INSERTING_TAG:
-        messageNode(doc, TidyWarning, node, fmt, node->element);
+        initMessageNode( &msg, doc, TidyWarning, node, code, fmt );
+        messageArg( &msg, node->element );
         break;
 
     case USING_BR_INPLACE_OF:
@@ -1498,7 +1789,8 @@ void TY_(ReportError)(TidyDocImpl* doc, Node *element, Node *node, uint code)
     case PROPRIETARY_ELEMENT:
     case UNESCAPED_ELEMENT:
     case NOFRAMES_CONTENT:
-        messageNode(doc, TidyWarning, node, fmt, nodedesc);
+        initMessageNode( &msg, doc, TidyWarning, node, code, fmt );
+        messageTag( &msg, node );
         break;
 
     case MISSING_TITLE_ELEMENT:
@@ -1512,97 +1804,113 @@ void TY_(ReportError)(TidyDocImpl* doc, Node *element, Node *node, uint code)
     case INCONSISTENT_NAMESPACE:
     case DOCTYPE_AFTER_TAGS:
     case DTYPE_NOT_UPPER_CASE:
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-security"
-        messageNode(doc, TidyWarning, rpt, fmt);
-#pragma clang diagnostic pop
+        initMessageNode( &msg, doc, TidyWarning, rpt, code, fmt );
         break;
 
     case COERCE_TO_ENDTAG:
     case NON_MATCHING_ENDTAG:
-        messageNode(doc, TidyWarning, rpt, fmt, node->element, node->element);
+        initMessageNode( &msg, doc, TidyWarning, rpt, code, fmt );
+        messageArg( &msg, node->element );
+        messageArg( &msg, node->element );
         break;
 
     case UNEXPECTED_ENDTAG_IN:
     case TOO_MANY_ELEMENTS_IN:
-        messageNode(doc, TidyWarning, node, fmt, node->element, element->element);
+        initMessageNode( &msg, doc, TidyWarning, node, code, fmt );
+        messageArg( &msg, node->element );
+        messageArg( &msg, element->element );
         break;
 
     case ENCODING_IO_CONFLICT:
     case MISSING_DOCTYPE:
     case SPACE_PRECEDING_XMLDECL:
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-security"
-        messageNode(doc, TidyWarning, node, fmt);
-#pragma clang diagnostic pop
+        initMessageNode( &msg, doc, TidyWarning, node, code, fmt );
         break;
 
     case TRIM_EMPTY_ELEMENT:
     case ILLEGAL_NESTING:
     case UNEXPECTED_END_OF_FILE:
     case ELEMENT_NOT_EMPTY:
-        TagToString(element, elemdesc, sizeof(elemdesc));
-        messageNode(doc, TidyWarning, element, fmt, elemdesc);
+        initMessageNode( &msg, doc, TidyWarning, element, code, fmt );
+        messageTag( &msg, element );
         break;
 
 
     case MISSING_ENDTAG_FOR:
-        messageNode(doc, TidyWarning, rpt, fmt, element->element);
+        initMessageNode( &msg, doc, TidyWarning, rpt, code, fmt );
+        messageArg( &msg, element->element );
         break;
 
     case MISSING_ENDTAG_BEFORE:
-        messageNode(doc, TidyWarning, rpt, fmt, element->element, nodedesc);
+        initMessageNode( &msg, doc, TidyWarning, rpt, code, fmt );
+        messageArg( &msg, element->element );
+        messageTag( &msg, node );
         break;
 
     case DISCARDING_UNEXPECTED:
         /* Force error if in a bad form */
-        messageNode(doc, doc->badForm ? TidyError : TidyWarning, node, fmt, nodedesc);
+        initMessageNode( &msg, doc, doc->badForm ? TidyError : TidyWarning,
+                         node, code, fmt );
+        messageTag( &msg, node );
         break;
 
     case TAG_NOT_ALLOWED_IN:
-        messageNode(doc, TidyWarning, rpt, fmt, nodedesc, element->element);
+        initMessageNode( &msg, doc, TidyWarning, rpt, code, fmt );
+        messageTag( &msg, node );
+        messageArg( &msg, element->element );
         break;
 
     case REPLACING_UNEX_ELEMENT:
-        TagToString(element, elemdesc, sizeof(elemdesc));
-        messageNode(doc, TidyWarning, rpt, fmt, elemdesc, nodedesc);
+        initMessageNode( &msg, doc, TidyWarning, rpt, code, fmt );
+        messageTag( &msg, element );
+        messageTag( &msg, node );
         break;
+
+    default:
+        return;
     }
-#pragma clang diagnostic pop
+
+    messageOut( &msg );
 }
 
 void TY_(ReportFatal)( TidyDocImpl* doc, Node *element, Node *node, uint code)
 {
-    char nodedesc[ 256 ] = {0};
+    TidyMessageImpl msg;
     Node* rpt = ( element ? element : node );
-    ctmbstr fmt = GetFormatFromCode(code);
+    ctmbstr fmt;
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-nonliteral"
+    if ( MUTED(doc, code) )
+        return;
+
+    fmt = GetFormatFromCode(code);
     switch ( code )
     {
     case SUSPECTED_MISSING_QUOTE:
     case DUPLICATE_FRAMESET:
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-security"
-        messageNode(doc, TidyError, rpt, fmt);
-#pragma clang diagnostic pop
+        initMessageNode( &msg, doc, TidyError, rpt, code, fmt );
         break;
 
     case UNKNOWN_ELEMENT:
-        TagToString(node, nodedesc, sizeof(nodedesc));
-        messageNode( doc, TidyError, node, fmt, nodedesc );
+        initMessageNode( &msg, doc, TidyError, node, code, fmt );
+        messageTag( &msg, node );
         break;
 
     case UNEXPECTED_ENDTAG_IN:
-        messageNode(doc, TidyError, node, fmt, node->element, element->element);
+        initMessageNode( &msg, doc, TidyError, node, code, fmt );
+        messageArg( &msg, node->element );
+        messageArg( &msg, element->element );
         break;
 
     case UNEXPECTED_ENDTAG:  /* generated by XML docs */
-        messageNode(doc, TidyError, node, fmt, node->element);
+        initMessageNode( &msg, doc, TidyError, node, code, fmt );
+        messageArg( &msg, node->element );
         break;
+
+    default:
+        return;
     }
-#pragma clang diagnostic pop
+
+    messageOut( &msg );
 }
 
 void TY_(ErrorSummary)( TidyDocImpl* doc )
@@ -1874,7 +2182,7 @@ void TY_(ReportMarkupVersion)( TidyDocImpl* doc )
     if (doc->givenDoctype)
     {
         /* todo: deal with non-ASCII characters in FPI */
-        message(doc, TidyInfo, "Doctype given is \"%s\"", doc->givenDoctype);
+        message( doc, TidyInfo, "Doctype given is \"%s\"", doc->givenDoctype );
     }
 
     if ( ! cfgBool(doc, TidyXmlTags) )
@@ -1894,7 +2202,7 @@ void TY_(ReportMarkupVersion)( TidyDocImpl* doc )
 
         /* Warn about missing sytem identifier (SI) in emitted doctype */
         if ( TY_(WarnMissingSIInEmittedDocType)( doc ) )
-            message( doc, TidyInfo, "No system identifier in emitted doctype" );
+            message( doc, TidyInfo, "No system identifier in emitted doctype", NULL );
     }
 }
 
@@ -66,6 +66,29 @@ void TY_(ReportWarning)(TidyDocImpl* doc, Node *element, Node *node, uint code);
 void TY_(ReportError)(TidyDocImpl* doc, Node* element, Node* node, uint code);
 void TY_(ReportFatal)(TidyDocImpl* doc, Node* element, Node* node, uint code);
 
+/* A message being reported.  Its arguments are kept as given
+** and the text is formatted only when it is asked for.
+*/
+struct _TidyMessageImpl
+{
+    TidyDocImpl*    doc;
+    uint            code;
+    TidyReportLevel level;
+    int             line;
+    int             column;
+    ctmbstr         format;
+    uint            nargs;
+    ctmbstr         args[3];
+    Node*           tags[3];     /* shown as a tag if set in tagargs */
+    uint            tagargs;
+    Node*           node;        /* where it is reported, or NULL */
+    ctmbstr         attribute;   /* attribute it is about, or NULL */
+    tmbstr          text;        /* NULL until formatted */
+    tmbchar         textbuf[2048];
+};
+
+ctmbstr TY_(MessageText)( TidyMessageImpl* msg );
+
 /* error codes for entities/numeric character references */
 
 #define MISSING_SEMICOLON            1
@@ -87,6 +87,7 @@ void TY_(CoerceNode)(TidyDocImpl* doc, Node *node, TidyTagId tid, Bool obsolete,
     MemFree(tmp->element);
     MemFree(tmp);
 
+    TY_(PrintCacheChanged)( node );
     node->was = node->tag;
     node->tag = tag;
     node->type = StartTag;
@@ -98,6 +99,8 @@ void TY_(CoerceNode)(TidyDocImpl* doc, Node *node, TidyTagId tid, Bool obsolete,
 /* extract a node and its children from a markup tree */
 Node *TY_(RemoveNode)(Node *node)
 {
+    TY_(PrintCacheChanged)( node->parent );
+
     if (node->prev)
         node->prev->next = node->next;
 
@@ -138,6 +141,7 @@ Node *TY_(DiscardElement)( TidyDocImpl* doc, Node *element )
 */
 void TY_(InsertNodeAtStart)(Node *element, Node *node)
 {
+    TY_(PrintCacheChanged)( element );
     node->parent = element;
 
     if (element->content == NULL)
@@ -156,6 +160,7 @@ void TY_(InsertNodeAtStart)(Node *element, Node *node)
 */
 void TY_(InsertNodeAtEnd)(Node *element, Node *node)
 {
+    TY_(PrintCacheChanged)( element );
     node->parent = element;
     node->prev = element->last;
 
@@ -173,6 +178,7 @@ void TY_(InsertNodeAtEnd)(Node *element, Node *node)
 */
 static void InsertNodeAsParent(Node *element, Node *node)
 {
+    TY_(PrintCacheChanged)( element->parent );
     node->content = element;
     node->last = element;
     node->parent = element->parent;
@@ -203,6 +209,7 @@ void TY_(InsertNodeBeforeElement)(Node *element, Node *node)
     Node *parent;
 
     parent = element->parent;
+    TY_(PrintCacheChanged)( parent );
     node->parent = parent;
     node->next = element;
     node->prev = element->prev;
@@ -221,6 +228,7 @@ void TY_(InsertNodeAfterElement)(Node *element, Node *node)
     Node *parent;
 
     parent = element->parent;
+    TY_(PrintCacheChanged)( parent );
     node->parent = parent;
 
     /* AQ - 13 Jan 2000 fix for parent == NULL */
@@ -3388,7 +3396,9 @@ void TY_(ParseBody)(TidyDocImpl* doc, Node *body, GetTokenMode mode)
                      && body->attributes == NULL )
                 {
                     body->attributes = node->attributes;
+                    body->attrmask = node->attrmask;
                     node->attributes = NULL;
+                    node->attrmask = 0;
                 }
 
                 TY_(FreeNode)( doc, node);
@@ -4006,87 +4016,71 @@ static void ReplaceObsoleteElements(TidyDocImpl* doc, Node* node)
     }
 }
 
-static void AttributeChecks(TidyDocImpl* doc, Node* node)
+#ifdef TIDY_APPLE_CHANGES
+/* extract "element", put its content in its place and
+** delete it; returns the first node of the content
+*/
+static Node* ReplaceByContent(TidyDocImpl* doc, Node* element)
 {
-    Node *next;
+    Node *first = element->content, *node;
 
-    while (node)
+    while ((node = element->content) != NULL)
     {
-        next = node->next;
-
-        if (TY_(nodeIsElement)(node))
-        {
-            if (node->tag->chkattrs)
-                node->tag->chkattrs(doc, node);
-            else
-                TY_(CheckAttributes)(doc, node);
-        }
-
-        if (node->content)
-            AttributeChecks(doc, node->content);
-
-        node = next;
+        TY_(RemoveNode)(node);
+        TY_(InsertNodeBeforeElement)(element, node);
     }
+    TY_(RemoveNode)(element);
+    TY_(FreeNode)(doc, element);
+    return first;
 }
+#endif
 
 /* Apple Changes:
    2007-02-02 iccir If TidySanitizeAgainstXSS is set, remove elements which could load external content
+                    (or those not allowed by the sanitizer policy)
 */
-#ifdef TIDY_APPLE_CHANGES
-static void SanitizeNodesAgainstXSS(TidyDocImpl* doc, Node* node)
+static void AttributeChecks(TidyDocImpl* doc, Node* node)
 {
     Node *next;
-
-    Bool isXml = cfgBool( doc, TidyXmlTags );
-    Bool shouldRemoveElement;
+#ifdef TIDY_APPLE_CHANGES
+    Bool sanitize = cfgBool(doc, TidySanitizeAgainstXSS);
+#endif
 
     while (node)
     {
         next = node->next;
 
-        if (!isXml)
-        {
-            shouldRemoveElement = TY_(nodeIsFRAMESET) (node) ||
-                                  TY_(nodeIsSCRIPT)   (node) ||
-                                  TY_(nodeIsIFRAME)   (node) ||
-                                  TY_(nodeIsOBJECT)   (node) ||
-                                  TY_(nodeIsFRAME)    (node) ||
-                                  TY_(nodeIsEMBED)    (node) ||
-                                  TY_(nodeIsSTYLE)    (node) ||
-                                  TY_(nodeIsLINK)     (node) ||
-                                  TY_(nodeIsMETA)     (node) ||
-                                  TY_(nodeIsAPPLET)   (node) ;
-        }
-        else
+#ifdef TIDY_APPLE_CHANGES
+        if (sanitize && !TY_(SanitizeAllowsElement)(doc, node))
         {
-            /* When the content was parsed as XML, the tag identifiers all point at a generic XML tag identifier
-               with an unknown tag name, so we need to manually compare the tag names with the bad set of tags. */
-            shouldRemoveElement = node->element && (!TY_(tmbstrcasecmp)(node->element, "frameset") ||
-                                                    !TY_(tmbstrcasecmp)(node->element, "script")   ||
-                                                    !TY_(tmbstrcasecmp)(node->element, "iframe")   ||
-                                                    !TY_(tmbstrcasecmp)(node->element, "object")   ||
-                                                    !TY_(tmbstrcasecmp)(node->element, "frame")    ||
-                                                    !TY_(tmbstrcasecmp)(node->element, "embed")    ||
-                                                    !TY_(tmbstrcasecmp)(node->element, "style")    ||
-                                                    !TY_(tmbstrcasecmp)(node->element, "link")     ||
-                                                    !TY_(tmbstrcasecmp)(node->element, "meta")     ||
-                                                    !TY_(tmbstrcasecmp)(node->element, "applet")   );
+            /* elements which could load external content go with
+               their content, the others are replaced by it */
+            if (node->content && !TY_(SanitizeDropsContent)(doc, node))
+                next = ReplaceByContent(doc, node);
+            else
+            {
+                TY_(RemoveNode)(node);
+                TY_(FreeNode)(doc, node);
+            }
+            node = next;
+            continue;
         }
+#endif
 
-        if (shouldRemoveElement)
-        {
-            RemoveNode(node);
-            FreeNode(doc, node);
-        }
-        else if (node->content)
+        if (TY_(nodeIsElement)(node))
         {
-            SanitizeNodesAgainstXSS(doc, node->content);
+            if (node->tag->chkattrs)
+                node->tag->chkattrs(doc, node);
+            else
+                TY_(CheckAttributes)(doc, node);
         }
 
+        if (node->content)
+            AttributeChecks(doc, node->content);
+
         node = next;
     }
 }
-#endif
 
 /*
   HTML is the top level element
@@ -4095,6 +4089,11 @@ void TY_(ParseDocument)(TidyDocImpl* doc)
 {
     Node *node, *html, *doctype = NULL;
 
+#ifdef TIDY_APPLE_CHANGES
+    if (cfgBool(doc, TidySanitizeAgainstXSS))
+        TY_(InitSanitizePolicy)(doc);
+#endif
+
     while ((node = TY_(GetToken)(doc, IgnoreWhitespace)) != NULL)
     {
         if (node->type == XmlDecl)
@@ -4212,10 +4211,6 @@ void TY_(ParseDocument)(TidyDocImpl* doc)
         TY_(InsertNodeAtEnd)(head, TY_(InferredTag)(doc, TidyTag_TITLE));
     }
 
-#ifdef TIDY_APPLE_CHANGES
-    if (cfgBool(doc, TidySanitizeAgainstXSS))
-        SanitizeNodesAgainstXSS(doc, &doc->root);
-#endif
     AttributeChecks(doc, &doc->root);
     ReplaceObsoleteElements(doc, &doc->root);
     TY_(DropEmptyElements)(doc, &doc->root);
@@ -4344,6 +4339,11 @@ void TY_(ParseXMLDocument)(TidyDocImpl* doc)
 
     TY_(SetOptionBool)( doc, TidyXmlTags, yes );
 
+#ifdef TIDY_APPLE_CHANGES
+    if (cfgBool(doc, TidySanitizeAgainstXSS))
+        TY_(InitSanitizePolicy)(doc);
+#endif
+
     while ((node = TY_(GetToken)(doc, IgnoreWhitespace)) != NULL)
     {
         /* discard unexpected end tags */
@@ -4397,7 +4397,6 @@ void TY_(ParseXMLDocument)(TidyDocImpl* doc)
 
 #ifdef TIDY_APPLE_CHANGES
     if (cfgBool(doc, TidySanitizeAgainstXSS)) {
-        SanitizeNodesAgainstXSS(doc, &doc->root);
         AttributeChecks(doc, &doc->root);
     }
 #endif
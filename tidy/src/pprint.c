@@ -24,6 +24,10 @@
 #include "tmbstr.h"
 #include "utf8.h"
 
+#if SUPPORT_PARALLEL_PRINT
+#include <pthread.h>
+#endif
+
 /*
   Block-level and unknown elements are printed on
   new lines and their contents indented 2 spaces
@@ -46,27 +50,17 @@ static Bool ShouldIndent( TidyDocImpl* doc, Node *node );
 #if SUPPORT_ASIAN_ENCODINGS
 /* #431953 - start RJ Wraplen adjusted for smooth international ride */
 
-#if 0
-uint CWrapLen( TidyDocImpl* doc, uint ind )
+/* Chinese and Japanese characters take two positions on a
+   fixed-width screen.  The printer keeps a column count next to
+   linelen and wraphere, see CharColumns() below.
+*/
+static Bool IsWideLanguage( ctmbstr lang )
 {
-    ctmbstr lang = cfgStr( doc, TidyLanguage );
-    uint wraplen = cfg( doc, TidyWrapLen );
-
-    if ( !TY_(tmbstrcasecmp)(lang, "zh") )
-        /* Chinese characters take two positions on a fixed-width screen */ 
-        /* It would be more accurate to keep a parallel linelen and wraphere
-           incremented by 2 for Chinese characters and 1 otherwise, but this
-           is way simpler.
-        */
-        return (ind + (( wraplen - ind ) / 2)) ; 
-    
-    if ( !TY_(tmbstrcasecmp)(lang, "ja") )
-        /* average Japanese text is 30% kanji */
-        return (ind + ((( wraplen - ind ) * 7) / 10)) ; 
-    
-    return wraplen;
+    return ( lang &&
+             ( !TY_(tmbstrncasecmp)(lang, "zh", 2) ||
+               !TY_(tmbstrncasecmp)(lang, "ja", 2) ) &&
+             ( lang[2] == '\0' || lang[2] == '-' || lang[2] == '_' ) );
 }
-#endif
 
 typedef enum
 {
@@ -297,32 +291,428 @@ void TY_(InitPrintBuf)( TidyDocImpl* doc )
     InitIndent( &doc->pprint.indent[1] );
 }
 
+static void FreeEscapes( TidyPrintImpl* pprint )
+{
+    uint ix;
+    for ( ix = 0; ix < 256; ++ix )
+    {
+        MemFree( pprint->escapes[ix] );
+        pprint->escapes[ix] = NULL;
+    }
+}
+
 void TY_(FreePrintBuf)( TidyDocImpl* doc )
 {
     MemFree( doc->pprint.linebuf );
+    MemFree( doc->pprint.frames );
+    FreeEscapes( &doc->pprint );
+    if ( doc->pprint.keepcfg )
+        TY_(FreeConfigCopy)( doc->pprint.keepcfg );
+    tidyBufFree( &doc->pprint.kept );
+    MemFree( doc->pprint.splices );
+    MemFree( doc->pprint.replay );
     TY_(InitPrintBuf)( doc );
 }
 
+/* Select the save-time transforms for the following print run
+** from the current configuration.
+*/
+void TY_(InitPrintFilters)( TidyDocImpl* doc )
+{
+    TidyPrintImpl* pprint = &doc->pprint;
+    Bool makeClean = cfgBool( doc, TidyMakeClean );
+    Bool makeBare  = cfgBool( doc, TidyMakeBare );
+    uint filters = 0;
+
+    if ( cfgBool(doc, TidyEscapeCdata) )
+        filters |= PF_CDATA_AS_TEXT;
+
+    if ( cfgBool(doc, TidyHideComments) )
+        filters |= PF_DROP_COMMENTS;
+
+    if ( makeClean )
+        filters |= PF_DROP_FONT | PF_WBR_AS_SPACE;
+
+    if ( (makeClean && cfgBool(doc, TidyAsciiChars)) || makeBare )
+        filters |= PF_ASCII_QUOTES;
+
+    /* Note: no longer replaces &nbsp; in */
+    /* attribute values / non-text tokens */
+    if ( makeBare )
+        filters |= PF_NBSP_AS_SPACE;
+
+    pprint->filters = filters;
+    pprint->inPre = 0;
+    pprint->minify = cfgBool( doc, TidyMinify );
+
+    pprint->widecols = no;
+    pprint->dbcscols = no;
+#if SUPPORT_ASIAN_ENCODINGS
+    if ( IsWideLanguage(cfgStr(doc, TidyLanguage)) )
+    {
+        uint outenc = (uint)cfg( doc, TidyOutCharEncoding );
+        pprint->widecols = yes;
+        pprint->dbcscols = ( outenc == BIG5 || outenc == SHIFTJIS );
+    }
+#endif
+
+    /* entities are rendered for this version on first use */
+    FreeEscapes( pprint );
+    pprint->entvers = 0;
+    if ( !cfgBool(doc, TidyNumEntities) )
+        pprint->entvers = (uint) TY_(HTMLVersion)( doc );
+
+    /* output kept with other options, entities or encoding is stale */
+    pprint->keep = ( cfgBool(doc, TidyPrintCache) &&
+                     doc->docOut->encoding != ISO2022 );
+    if ( pprint->keep )
+    {
+        StreamOut* out = doc->docOut;
+        Bool changed;
+
+        if ( pprint->keepcfg == NULL )
+        {
+            uint size = N_TIDY_OPTIONS * sizeof(TidyOptionValue);
+            pprint->keepcfg = (TidyOptionValue*) MemAlloc( size );
+            ClearMemory( pprint->keepcfg, size );
+        }
+        changed = TY_(UpdateConfigCopy)( doc, pprint->keepcfg );
+        if ( changed || pprint->keepgen == 0 ||
+             pprint->keepvers != pprint->entvers ||
+             pprint->keepenc != out->encoding || pprint->keepnl != out->nl )
+        {
+            ++pprint->keepgen;
+            pprint->keepvers = pprint->entvers;
+            pprint->keepenc = out->encoding;
+            pprint->keepnl = out->nl;
+        }
+    }
+}
+
+static Bool IsHiddenNode( TidyDocImpl* doc, Node* node )
+{
+    return ( (doc->pprint.filters & PF_DROP_COMMENTS) &&
+             node->type == CommentTag );
+}
+
+/* element is not printed, its content is */
+static Bool IsTransparentNode( TidyDocImpl* doc, Node* node )
+{
+    return ( (doc->pprint.filters & PF_DROP_FONT) && nodeIsFONT(node) );
+}
+
+static Bool IsSpaceNode( TidyDocImpl* doc, Node* node )
+{
+    return ( (doc->pprint.filters & PF_WBR_AS_SPACE) && nodeIsWBR(node) );
+}
+
+/* node is printed as character data */
+static Bool IsPrintedText( TidyDocImpl* doc, Node* node )
+{
+    if ( node == NULL )
+        return no;
+
+    if ( node->type == TextNode )
+        return yes;
+
+    if ( node->type == CDATATag )
+        return ( (doc->pprint.filters & PF_CDATA_AS_TEXT) != 0 );
+
+    return IsSpaceNode( doc, node );
+}
+
+/*
+  With hidden comments and transparent <font> elements the
+  printed tree differs from the parse tree.  The following
+  walk the printed tree: hidden nodes are skipped, and the
+  content of a transparent element takes its place among
+  the element's siblings.
+*/
+static Node* PrintedForward( TidyDocImpl* doc, Node* node, Node* parent )
+{
+    if ( !(doc->pprint.filters & (PF_DROP_COMMENTS | PF_DROP_FONT)) )
+        return node;
+
+    for (;;)
+    {
+        if ( node == NULL )
+        {
+            if ( parent == NULL || !IsTransparentNode(doc, parent) )
+                return NULL;
+            node = parent->next;
+            parent = parent->parent;
+        }
+        else if ( IsHiddenNode(doc, node) )
+            node = node->next;
+        else if ( IsTransparentNode(doc, node) )
+        {
+            parent = node;
+            node = node->content;
+        }
+        else
+            return node;
+    }
+}
+
+static Node* PrintedBackward( TidyDocImpl* doc, Node* node, Node* parent )
+{
+    if ( !(doc->pprint.filters & (PF_DROP_COMMENTS | PF_DROP_FONT)) )
+        return node;
+
+    for (;;)
+    {
+        if ( node == NULL )
+        {
+            if ( parent == NULL || !IsTransparentNode(doc, parent) )
+                return NULL;
+            node = parent->prev;
+            parent = parent->parent;
+        }
+        else if ( IsHiddenNode(doc, node) )
+            node = node->prev;
+        else if ( IsTransparentNode(doc, node) )
+        {
+            parent = node;
+            node = node->last;
+        }
+        else
+            return node;
+    }
+}
+
+static Node* FirstPrinted( TidyDocImpl* doc, Node* node )
+{
+    return PrintedForward( doc, node->content, node );
+}
+
+static Node* NextPrinted( TidyDocImpl* doc, Node* node )
+{
+    return PrintedForward( doc, node->next, node->parent );
+}
+
+static Node* PrevPrinted( TidyDocImpl* doc, Node* node )
+{
+    return PrintedBackward( doc, node->prev, node->parent );
+}
+
+static Node* ParentPrinted( TidyDocImpl* doc, Node* node )
+{
+    Node* parent = node->parent;
+    while ( parent && IsTransparentNode(doc, parent) )
+        parent = parent->parent;
+    return parent;
+}
+
+/* Character substitutions for text printed from node */
+static uint TextFilters( TidyDocImpl* doc, Node* node )
+{
+    TidyPrintImpl* pprint = &doc->pprint;
+    uint filters = 0;
+
+    if ( IsPrintedText(doc, node) )
+    {
+        filters = pprint->filters & (PF_ASCII_QUOTES | PF_NBSP_AS_SPACE);
+        if ( pprint->inPre > 0 )
+            filters |= PF_NBSP_AS_SPACE;
+    }
+    return filters;
+}
+
+/*
+  Filters from Word and PowerPoint often use smart
+  quotes resulting in character codes between 128
+  and 159. Unfortunately, the corresponding HTML 4.0
+  entities for these are not widely supported. The
+  following converts dashes and quotation marks to
+  the nearest ASCII equivalent. My thanks to
+  Andrzej Novosiolov for his help with this code.
+
+  Note: The old code in the pretty printer applied
+  this to all node types and attribute values while
+  this routine applies it only to text nodes. First,
+  Microsoft Office products rarely put the relevant
+  characters into these tokens, second support for
+  them is much better now and last but not least, it
+  can be harmful to replace these characters since
+  US-ASCII quote marks are often used as syntax
+  characters, a simple
+
+    <a onmouseover="alert('&#x2018;')">...</a>
+
+  would be broken if the U+2018 is replaced by "'".
+  The old code would neither take care whether the
+  quote mark is already used as delimiter,
+
+    <p title='&#x2018;'>...</p>
+
+  got
+  
+    <p title='''>...</p>
+
+  Since browser support is much better nowadays and
+  high-quality typography is better than ASCII it'd
+  be probably a good idea to drop the feature...
+*/
+static uint FilterChar( uint filters, uint c )
+{
+    if ( (filters & PF_NBSP_AS_SPACE) && c == 160 )
+        return ' ';
+
+    if ( (filters & PF_ASCII_QUOTES) && c >= 0x2013 && c <= 0x201E )
+    {
+        switch (c)
+        {
+        case 0x2013: /* en dash */
+        case 0x2014: /* em dash */
+            c = '-';
+            break;
+        case 0x2018: /* left single  quotation mark */
+        case 0x2019: /* right single quotation mark */
+        case 0x201A: /* single low-9 quotation mark */
+            c = '\'';
+            break;
+        case 0x201C: /* left double  quotation mark */
+        case 0x201D: /* right double quotation mark */
+        case 0x201E: /* double low-9 quotation mark */
+            c = '"';
+            break;
+        }
+    }
+    return c;
+}
+
 static void expand( TidyPrintImpl* pprint, uint len )
 {
-    uint* ip;
+    tmbstr ip;
     uint buflen = pprint->lbufsize;
 
     if ( buflen == 0 )
-        buflen = 256;
+        buflen = 1024;
     while ( len >= buflen )
         buflen *= 2;
 
-    ip = (uint*) MemRealloc( pprint->linebuf, buflen*sizeof(uint) );
+    ip = (tmbstr) MemRealloc( pprint->linebuf, buflen );
     if ( ip )
     {
-      ClearMemory( ip+pprint->lbufsize, 
-                   (buflen-pprint->lbufsize)*sizeof(uint) );
+      ClearMemory( ip+pprint->lbufsize, buflen-pprint->lbufsize );
       pprint->lbufsize = buflen;
       pprint->linebuf = ip;
     }
 }
 
+/* The line buffer holds UTF-8.  It is private to the printer and
+** only has to give back what was put in, so values up to 0x7FFFFFFF
+** are kept in the original 5 and 6 byte forms and nothing is checked.
+*/
+static uint LineCharLen( uint c )
+{
+    if ( c < 0x80 )
+        return 1;
+    if ( c < 0x800 )
+        return 2;
+    if ( c < 0x10000 )
+        return 3;
+    if ( c < 0x200000 )
+        return 4;
+    if ( c < 0x4000000 )
+        return 5;
+    return 6;
+}
+
+static uint PutLineChar( tmbstr buf, uint c )
+{
+    static const byte lead[7] = { 0, 0, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC };
+    uint i, len = LineCharLen( c );
+
+    if ( len == 1 )
+    {
+        buf[0] = (tmbchar) c;
+        return 1;
+    }
+    for ( i = len - 1; i > 0; --i )
+    {
+        buf[i] = (tmbchar)( 0x80 | (c & 0x3F) );
+        c >>= 6;
+    }
+    buf[0] = (tmbchar)( lead[len] | c );
+    return len;
+}
+
+/* Also used for strings from the tree; a truncated
+** sequence yields U+FFFD.
+*/
+static uint GetLineChar( ctmbstr buf, uint len, uint* ch )
+{
+    const byte* p = (const byte*) buf;
+    uint c = p[0], n = 0, i;
+
+    if ( c >= 0xFC )
+        n = 5, c &= 0x01;
+    else if ( c >= 0xF8 )
+        n = 4, c &= 0x03;
+    else if ( c >= 0xF0 )
+        n = 3, c &= 0x07;
+    else if ( c >= 0xE0 )
+        n = 2, c &= 0x0F;
+    else if ( c >= 0xC0 )
+        n = 1, c &= 0x1F;
+
+    for ( i = 1; i <= n && i < len && (p[i] & 0xC0) == 0x80; ++i )
+        c = (c << 6) | (p[i] & 0x3F);
+
+    *ch = ( i > n ? c : 0xFFFD );
+    return i;
+}
+
+/* Display columns taken by c.  Big5 and Shift_JIS text is
+** printed as native codes, where any double byte code is wide.
+*/
+static uint CharColumns( TidyPrintImpl* pprint, uint c )
+{
+    if ( !pprint->widecols || c < 0x1100 )
+        return 1;
+    if ( pprint->dbcscols )
+        return ( c > 0xFF ? 2 : 1 );
+
+    if ( c <= 0x115F ||                          /* Hangul Jamo */
+         (c >= 0x2E80 && c <= 0xA4CF && c != 0x303F) ||
+         (c >= 0xAC00 && c <= 0xD7A3) ||         /* Hangul syllables */
+         (c >= 0xF900 && c <= 0xFAFF) ||         /* CJK compatibility */
+         (c >= 0xFE30 && c <= 0xFE4F) ||
+         (c >= 0xFF00 && c <= 0xFF60) ||         /* fullwidth forms */
+         (c >= 0xFFE0 && c <= 0xFFE6) ||
+         (c >= 0x20000 && c <= 0x3FFFD) )
+        return 2;
+    return 1;
+}
+
+/* Writes the first len bytes of the line.  For UTF-8 output the
+** buffer is written as is, in runs; newlines and the characters
+** WriteChar() would replace still go through it.
+*/
+static void WriteLine( TidyDocImpl* doc, uint len )
+{
+    TidyPrintImpl* pprint = &doc->pprint;
+    StreamOut* out = doc->docOut;
+    Bool asis = ( out->encoding == UTF8 );
+    uint i = 0, start = 0;
+
+    while ( i < len )
+    {
+        uint c, n = GetLineChar( pprint->linebuf + i, len - i, &c );
+
+        if ( !asis || c == '\n' || c > 0x10FFFF ||
+             c == 0xFFFE || c == 0xFFFF )
+        {
+            TY_(WriteBytes)( pprint->linebuf + start, i - start, out );
+            TY_(WriteChar)( c, out );
+            start = i + n;
+        }
+        i += n;
+    }
+    TY_(WriteBytes)( pprint->linebuf + start, len - start, out );
+}
+
 static uint GetSpaces( TidyPrintImpl* pprint )
 {
     int spaces = pprint->indent[ 0 ].spaces;
@@ -353,15 +743,15 @@ static Bool IsWrapInString( TidyPrintImpl* pprint )
              (ind->attrStringStart > 0 && ind->attrStringStart < wrap) );
 }
 
-static Bool HasMixedContent (Node *element)
+static Bool HasMixedContent( TidyDocImpl* doc, Node *element )
 {
     Node * node;
 
     if (!element)
         return no;
 
-    for (node = element->content; node; node = node->next)
-        if ( TY_(nodeIsText)(node) )
+    for (node = FirstPrinted(doc, element); node; node = NextPrinted(doc, node))
+        if ( IsPrintedText(doc, node) )
              return yes;
 
     return no;
@@ -399,54 +789,71 @@ static Bool WantIndent( TidyDocImpl* doc )
 }
 
 
+/* Wrapping is switched off in the option flags only, so that
+** the option values, which may be shared, stay untouched.
+*/
 static uint  WrapOff( TidyDocImpl* doc )
 {
-    uint saveWrap = (uint)cfg( doc, TidyWrapLen );
-    TY_(SetOptionInt)( doc, TidyWrapLen, 0xFFFFFFFF );  /* very large number */
+    uint saveWrap = doc->optflags.wraplen;
+    doc->optflags.wraplen = 0xFFFFFFFF;  /* very large number */
     return saveWrap;
 }
 
 static void  WrapOn( TidyDocImpl* doc, uint saveWrap )
 {
-    TY_(SetOptionInt)( doc, TidyWrapLen, saveWrap );
+    doc->optflags.wraplen = saveWrap;
 }
 
 static uint  WrapOffCond( TidyDocImpl* doc, Bool onoff )
 {
     if ( onoff )
         return WrapOff( doc );
-    return (uint)cfg( doc, TidyWrapLen );
+    return doc->optflags.wraplen;
 }
 
 
-static void AddC( TidyPrintImpl* pprint, uint c, uint string_index)
+static uint AddChar( TidyPrintImpl* pprint, uint c )
 {
-    if ( string_index + 1 >= pprint->lbufsize )
-        expand( pprint, string_index + 1 );
-    pprint->linebuf[string_index] = c;
+    if ( c > 0x7FFFFFFF )
+        c = 0xFFFD;
+    if ( pprint->linelen + 6 >= pprint->lbufsize )
+        expand( pprint, pprint->linelen + 6 );
+    pprint->linelen += PutLineChar( pprint->linebuf + pprint->linelen, c );
+    pprint->linecols += CharColumns( pprint, c );
+    return pprint->linelen;
 }
 
-static uint AddChar( TidyPrintImpl* pprint, uint c )
+/* str is UTF-8, as are all strings in the tree */
+static uint AddString( TidyPrintImpl* pprint, ctmbstr str )
 {
-    AddC( pprint, c, pprint->linelen );
-    return ++pprint->linelen;
+    size_t len = TY_(tmbstrlen)( str );
+    uint ix = 0;
+
+    assert( len <= UINT_MAX / 2 );
+    while ( ix < (uint) len )
+    {
+        uint c;
+        ix += GetLineChar( str + ix, (uint) len - ix, &c );
+        AddChar( pprint, c );
+    }
+    return pprint->linelen;
 }
 
-static uint AddAsciiString( TidyPrintImpl* pprint, ctmbstr str, uint string_index )
+/* Adds n ASCII characters in one go */
+static void AddAsciiRun( TidyPrintImpl* pprint, ctmbstr str, uint n )
 {
-    size_t ix, len = TY_(tmbstrlen)( str );
-    assert( string_index <= UINT_MAX - len );
-    if ( string_index + len >= pprint->lbufsize )
-        expand( pprint, (uint)( string_index + len ) );
-
-    for ( ix=0; ix<len; ++ix )
-        pprint->linebuf[string_index + ix] = str[ ix ];
-    return (uint)( string_index + len );
+    if ( pprint->linelen + n >= pprint->lbufsize )
+        expand( pprint, pprint->linelen + n );
+    memcpy( pprint->linebuf + pprint->linelen, str, n );
+    pprint->linelen += n;
+    pprint->linecols += n;
 }
 
-static uint AddString( TidyPrintImpl* pprint, ctmbstr str )
+/* Saves current output point as the wrap point */
+static void SetWrapPoint( TidyPrintImpl* pprint )
 {
-   return pprint->linelen = AddAsciiString( pprint, str, pprint->linelen );
+    pprint->wraphere = pprint->linelen;
+    pprint->wrapcols = pprint->linecols;
 }
 
 /* Saves current output point as the wrap point,
@@ -456,12 +863,13 @@ static uint AddString( TidyPrintImpl* pprint, ctmbstr str )
 static Bool SetWrap( TidyDocImpl* doc, uint indent )
 {
     TidyPrintImpl* pprint = &doc->pprint;
-    Bool wrap = ( indent + pprint->linelen < cfg(doc, TidyWrapLen) );
+    Bool wrap = ( pprint->minify ||
+                  indent + pprint->linecols < doc->optflags.wraplen );
     if ( wrap )
     {
         if ( pprint->indent[0].spaces < 0 )
             pprint->indent[0].spaces = indent;
-        pprint->wraphere = pprint->linelen;
+        SetWrapPoint( pprint );
     }
     else if ( pprint->ixInd == 0 )
     {
@@ -488,12 +896,13 @@ static Bool SetWrapAttr( TidyDocImpl* doc,
     TidyPrintImpl* pprint = &doc->pprint;
     TidyIndent *ind = pprint->indent + 0;
 
-    Bool wrap = ( indent + pprint->linelen < cfg(doc, TidyWrapLen) );
+    Bool wrap = ( pprint->minify ||
+                  indent + pprint->linecols < doc->optflags.wraplen );
     if ( wrap )
     {
         if ( ind[0].spaces < 0 )
             ind[0].spaces = indent;
-        pprint->wraphere = pprint->linelen;
+        SetWrapPoint( pprint );
     }
     else if ( pprint->ixInd == 0 )
     {
@@ -538,7 +947,7 @@ static void ResetLine( TidyPrintImpl* pprint )
         if ( ind[0].attrValStart > 0 )
             ind[0].attrValStart = 0;
     }
-    pprint->wraphere = pprint->ixInd = 0;
+    pprint->wraphere = pprint->wrapcols = pprint->ixInd = 0;
 }
 
 /* Shift text after wrap point to
@@ -548,24 +957,25 @@ static void ResetLineAfterWrap( TidyPrintImpl* pprint )
 {
     if ( pprint->linelen > pprint->wraphere )
     {
-        uint *p = pprint->linebuf;
-        uint *q = p + pprint->wraphere;
-        uint *end = p + pprint->linelen;
+        tmbstr p = pprint->linebuf;
+        tmbstr q = p + pprint->wraphere;
+        tmbstr end = p + pprint->linelen;
 
         if ( ! IsWrapInAttrVal(pprint) )
         {
             while ( q < end && *q == ' ' )
-                ++q, ++pprint->wraphere;
+                ++q, ++pprint->wraphere, ++pprint->wrapcols;
         }
 
-        while ( q < end )
-            *p++ = *q++;
+        memmove( p, q, end - q );
 
         pprint->linelen -= pprint->wraphere;
+        pprint->linecols -= pprint->wrapcols;
     }
     else
     {
         pprint->linelen = 0;
+        pprint->linecols = 0;
     }
 
     ResetLine( pprint );
@@ -580,7 +990,7 @@ static void WrapLine( TidyDocImpl* doc )
     TidyPrintImpl* pprint = &doc->pprint;
     uint i;
 
-    if ( pprint->wraphere == 0 )
+    if ( pprint->wraphere == 0 || pprint->minify )
         return;
 
     if ( WantIndent(doc) )
@@ -590,8 +1000,7 @@ static void WrapLine( TidyDocImpl* doc )
             TY_(WriteChar)( ' ', doc->docOut );
     }
 
-    for ( i = 0; i < pprint->wraphere; ++i )
-        TY_(WriteChar)( pprint->linebuf[i], doc->docOut );
+    WriteLine( doc, pprint->wraphere );
 
     if ( IsWrapInString(pprint) )
         TY_(WriteChar)( '\\', doc->docOut );
@@ -607,7 +1016,7 @@ static void WrapLine( TidyDocImpl* doc )
 static Bool CheckWrapLine( TidyDocImpl* doc )
 {
     TidyPrintImpl* pprint = &doc->pprint;
-    if ( GetSpaces(pprint) + pprint->linelen >= cfg(doc, TidyWrapLen) )
+    if ( GetSpaces(pprint) + pprint->linecols >= doc->optflags.wraplen )
     {
         WrapLine( doc );
         return yes;
@@ -618,7 +1027,7 @@ static Bool CheckWrapLine( TidyDocImpl* doc )
 static Bool CheckWrapIndent( TidyDocImpl* doc, uint indent )
 {
     TidyPrintImpl* pprint = &doc->pprint;
-    if ( GetSpaces(pprint) + pprint->linelen >= cfg(doc, TidyWrapLen) )
+    if ( GetSpaces(pprint) + pprint->linecols >= doc->optflags.wraplen )
     {
         WrapLine( doc );
         if ( pprint->indent[ 0 ].spaces < 0 )
@@ -634,6 +1043,9 @@ static void WrapAttrVal( TidyDocImpl* doc )
     uint i;
 
     /* assert( IsWrapInAttrVal(pprint) ); */
+    if ( pprint->minify )
+        return;
+
     if ( WantIndent(doc) )
     {
         uint spaces = GetSpaces( pprint );
@@ -641,8 +1053,7 @@ static void WrapAttrVal( TidyDocImpl* doc )
             TY_(WriteChar)( ' ', doc->docOut );
     }
 
-    for ( i = 0; i < pprint->wraphere; ++i )
-        TY_(WriteChar)( pprint->linebuf[i], doc->docOut );
+    WriteLine( doc, pprint->wraphere );
 
     if ( IsWrapInString(pprint) )
         TY_(WriteChar)( '\\', doc->docOut );
@@ -653,10 +1064,32 @@ static void WrapAttrVal( TidyDocImpl* doc )
     ResetLineAfterWrap( pprint );
 }
 
+/* Minified output has no line breaks or indentation of its
+** own, the line is just written out.
+*/
+static void FlushMinified( TidyDocImpl* doc, uint indent )
+{
+    TidyPrintImpl* pprint = &doc->pprint;
+
+    if ( pprint->linelen > 0 )
+    {
+        WriteLine( doc, pprint->linelen );
+        ResetLine( pprint );
+        pprint->linelen = pprint->linecols = 0;
+    }
+    pprint->indent[ 0 ].spaces = indent;
+}
+
 void TY_(PFlushLine)( TidyDocImpl* doc, uint indent )
 {
     TidyPrintImpl* pprint = &doc->pprint;
 
+    if ( pprint->minify )
+    {
+        FlushMinified( doc, indent );
+        return;
+    }
+
     if ( pprint->linelen > 0 )
     {
         uint i;
@@ -670,13 +1103,12 @@ void TY_(PFlushLine)( TidyDocImpl* doc, uint indent )
                 TY_(WriteChar)( ' ', doc->docOut );
         }
 
-        for ( i = 0; i < pprint->linelen; ++i )
-            TY_(WriteChar)( pprint->linebuf[i], doc->docOut );
+        WriteLine( doc, pprint->linelen );
 
         if ( IsInString(pprint) )
             TY_(WriteChar)( '\\', doc->docOut );
         ResetLine( pprint );
-        pprint->linelen = 0;
+        pprint->linelen = pprint->linecols = 0;
     }
 
     TY_(WriteChar)( '\n', doc->docOut );
@@ -686,7 +1118,9 @@ void TY_(PFlushLine)( TidyDocImpl* doc, uint indent )
 static void PCondFlushLine( TidyDocImpl* doc, uint indent )
 {
     TidyPrintImpl* pprint = &doc->pprint;
-    if ( pprint->linelen > 0 )
+    if ( pprint->minify )
+        FlushMinified( doc, indent );
+    else if ( pprint->linelen > 0 )
     {
         uint i;
 
@@ -699,8 +1133,7 @@ static void PCondFlushLine( TidyDocImpl* doc, uint indent )
                 TY_(WriteChar)(' ', doc->docOut);
         }
 
-        for ( i = 0; i < pprint->linelen; ++i )
-            TY_(WriteChar)( pprint->linebuf[i], doc->docOut );
+        WriteLine( doc, pprint->linelen );
 
         if ( IsInString(pprint) )
             TY_(WriteChar)( '\\', doc->docOut );
@@ -708,17 +1141,66 @@ static void PCondFlushLine( TidyDocImpl* doc, uint indent )
 
         TY_(WriteChar)( '\n', doc->docOut );
         pprint->indent[ 0 ].spaces = indent;
-        pprint->linelen = 0;
+        pprint->linelen = pprint->linecols = 0;
+    }
+}
+
+/* A line break that is part of the content, or that the markup
+** after it depends on.  Minified output keeps it as a character.
+*/
+static void PFlushContentLine( TidyDocImpl* doc, uint indent )
+{
+    if ( doc->pprint.minify )
+        AddChar( &doc->pprint, '\n' );
+    else
+        TY_(PFlushLine)( doc, indent );
+}
+
+/* Slots hold the longest entity, "&thetasym;", and "&#65535;" */
+#define ESCAPE_SLOT  12u
+
+/* Named entity, if wanted and known for the document's version,
+** or else numeric character reference for c.  Whether a name is
+** wanted depends only on c and the output encoding, so escapes
+** for the BMP are rendered once per save and kept in pages of
+** 256 slots.
+*/
+static ctmbstr CharEscape( TidyDocImpl* doc, uint c, Bool named,
+                           tmbstr buf, uint size )
+{
+    TidyPrintImpl* pprint = &doc->pprint;
+    ctmbstr name = NULL;
+
+    if ( c <= 0xFFFF )
+    {
+        tmbstr page = pprint->escapes[ c >> 8 ];
+        if ( page == NULL )
+        {
+            page = (tmbstr) MemAlloc( 256 * ESCAPE_SLOT );
+            ClearMemory( page, 256 * ESCAPE_SLOT );
+            pprint->escapes[ c >> 8 ] = page;
+        }
+        buf = page + (c & 0xFF) * ESCAPE_SLOT;
+        size = ESCAPE_SLOT;
+        if ( buf[0] != '\0' )
+            return buf;
     }
+
+    if ( named && pprint->entvers )
+        name = TY_(EntityName)( c, pprint->entvers );
+    if ( name )
+        TY_(tmbsnprintf)( buf, size, "&%s;", name );
+    else
+        TY_(tmbsnprintf)( buf, size, "&#%u;", c );
+    return buf;
 }
 
 static void PPrintChar( TidyDocImpl* doc, uint c, uint mode )
 {
     tmbchar entity[128];
-    ctmbstr p;
     TidyPrintImpl* pprint  = &doc->pprint;
-    uint outenc = (uint)cfg( doc, TidyOutCharEncoding );
-    Bool qmark = cfgBool( doc, TidyQuoteMarks );
+    uint outenc = doc->optflags.outenc;
+    Bool qmark = cfgFlag( doc, OF_QUOTE_MARKS );
 
     if ( c == ' ' && !(mode & (PREFORMATTED | COMMENT | ATTRIBVALUE | CDATA)))
     {
@@ -727,13 +1209,13 @@ static void PPrintChar( TidyDocImpl* doc, uint c, uint mode )
         {
             ctmbstr ent = "&nbsp;";
             /* by default XML doesn't define &nbsp; */
-            if ( cfgBool(doc, TidyNumEntities) || cfgBool(doc, TidyXmlTags) )
+            if ( cfgFlag(doc, OF_NUM_ENTITIES | OF_XML_TAGS) )
                 ent = "&#160;";
             AddString( pprint, ent );
             return;
         }
         else
-            pprint->wraphere = pprint->linelen;
+            SetWrapPoint( pprint );
     }
 
     /* comment characters are passed raw */
@@ -772,9 +1254,9 @@ static void PPrintChar( TidyDocImpl* doc, uint c, uint mode )
                     See fix for [4642206] in lexer.c
 */
 #ifdef TIDY_APPLE_CHANGES
-        if ( c == '&' && cfgBool(doc, TidyQuoteAmpersand) && (cfg(doc, TidyOutCharEncoding) != RAW) )
+        if ( c == '&' && cfgFlag(doc, OF_QUOTE_AMP) && outenc != RAW )
 #else
-        if ( c == '&' && cfgBool(doc, TidyQuoteAmpersand) )
+        if ( c == '&' && cfgFlag(doc, OF_QUOTE_AMP) )
 #endif
         {
             AddString( pprint, "&amp;" );
@@ -795,10 +1277,9 @@ static void PPrintChar( TidyDocImpl* doc, uint c, uint mode )
 
         if ( c == 160 && outenc != RAW )
         {
-            if ( cfgBool(doc, TidyQuoteNbsp) )
+            if ( cfgFlag(doc, OF_QUOTE_NBSP) )
             {
-                if ( cfgBool(doc, TidyNumEntities) ||
-                     cfgBool(doc, TidyXmlTags) )
+                if ( cfgFlag(doc, OF_NUM_ENTITIES | OF_XML_TAGS) )
                     AddString( pprint, "&#160;" );
                 else
                     AddString( pprint, "&nbsp;" );
@@ -821,13 +1302,16 @@ static void PPrintChar( TidyDocImpl* doc, uint c, uint mode )
     case UTF16LE:
     case UTF16BE:
 #endif
-        if (!(mode & PREFORMATTED) && cfg(doc, TidyPunctWrap))
+        if (!(mode & PREFORMATTED) && cfgFlag(doc, OF_PUNCT_WRAP))
         {
             WrapPoint wp = CharacterWrapPoint(c);
             if (wp == WrapBefore)
-                pprint->wraphere = pprint->linelen;
+                SetWrapPoint( pprint );
             else if (wp == WrapAfter)
-                pprint->wraphere = pprint->linelen + 1;
+            {
+                pprint->wraphere = pprint->linelen + LineCharLen(c);
+                pprint->wrapcols = pprint->linecols + CharColumns(pprint, c);
+            }
         }
         break;
 
@@ -835,13 +1319,11 @@ static void PPrintChar( TidyDocImpl* doc, uint c, uint mode )
         /* Allow linebreak at Chinese punctuation characters */
         /* There are not many spaces in Chinese */
         AddChar( pprint, c );
-        if (!(mode & PREFORMATTED)  && cfg(doc, TidyPunctWrap))
+        if (!(mode & PREFORMATTED)  && cfgFlag(doc, OF_PUNCT_WRAP))
         {
             WrapPoint wp = Big5WrapPoint(c);
-            if (wp == WrapBefore)
-                pprint->wraphere = pprint->linelen;
-            else if (wp == WrapAfter)
-                pprint->wraphere = pprint->linelen + 1;
+            if (wp == WrapBefore || wp == WrapAfter)
+                SetWrapPoint( pprint );
         }
         return;
 
@@ -875,20 +1357,13 @@ static void PPrintChar( TidyDocImpl* doc, uint c, uint mode )
     {
         if (c > 255)  /* multi byte chars */
         {
-            uint vers = TY_(HTMLVersion)( doc );
-            if ( !cfgBool(doc, TidyNumEntities) && (p = TY_(EntityName)(c, vers)) )
-                TY_(tmbsnprintf)(entity, sizeof(entity), "&%s;", p);
-            else
-                TY_(tmbsnprintf)(entity, sizeof(entity), "&#%u;", c);
-
-            AddString( pprint, entity );
+            AddString( pprint, CharEscape(doc, c, yes, entity, sizeof(entity)) );
             return;
         }
 
         if (c > 126 && c < 160)
         {
-            TY_(tmbsnprintf)(entity, sizeof(entity), "&#%u;", c);
-            AddString( pprint, entity );
+            AddString( pprint, CharEscape(doc, c, no, entity, sizeof(entity)) );
             return;
         }
 
@@ -918,8 +1393,7 @@ static void PPrintChar( TidyDocImpl* doc, uint c, uint mode )
         /* if ASCII use numeric entities for chars > 127 */
         if ( c > 127 && outenc == ASCII )
         {
-            TY_(tmbsnprintf)(entity, sizeof(entity), "&#%u;", c);
-            AddString( pprint, entity );
+            AddString( pprint, CharEscape(doc, c, no, entity, sizeof(entity)) );
             return;
         }
 
@@ -931,19 +1405,42 @@ static void PPrintChar( TidyDocImpl* doc, uint c, uint mode )
     /* default treatment for ASCII */
     if ( outenc == ASCII && (c > 126 || (c < ' ' && c != '\t')) )
     {
-        uint vers = TY_(HTMLVersion)( doc );
-        if (!cfgBool(doc, TidyNumEntities) && (p = TY_(EntityName)(c, vers)) )
-            TY_(tmbsnprintf)(entity, sizeof(entity), "&%s;", p);
-        else
-            TY_(tmbsnprintf)(entity, sizeof(entity), "&#%u;", c);
-
-        AddString( pprint, entity );
+        AddString( pprint, CharEscape(doc, c, yes, entity, sizeof(entity)) );
         return;
     }
 
     AddChar( pprint, c );
 }
 
+/* Printable ASCII that PPrintChar() adds unchanged in any output
+** encoding, without setting a wrap point.  Markup characters and
+** quotes are only passed raw in comments and CDATA.
+*/
+static Bool IsPlainChar( uint c, Bool raw )
+{
+    if ( c <= ' ' || c >= 0x7F )
+        return no;
+    return ( raw || (c != '<' && c != '>' && c != '&' &&
+                     c != '"' && c != '\'') );
+}
+
+/* Length of the run of plain characters at ix, limited to the
+** columns left before the line has to be checked for wrapping.
+*/
+static uint PlainRun( TidyDocImpl* doc, uint ix, uint end,
+                      Bool raw, uint wraplen )
+{
+    TidyPrintImpl* pprint = &doc->pprint;
+    ctmbstr text = doc->lexer->lexbuf;
+    uint used = GetSpaces( pprint ) + pprint->linecols;
+    uint room = ( used < wraplen ? wraplen - used : 1 );
+    uint n = 1;
+
+    while ( n < room && ix + n < end && IsPlainChar((byte) text[ix + n], raw) )
+        ++n;
+    return n;
+}
+
 static uint IncrWS( uint start, uint end, uint indent, int ixWS )
 {
   if ( ixWS > 0 )
@@ -954,10 +1451,9 @@ static uint IncrWS( uint start, uint end, uint indent, int ixWS )
   return start;
 }
 /* 
-  The line buffer is uint not char so we can
-  hold Unicode values unencoded. The translation
-  to UTF-8 is deferred to the TY_(WriteChar)() routine called
-  to flush the line buffer.
+  The line buffer holds UTF-8, whatever the output
+  encoding.  Translation to the output encoding is
+  deferred to WriteLine(), called to flush the line buffer.
 */
 static void PPrintText( TidyDocImpl* doc, uint mode, uint indent,
                         Node* node  )
@@ -965,6 +1461,9 @@ static void PPrintText( TidyDocImpl* doc, uint mode, uint indent,
     uint start = node->start;
     uint end = node->end;
     uint ix, c = 0;
+    uint filters = TextFilters( doc, node );
+    uint wraplen = doc->optflags.wraplen;
+    Bool raw = ( (mode & (COMMENT | CDATA)) != 0 );
     int  ixNL = TextEndsWithNewline( doc->lexer, node, mode );
     int  ixWS = TextStartsWithWhitespace( doc->lexer, node, start, mode );
     if ( ixNL > 0 )
@@ -983,13 +1482,27 @@ static void PPrintText( TidyDocImpl* doc, uint mode, uint indent,
         */
         c = (byte) doc->lexer->lexbuf[ix];
 
+        /* copy plain text up to the next character that needs
+           escaping, may be a wrap point, or needs a wrap check */
+        if ( IsPlainChar(c, raw) )
+        {
+            uint n = PlainRun( doc, ix, end, raw, wraplen );
+            AddAsciiRun( &doc->pprint, doc->lexer->lexbuf + ix, n );
+            ix += n - 1;
+            continue;
+        }
+
         /* look for UTF-8 multibyte character */
         if ( c > 0x7F )
+        {
              ix += TY_(GetUTF8)( doc->lexer->lexbuf + ix, &c );
+             if ( filters )
+                 c = FilterChar( filters, c );
+        }
 
         if ( c == '\n' )
         {
-            TY_(PFlushLine)( doc, indent );
+            PFlushContentLine( doc, indent );
             ixWS = TextStartsWithWhitespace( doc->lexer, node, ix+1, mode );
             ix = IncrWS( ix, end, indent, ixWS );
         }
@@ -1047,7 +1560,7 @@ static void PPrintAttrValue( TidyDocImpl* doc, uint indent,
 
     if ( value )
     {
-        uint wraplen = (uint)cfg( doc, TidyWrapLen );
+        uint wraplen = doc->optflags.wraplen;
         int attrStart = SetInAttrVal( pprint );
         int strStart = ClearInString( pprint );
 
@@ -1059,7 +1572,7 @@ static void PPrintAttrValue( TidyDocImpl* doc, uint indent,
                 SetWrapAttr( doc, indent, attrStart, strStart );
 
             if ( wrappable && pprint->wraphere > 0 &&
-                 GetSpaces(pprint) + pprint->linelen >= wraplen )
+                 GetSpaces(pprint) + pprint->linecols >= wraplen )
                 WrapAttrVal( doc );
 
             if ( c == delim )
@@ -1127,7 +1640,7 @@ static uint AttrIndent( TidyDocImpl* doc, Node* node, AttVal* ARG_UNUSED(attr) )
   size_t node_element_len = TY_(tmbstrlen)( node->element );
   assert( xtra <= UINT_MAX - node_element_len );
   if ( !TY_(nodeHasCM)(node, CM_INLINE) ||
-       !ShouldIndent(doc, node->parent ? node->parent: node) )
+       !ShouldIndent(doc, node->parent ? ParentPrinted(doc, node): node) )
     return (uint)( xtra + node_element_len );
 
   if ( NULL != (node = TY_(FindContainer)(node)) )
@@ -1137,7 +1650,8 @@ static uint AttrIndent( TidyDocImpl* doc, Node* node, AttVal* ARG_UNUSED(attr) )
 
 static Bool AttrNoIndentFirst( /*TidyDocImpl* doc,*/ Node* node, AttVal* attr )
 {
-  return ( attr==node->attributes );
+  /* node->attributes is NULL for a lone synthesized xml:space */
+  return ( attr==node->attributes || node->attributes==NULL );
   
   /*&& 
            ( InsideHead(doc, node) ||
@@ -1153,7 +1667,8 @@ static void PPrintAttribute( TidyDocImpl* doc, uint indent,
     Bool xhtmlOut  = cfgBool( doc, TidyXhtmlOut );
     Bool wrapAttrs = cfgBool( doc, TidyWrapAttVals );
     Bool ucAttrs   = cfgBool( doc, TidyUpperCaseAttrs );
-    Bool indAttrs  = cfgBool( doc, TidyIndentAttributes );
+    Bool indAttrs  = ( cfgBool(doc, TidyIndentAttributes) &&
+                       !doc->pprint.minify );
     uint xtra      = AttrIndent( doc, node, attr );
     Bool first     = AttrNoIndentFirst( /*doc,*/ node, attr );
     tmbstr name    = attr->attribute;
@@ -1243,14 +1758,6 @@ static void PPrintAttrs( TidyDocImpl* doc, uint indent, Node *node )
     TidyPrintImpl* pprint = &doc->pprint;
     AttVal* av;
 
-    /* add xml:space attribute to pre and other elements */
-    if ( cfgBool(doc, TidyXmlOut) && cfgBool(doc, TidyXmlSpace) &&
-         !TY_(GetAttrByName)(node, "xml:space") &&
-         TY_(XMLPreserveWhiteSpace)(doc, node) )
-    {
-        TY_(AddAttribute)( doc, node, "xml:space", "preserve" );
-    }
-
     for ( av = node->attributes; av; av = av->next )
     {
         if ( av->attribute != NULL )
@@ -1268,6 +1775,19 @@ static void PPrintAttrs( TidyDocImpl* doc, uint indent, Node *node )
             PPrintPhp( doc, indent, av->php );
         }
     }
+
+    /* add xml:space attribute to pre and other elements */
+    if ( cfgBool(doc, TidyXmlOut) && cfgBool(doc, TidyXmlSpace) &&
+         !TY_(GetAttrByName)(node, "xml:space") &&
+         TY_(XMLPreserveWhiteSpace)(doc, node) )
+    {
+        AttVal xmlSpace;
+        ClearMemory( &xmlSpace, sizeof(xmlSpace) );
+        xmlSpace.attribute = (tmbstr) "xml:space";
+        xmlSpace.value = (tmbstr) "preserve";
+        xmlSpace.delim = '"';
+        PPrintAttribute( doc, indent, node, &xmlSpace );
+    }
 }
 
 /*
@@ -1284,17 +1804,21 @@ static void PPrintAttrs( TidyDocImpl* doc, uint indent, Node *node )
  <p><img />
  x<</p> won't.
 */
-static Bool AfterSpaceImp(Lexer *lexer, Node *node, Bool isEmpty)
+static Bool AfterSpaceImp( TidyDocImpl* doc, Node *node, Bool isEmpty )
 {
-    Node *prev;
+    Lexer* lexer = doc->lexer;
+    Node *prev, *parent;
 
     if ( !TY_(nodeCMIsInline)(node) )
         return yes;
 
-    prev = node->prev;
+    prev = PrevPrinted( doc, node );
     if (prev)
     {
-        if (TY_(nodeIsText)(prev) && prev->end > prev->start)
+        if ( IsSpaceNode(doc, prev) )
+            return yes;
+
+        if (IsPrintedText(doc, prev) && prev->end > prev->start)
         {
             uint i, c = '\0'; /* initialised to avoid warnings */
             for (i = prev->start; i < prev->end; ++i)
@@ -1303,6 +1827,7 @@ static Bool AfterSpaceImp(Lexer *lexer, Node *node, Bool isEmpty)
                 if ( c > 0x7F )
                     i += TY_(GetUTF8)( lexer->lexbuf + i, &c );
             }
+            c = FilterChar( TextFilters(doc, prev), c );
 
             if ( c == ' ' || c == '\n' )
                 return yes;
@@ -1313,15 +1838,16 @@ static Bool AfterSpaceImp(Lexer *lexer, Node *node, Bool isEmpty)
         return no;
     }
 
-    if ( isEmpty && !TY_(nodeCMIsInline)(node->parent) )
+    parent = ParentPrinted( doc, node );
+    if ( isEmpty && !TY_(nodeCMIsInline)(parent) )
         return no;
 
-    return AfterSpaceImp(lexer, node->parent, isEmpty);
+    return AfterSpaceImp(doc, parent, isEmpty);
 }
 
-static Bool AfterSpace(Lexer *lexer, Node *node)
+static Bool AfterSpace( TidyDocImpl* doc, Node *node )
 {
-    return AfterSpaceImp(lexer, node, TY_(nodeCMIsEmpty)(node));
+    return AfterSpaceImp(doc, node, TY_(nodeCMIsEmpty)(node));
 }
 
 static void PPrintTag( TidyDocImpl* doc,
@@ -1357,8 +1883,10 @@ static void PPrintTag( TidyDocImpl* doc,
 
     PPrintAttrs( doc, indent, node );
 
+    /* with xhtml output, <foo/> containers get an explicit end tag */
     if ( (xmlOut || xhtmlOut) &&
-         (node->type == StartEndTag || TY_(nodeCMIsEmpty)(node)) )
+         ((node->type == StartEndTag && !xhtmlOut) ||
+          TY_(nodeCMIsEmpty)(node)) )
     {
         AddChar( pprint, ' ' );   /* Space is NS compatibility hack <br /> */
         AddChar( pprint, '/' );   /* Required end tag marker */
@@ -1368,10 +1896,10 @@ static void PPrintTag( TidyDocImpl* doc,
 
     if ( (node->type != StartEndTag || xhtmlOut) && !(mode & PREFORMATTED) )
     {
-        uint wraplen = (uint)cfg( doc, TidyWrapLen );
+        uint wraplen = doc->optflags.wraplen;
         CheckWrapIndent( doc, indent );
 
-        if ( indent + pprint->linelen < wraplen )
+        if ( indent + pprint->linecols < wraplen )
         {
             /* wrap after start tag if is <br/> or if it's not inline.
                Technically, it would be safe to call only AfterSpace.
@@ -1380,16 +1908,16 @@ static void PPrintTag( TidyDocImpl* doc,
                elements but can still be false for some <br>. So it has to
                stay as well. */
             if (!(mode & NOWRAP) && (!TY_(nodeCMIsInline)(node) || nodeIsBR(node))
-                && AfterSpace(doc->lexer, node))
+                && AfterSpace(doc, node))
             {
-                pprint->wraphere = pprint->linelen;
+                SetWrapPoint( pprint );
             }
         }
         /* flush the current buffer only if it is known to be safe,
            i.e. it will not introduce some spurious white spaces.
            See bug #996484 */
         else if ( mode & NOWRAP ||
-                  nodeIsBR(node) || AfterSpace(doc->lexer, node))
+                  nodeIsBR(node) || AfterSpace(doc, node))
             PCondFlushLine( doc, indent );
     }
 }
@@ -1454,14 +1982,14 @@ static void PPrintComment( TidyDocImpl* doc, uint indent, Node* node )
 
     AddString(pprint, "--");
     AddChar( pprint, '>' );
-    if ( node->linebreak && node->next )
-        TY_(PFlushLine)( doc, indent );
+    if ( node->linebreak && NextPrinted(doc, node) )
+        PFlushContentLine( doc, indent );
 }
 
 static void PPrintDocType( TidyDocImpl* doc, uint indent, Node *node )
 {
     TidyPrintImpl* pprint = &doc->pprint;
-    uint wraplen = (uint)cfg( doc, TidyWrapLen );
+    uint wraplen = doc->optflags.wraplen;
     uint spaces = (uint)cfg( doc, TidyIndentSpaces );
     AttVal* fpi = TY_(GetAttrByName)(node, "PUBLIC");
     AttVal* sys = TY_(GetAttrByName)(node, "SYSTEM");
@@ -1488,12 +2016,13 @@ static void PPrintDocType( TidyDocImpl* doc, uint indent, Node *node )
 
     if (fpi && fpi->value && sys && sys->value)
     {
-        size_t i = pprint->linelen - (TY_(tmbstrlen)(sys->value) + 2) - 1;
+        size_t i = pprint->linecols - (TY_(tmbstrlen)(sys->value) + 2) - 1;
         if (!(i>0&&TY_(tmbstrlen)(sys->value)+2+i<wraplen&&i<=(spaces?spaces:2)*2))
             i = 0;
 
         assert( i <= UINT_MAX );
-        PCondFlushLine(doc, (uint)i);
+        if (!pprint->minify)
+            PCondFlushLine(doc, (uint)i);
         if (pprint->linelen)
             AddChar(pprint, ' ');
     }
@@ -1560,11 +2089,11 @@ static void PPrintXmlDecl( TidyDocImpl* doc, uint indent, Node *node )
     TidyPrintImpl* pprint = &doc->pprint;
     Bool ucAttrs;
     SetWrap( doc, indent );
-    saveWrap = WrapOff( doc );
 
     /* no case translation for XML declaration pseudo attributes */
     ucAttrs = cfgBool(doc, TidyUpperCaseAttrs);
     TY_(SetOptionBool)(doc, TidyUpperCaseAttrs, no);
+    saveWrap = WrapOff( doc );
 
     AddString( pprint, "<?xml" );
 
@@ -1577,13 +2106,13 @@ static void PPrintXmlDecl( TidyDocImpl* doc, uint indent, Node *node )
     if ( NULL != (att = TY_(GetAttrByName)(node, "standalone")) )
       PPrintAttribute( doc, indent, node, att );
 
-    /* restore old config value */
-    TY_(SetOptionBool)(doc, TidyUpperCaseAttrs, ucAttrs);
-
     if ( node->end <= 0 || doc->lexer->lexbuf[node->end - 1] != '?' )
         AddChar( pprint, '?' );
     AddChar( pprint, '>' );
     WrapOn( doc, saveWrap );
+
+    /* restore old config value */
+    TY_(SetOptionBool)(doc, TidyUpperCaseAttrs, ucAttrs);
     TY_(PFlushLine)( doc, indent );
 }
 
@@ -1781,16 +2310,42 @@ static Bool HasCDATA( Lexer* lexer, Node* node )
 }
 
 
+/* Comment delimiters for the CDATA markers put around script and
+** style content in XHTML output.  Returns no if the content is in
+** a CDATA section already.
+*/
+static Bool ScriptCDATAComment( TidyDocImpl* doc, Node* node,
+                                ctmbstr* commentStart, ctmbstr* commentEnd )
+{
+    AttVal* type = attrGetTYPE(node);
+
+    *commentStart = DEFAULT_COMMENT_START;
+    *commentEnd = DEFAULT_COMMENT_END;
+
+    if (AttrValueIs(type, "text/javascript"))
+    {
+        *commentStart = JS_COMMENT_START;
+        *commentEnd = JS_COMMENT_END;
+    }
+    else if (AttrValueIs(type, "text/css"))
+    {
+        *commentStart = CSS_COMMENT_START;
+        *commentEnd = CSS_COMMENT_END;
+    }
+    else if (AttrValueIs(type, "text/vbscript"))
+    {
+        *commentStart = VB_COMMENT_START;
+        *commentEnd = VB_COMMENT_END;
+    }
+
+    return !HasCDATA(doc->lexer, FirstPrinted(doc, node));
+}
+
 static
-void PPrintScriptStyle( TidyDocImpl* doc, uint mode, uint indent, Node *node )
+void PPrintScriptStart( TidyDocImpl* doc, uint mode, uint indent, Node *node )
 {
     TidyPrintImpl* pprint = &doc->pprint;
-    Node*   content;
-    ctmbstr commentStart = DEFAULT_COMMENT_START;
-    ctmbstr commentEnd = DEFAULT_COMMENT_END;
-    Bool    hasCData = no;
-    int     contentIndent = -1;
-    Bool    xhtmlOut = cfgBool( doc, TidyXhtmlOut );
+    ctmbstr commentStart, commentEnd;
 
     if ( InsideHead(doc, node) )
       TY_(PFlushLine)( doc, indent );
@@ -1800,56 +2355,30 @@ void PPrintScriptStyle( TidyDocImpl* doc, uint mode, uint indent, Node *node )
     /* use zero indent here, see http://tidy.sf.net/bug/729972 */
     TY_(PFlushLine)(doc, 0);
 
-    if ( xhtmlOut && node->content != NULL )
+    if ( cfgBool(doc, TidyXhtmlOut) && FirstPrinted(doc, node) != NULL &&
+         ScriptCDATAComment(doc, node, &commentStart, &commentEnd) )
     {
-        AttVal* type = attrGetTYPE(node);
+        uint saveWrap = WrapOff( doc );
 
-        if (AttrValueIs(type, "text/javascript"))
-        {
-            commentStart = JS_COMMENT_START;
-            commentEnd = JS_COMMENT_END;
-        }
-        else if (AttrValueIs(type, "text/css"))
-        {
-            commentStart = CSS_COMMENT_START;
-            commentEnd = CSS_COMMENT_END;
-        }
-        else if (AttrValueIs(type, "text/vbscript"))
-        {
-            commentStart = VB_COMMENT_START;
-            commentEnd = VB_COMMENT_END;
-        }
-
-        hasCData = HasCDATA(doc->lexer, node->content);
-
-        if (!hasCData)
-        {
-            uint saveWrap = WrapOff( doc );
-
-            AddString( pprint, commentStart );
-            AddString( pprint, CDATA_START );
-            AddString( pprint, commentEnd );
-            PCondFlushLine( doc, indent );
+        AddString( pprint, commentStart );
+        AddString( pprint, CDATA_START );
+        AddString( pprint, commentEnd );
+        PFlushContentLine( doc, indent );
 
-            WrapOn( doc, saveWrap );
-        }
+        WrapOn( doc, saveWrap );
     }
+}
 
-    for ( content = node->content;
-          content != NULL;
-          content = content->next )
-    {
-        /*
-          This is a bit odd, with the current code there can only
-          be one child and the only caller of this function defines
-          all these modes already...
-        */
-        TY_(PPrintTree)( doc, (mode | PREFORMATTED | NOWRAP | CDATA), 
-                         indent, content );
+/* last: the last child printed */
+static void PPrintScriptEnd( TidyDocImpl* doc, uint mode, uint indent,
+                             Node *node, Node* last )
+{
+    TidyPrintImpl* pprint = &doc->pprint;
+    ctmbstr commentStart, commentEnd;
+    int     contentIndent = -1;
 
-        if ( content == node->last )
-            contentIndent = TextEndsWithNewline( doc->lexer, content, CDATA );
-    }
+    if ( last != NULL )
+        contentIndent = TextEndsWithNewline( doc->lexer, last, CDATA );
 
     if ( contentIndent < 0 )
     {
@@ -1857,28 +2386,26 @@ void PPrintScriptStyle( TidyDocImpl* doc, uint mode, uint indent, Node *node )
         contentIndent = 0;
     }
 
-    if ( xhtmlOut && node->content != NULL )
+    if ( cfgBool(doc, TidyXhtmlOut) && FirstPrinted(doc, node) != NULL &&
+         ScriptCDATAComment(doc, node, &commentStart, &commentEnd) )
     {
-        if ( ! hasCData )
-        {
-            uint saveWrap = WrapOff( doc );
+        uint saveWrap = WrapOff( doc );
 
-            AddString( pprint, commentStart );
-            AddString( pprint, CDATA_END );
-            AddString( pprint, commentEnd );
+        AddString( pprint, commentStart );
+        AddString( pprint, CDATA_END );
+        AddString( pprint, commentEnd );
 
-            WrapOn( doc, saveWrap );
-            PCondFlushLine( doc, indent );
-        }
+        WrapOn( doc, saveWrap );
+        PCondFlushLine( doc, indent );
     }
 
-    if ( node->content && pprint->indent[ 0 ].spaces != (int)indent )
+    if ( FirstPrinted(doc, node) && pprint->indent[ 0 ].spaces != (int)indent )
     {
         pprint->indent[ 0 ].spaces = indent;
     }
     PPrintEndTag( doc, mode, indent, node );
     if ( cfgAutoBool(doc, TidyIndentContent) == TidyNoState
-         && node->next != NULL &&
+         && NextPrinted(doc, node) != NULL &&
          !( TY_(nodeHasCM)(node, CM_INLINE) || TY_(nodeIsText)(node) ) )
         TY_(PFlushLine)( doc, indent );
 }
@@ -1896,9 +2423,9 @@ static Bool ShouldIndent( TidyDocImpl* doc, Node *node )
 
     if ( indentContent == TidyAutoState )
     {
-        if ( node->content && TY_(nodeHasCM)(node, CM_NO_INDENT) )
+        if ( FirstPrinted(doc, node) && TY_(nodeHasCM)(node, CM_NO_INDENT) )
         {
-            for ( node = node->content; node; node = node->next )
+            for ( node = FirstPrinted(doc, node); node; node = NextPrinted(doc, node) )
                 if ( TY_(nodeHasCM)(node, CM_BLOCK) )
                     return yes;
             return no;
@@ -1923,9 +2450,368 @@ static Bool ShouldIndent( TidyDocImpl* doc, Node *node )
     if ( nodeIsMAP(node) )
         return yes;
 
-    return ( !TY_(nodeHasCM)( node, CM_INLINE ) && node->content );
+    return ( !TY_(nodeHasCM)( node, CM_INLINE ) && FirstPrinted(doc, node) );
+}
+
+/* Prints the siblings from content up to, not including, stop.
+** If naked, a block after text starts on a new line.
+*/
+static void PPrintContent( TidyDocImpl* doc, uint mode, uint indent,
+                           Node* content, Node* stop, Bool naked )
+{
+    Node* last = ( content ? PrevPrinted(doc, content) : NULL );
+
+    for ( ; content != stop; content = NextPrinted(doc, content) )
+    {
+        /* kludge for naked text before block level tag */
+        if ( naked && last && IsPrintedText(doc, last) &&
+             content->tag && !TY_(nodeHasCM)(content, CM_INLINE) )
+        {
+            TY_(PFlushLine)( doc, indent );
+        }
+
+        TY_(PPrintTree)( doc, mode, indent, content );
+        last = content;
+    }
+}
+
+/* The state of the line being printed */
+typedef struct _PrintLineState
+{
+    uint linelen;
+    uint linecols;
+    uint wraphere;
+    uint wrapcols;
+    uint ixInd;
+    TidyIndent indent[2];
+} PrintLineState;
+
+static void GetLineState( TidyPrintImpl* pprint, PrintLineState* st )
+{
+    st->linelen  = pprint->linelen;
+    st->linecols = pprint->linecols;
+    st->wraphere = pprint->wraphere;
+    st->wrapcols = pprint->wrapcols;
+    st->ixInd    = pprint->ixInd;
+    st->indent[0] = pprint->indent[0];
+    st->indent[1] = pprint->indent[1];
+}
+
+static void SetLineState( TidyPrintImpl* pprint, PrintLineState* st,
+                          ctmbstr line )
+{
+    if ( st->linelen >= pprint->lbufsize )
+        expand( pprint, st->linelen );
+    if ( st->linelen > 0 )
+        memcpy( pprint->linebuf, line, st->linelen );
+    pprint->linelen  = st->linelen;
+    pprint->linecols = st->linecols;
+    pprint->wraphere = st->wraphere;
+    pprint->wrapcols = st->wrapcols;
+    pprint->ixInd    = st->ixInd;
+    pprint->indent[0] = st->indent[0];
+    pprint->indent[1] = st->indent[1];
+}
+
+static Bool SameLineState( PrintLineState* a, PrintLineState* b )
+{
+    return ( a->linelen == b->linelen && a->linecols == b->linecols &&
+             a->wraphere == b->wraphere && a->wrapcols == b->wrapcols &&
+             a->ixInd == b->ixInd &&
+             memcmp(a->indent, b->indent, sizeof(a->indent)) == 0 );
 }
 
+#if SUPPORT_PARALLEL_PRINT
+
+/* Printing the content of the body on several threads.
+**
+** A block element in the body starts with PCondFlushLine() at
+** the body's content indent, after which the state of the printer
+** normally depends on nothing printed before.  So the children of
+** the body are split into runs at such blocks, and runs are printed
+** by workers, each into a buffer, with a copy of the document that
+** has its own printer and option flags (WrapOff() changes them).
+** A run starts in the state the flush leaves, and ends with the
+** flush of the block after it.  The calling thread prints the first
+** run straight to the output and then helps the workers.
+**
+** Where a run does not end in the state the next run was started
+** in, the buffers from there on are dropped and the rest is printed
+** on the calling thread, so the output is always that of printing
+** serially.  Tree, lexer and allocator are shared and must not be
+** changed meanwhile.
+*/
+
+#define RUNS_PER_THREAD  4u
+#define MAX_PRINT_THREADS 64u
+
+typedef struct _PrintRun
+{
+    Node*       first;     /* first child of the run */
+    Node*       next;      /* first child after the run, NULL: last run */
+    TidyBuffer  out;
+    PrintLineState end;    /* state after the run */
+    tmbstr      line;      /* unflushed end of the last run */
+} PrintRun;
+
+typedef struct _PrintPool
+{
+    uint        mode;
+    uint        indent;
+    Bool        naked;
+    int         encoding;
+    uint        nl;
+    PrintLineState start;  /* state every run but the first starts in */
+
+    PrintRun*   runs;
+    uint        nruns;
+    uint        nextRun;   /* next run for a worker, under lock */
+    pthread_mutex_t lock;
+} PrintPool;
+
+typedef struct _PrintWorker
+{
+    PrintPool*   pool;
+    TidyDocImpl* doc;      /* copy with its own printer and config */
+} PrintWorker;
+
+/* Block elements, other than pre, textarea, script and style,
+** start by flushing the line at the given indent.
+*/
+static Bool IsRunStart( TidyDocImpl* doc, Node* node, Bool naked )
+{
+    if ( node->type != StartTag || node->tag == NULL ||
+         TY_(nodeCMIsEmpty)(node) || TY_(nodeCMIsInline)(node) ||
+         node->tag->parser == TY_(ParsePre) || nodeIsTEXTAREA(node) ||
+         nodeIsSTYLE(node) || nodeIsSCRIPT(node) )
+        return no;
+
+    /* a block after text is preceded by a flush of its own */
+    return !( naked && IsPrintedText(doc, PrevPrinted(doc, node)) );
+}
+
+/* Rough cost of printing node and its content */
+static ulong PrintWeight( Node* node )
+{
+    Node* n = node;
+    ulong weight = 0;
+
+    for (;;)
+    {
+        weight += 16;
+        if ( n->type == TextNode && n->end > n->start )
+            weight += n->end - n->start;
+
+        if ( n->content )
+            n = n->content;
+        else
+        {
+            while ( n != node && n->next == NULL )
+                n = n->parent;
+            if ( n == node )
+                break;
+            n = n->next;
+        }
+    }
+    return weight;
+}
+
+/* Splits the children from first on into at most maxRuns runs of
+** about the same weight.  Returns the number of runs.
+*/
+static uint SplitRuns( TidyDocImpl* doc, Node* first, Bool naked,
+                       PrintRun* runs, uint maxRuns )
+{
+    Node* node;
+    ulong total = 0, sum = 0;
+    uint nruns = 0;
+
+    for ( node = first; node; node = NextPrinted(doc, node) )
+        total += PrintWeight( node );
+
+    runs[ nruns++ ].first = first;
+    for ( node = first; node; node = NextPrinted(doc, node) )
+    {
+        if ( node != first && nruns < maxRuns &&
+             sum >= total / maxRuns * nruns && IsRunStart(doc, node, naked) )
+        {
+            runs[ nruns - 1 ].next = node;
+            runs[ nruns++ ].first = node;
+        }
+        sum += PrintWeight( node );
+    }
+    runs[ nruns - 1 ].next = NULL;
+    return nruns;
+}
+
+static PrintRun* NextRun( PrintPool* pool )
+{
+    PrintRun* run = NULL;
+
+    pthread_mutex_lock( &pool->lock );
+    if ( pool->nextRun < pool->nruns )
+        run = &pool->runs[ pool->nextRun++ ];
+    pthread_mutex_unlock( &pool->lock );
+    return run;
+}
+
+static void* PrintRuns( void* arg )
+{
+    PrintWorker* worker = (PrintWorker*) arg;
+    PrintPool* pool = worker->pool;
+    TidyDocImpl* doc = worker->doc;
+    TidyPrintImpl* pprint = &doc->pprint;
+    PrintRun* run;
+
+    while ( NULL != (run = NextRun(pool)) )
+    {
+        StreamOut* out = TY_(BufferOutput)( &run->out, pool->encoding, pool->nl );
+
+        doc->docOut = out;
+        SetLineState( pprint, &pool->start, NULL );
+        PPrintContent( doc, pool->mode, pool->indent,
+                       run->first, run->next, pool->naked );
+        if ( run->next )
+            PCondFlushLine( doc, pool->indent );
+
+        GetLineState( pprint, &run->end );
+        if ( pprint->linelen > 0 )
+        {
+            run->line = (tmbstr) MemAlloc( pprint->linelen );
+            memcpy( run->line, pprint->linebuf, pprint->linelen );
+        }
+        doc->docOut = NULL;
+        MemFree( out );
+    }
+    return NULL;
+}
+
+static TidyDocImpl* NewPrintDoc( TidyDocImpl* doc )
+{
+    TidyDocImpl* copy = (TidyDocImpl*) MemAlloc( sizeof(TidyDocImpl) );
+    TidyPrintImpl* pprint = &copy->pprint;
+
+    memcpy( copy, doc, sizeof(TidyDocImpl) );
+    TY_(InitPrintBuf)( copy );
+    pprint->filters  = doc->pprint.filters;
+    pprint->inPre    = doc->pprint.inPre;
+    pprint->minify   = doc->pprint.minify;
+    pprint->widecols = doc->pprint.widecols;
+    pprint->dbcscols = doc->pprint.dbcscols;
+    pprint->entvers  = doc->pprint.entvers;
+    return copy;
+}
+
+/* Prints the children from first on with print-threads threads,
+** as far as that gives the serial output.  Returns the child to
+** go on from on the calling thread, NULL when done.
+*/
+static Node* PPrintParallel( TidyDocImpl* doc, uint mode, uint indent,
+                             Node* first, Bool naked )
+{
+    TidyPrintImpl* pprint = &doc->pprint;
+    uint nthreads = (uint) cfg( doc, TidyPrintThreads );
+    PrintWorker workers[ MAX_PRINT_THREADS ];
+    pthread_t threads[ MAX_PRINT_THREADS ];
+    PrintPool pool;
+    Node* rest = NULL;
+    uint i, nstarted = 0;
+    Bool inorder;
+
+    /* output is only kept on the calling thread */
+    if ( first == NULL || nthreads < 2 || cfgBool(doc, TidyVertSpace) ||
+         doc->docOut->encoding == ISO2022 || pprint->keep )
+        return first;
+    if ( nthreads > MAX_PRINT_THREADS )
+        nthreads = MAX_PRINT_THREADS;
+
+    ClearMemory( &pool, sizeof(pool) );
+    pool.runs = (PrintRun*) MemAlloc( nthreads * RUNS_PER_THREAD * sizeof(PrintRun) );
+    ClearMemory( pool.runs, nthreads * RUNS_PER_THREAD * sizeof(PrintRun) );
+    pool.nruns = SplitRuns( doc, first, naked, pool.runs,
+                            nthreads * RUNS_PER_THREAD );
+    if ( pool.nruns < 2 )
+    {
+        MemFree( pool.runs );
+        return first;
+    }
+
+    pool.mode = mode;
+    pool.indent = indent;
+    pool.naked = naked;
+    pool.encoding = doc->docOut->encoding;
+    pool.nl = doc->docOut->nl;
+    InitIndent( &pool.start.indent[0] );
+    InitIndent( &pool.start.indent[1] );
+    pool.start.indent[0].spaces = indent;
+    pool.nextRun = 1;
+    pthread_mutex_init( &pool.lock, NULL );
+
+    /* Shared tables are set up lazily, do it before there are threads */
+    TY_(EntityName)( 0, 0 );
+
+    /* Copies are taken before the first run changes the config */
+    for ( i = 0; i < nthreads; ++i )
+    {
+        workers[i].pool = &pool;
+        workers[i].doc = NewPrintDoc( doc );
+    }
+    for ( i = 1; i < nthreads && i < pool.nruns; ++i )
+    {
+        if ( pthread_create(&threads[nstarted], NULL, PrintRuns, &workers[i]) == 0 )
+            ++nstarted;
+    }
+
+    PPrintContent( doc, mode, indent, pool.runs[0].first,
+                   pool.runs[0].next, naked );
+    PCondFlushLine( doc, indent );
+    GetLineState( pprint, &pool.runs[0].end );
+    inorder = SameLineState( &pool.runs[0].end, &pool.start );
+
+    if ( inorder )
+        PrintRuns( &workers[0] );
+    else
+    {
+        pthread_mutex_lock( &pool.lock );
+        pool.nextRun = pool.nruns;
+        pthread_mutex_unlock( &pool.lock );
+        rest = pool.runs[0].next;
+    }
+
+    for ( i = 0; i < nstarted; ++i )
+        pthread_join( threads[i], NULL );
+    pthread_mutex_destroy( &pool.lock );
+
+    for ( i = 1; inorder && i < pool.nruns; ++i )
+    {
+        PrintRun* run = &pool.runs[i];
+
+        TY_(WriteBytes)( (ctmbstr) run->out.bp, run->out.size, doc->docOut );
+        if ( run->next == NULL ||
+             !SameLineState(&run->end, &pool.start) )
+        {
+            SetLineState( pprint, &run->end, run->line );
+            rest = run->next;
+            inorder = no;
+        }
+    }
+
+    for ( i = 0; i < pool.nruns; ++i )
+    {
+        tidyBufFree( &pool.runs[i].out );
+        MemFree( pool.runs[i].line );
+    }
+    for ( i = 0; i < nthreads; ++i )
+    {
+        TY_(FreePrintBuf)( workers[i].doc );
+        MemFree( workers[i].doc );
+    }
+    MemFree( pool.runs );
+    return rest;
+}
+
+#endif /* SUPPORT_PARALLEL_PRINT */
+
 /*
  Feature request #434940 - fix by Dave Raggett/Ignacio Vazquez-Abrams 21 Jun 01
  print just the content of the body element.
@@ -1940,21 +2826,331 @@ void TY_(PrintBody)( TidyDocImpl* doc )
 
     if ( node )
     {
-        for ( node = node->content; node != NULL; node = node->next )
-            TY_(PPrintTree)( doc, NORMAL, 0, node );
+        node = FirstPrinted( doc, node );
+#if SUPPORT_PARALLEL_PRINT
+        node = PPrintParallel( doc, NORMAL, 0, node, no );
+#endif
+        PPrintContent( doc, NORMAL, 0, node, NULL, no );
     }
 }
 
-void TY_(PPrintTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
+/* Elements are printed in three steps: the start, the content
+** child by child, and the end.  Elements whose content is being
+** printed are kept on a stack of frames in the printer rather
+** than on the C stack, so printing deep trees needs no more C
+** stack than printing flat ones.
+*/
+#define FRAME_CONTENT  0u   /* content only: root, clean <nobr> */
+#define FRAME_PRE      1u   /* <pre> like elements, <textarea> */
+#define FRAME_SCRIPT   2u   /* <script>, <style> */
+#define FRAME_INLINE   3u
+#define FRAME_BLOCK    4u   /* other tags */
+#define FRAME_XML      5u   /* XML elements */
+
+static TidyPrintFrame* PushFrame( TidyDocImpl* doc, uint kind, Node* node,
+                                  uint mode, uint indent,
+                                  uint cmode, uint cindent )
+{
+    TidyPrintImpl* pprint = &doc->pprint;
+    TidyPrintFrame* frame;
+
+    if ( pprint->nframes == pprint->framesize )
+    {
+        pprint->framesize = ( pprint->framesize ? 2 * pprint->framesize : 32 );
+        pprint->frames = (TidyPrintFrame*)
+            MemRealloc( pprint->frames, pprint->framesize * sizeof(TidyPrintFrame) );
+    }
+
+    frame = pprint->frames + pprint->nframes++;
+    frame->node = node;
+    frame->content = FirstPrinted( doc, node );
+    frame->last = NULL;
+    frame->kind = kind;
+    frame->mode = mode;
+    frame->indent = indent;
+    frame->cmode = cmode;
+    frame->cindent = cindent;
+    frame->naked = no;
+    frame->mixed = no;
+    frame->head = ( nodeIsHEAD(node) ||
+                    (pprint->nframes > 1 ? frame[-1].head
+                                         : InsideHead(doc, node)) );
+    frame->keep = NULL;
+    return frame;
+}
+
+/* Kept output.
+**
+** With print-cache, block and <pre> like elements, and elements in
+** XML output, keep a copy of what they print: the bytes written from
+** after the flush that starts the element up to its end, and the
+** state of the line at both ends.  When the element is printed again with
+** the same options, indent and mode, from the same line state, and
+** has not changed since, the bytes are written and the line state
+** restored instead of printing it.
+**
+** Kept output of an element that is part of its parent's is not
+** copied there, the parent's has a splice to it instead, so each
+** byte is kept once.  Every node printed while output is kept is
+** marked, and a change to a marked node drops the kept output of
+** the node and its ancestors.
+*/
+struct _TidyPrintKept
+{
+    uint gen;               /* kept with options of this generation */
+    uint kind;              /* and printed like this */
+    uint mode;
+    uint indent;
+    uint cindent;
+    uint inPre;
+    uint wraplen;
+    Bool head;
+    Bool preserve;          /* XML white space preserved */
+    PrintLineState start;
+
+    tmbstr bytes;           /* output, less that of the splices */
+    uint size;
+    TidyPrintSplice* splices;
+    uint nsplices;
+    PrintLineState end;
+    tmbstr line;            /* unflushed end of the output */
+};
+
+void TY_(FreePrintCache)( Node* node )
+{
+    if ( node->printcache )
+    {
+        MemFree( node->printcache );
+        node->printcache = NULL;
+    }
+}
+
+/* A <font> printed as its content is not marked itself */
+void TY_(PrintCacheChanged)( Node* node )
+{
+    while ( node && (node->printkept || nodeIsFONT(node)) )
+    {
+        TY_(FreePrintCache)( node );
+        node->printkept = no;
+        node = node->parent;
+    }
+}
+
+void TY_(DropPrintCache)( TidyDocImpl* doc )
+{
+    ++doc->pprint.keepgen;
+}
+
+static Bool SameKept( TidyPrintKept* a, TidyPrintKept* b )
+{
+    return ( a->gen == b->gen && a->kind == b->kind &&
+             a->mode == b->mode && a->indent == b->indent &&
+             a->cindent == b->cindent && a->inPre == b->inPre &&
+             a->wraplen == b->wraplen && a->head == b->head &&
+             a->preserve == b->preserve &&
+             SameLineState(&a->start, &b->start) );
+}
+
+static void AddSplice( TidyPrintImpl* pprint, Node* node, uint offset )
+{
+    if ( pprint->nsplices == pprint->splicesize )
+    {
+        pprint->splicesize = ( pprint->splicesize ? 2 * pprint->splicesize : 32 );
+        pprint->splices = (TidyPrintSplice*)
+            MemRealloc( pprint->splices, pprint->splicesize * sizeof(TidyPrintSplice) );
+    }
+    pprint->splices[ pprint->nsplices ].node = node;
+    pprint->splices[ pprint->nsplices ].offset = offset;
+    ++pprint->nsplices;
+}
+
+static uint PushReplay( TidyPrintImpl* pprint, uint n, TidyPrintKept* kept )
+{
+    if ( n == pprint->replaysize )
+    {
+        pprint->replaysize = ( pprint->replaysize ? 2 * pprint->replaysize : 32 );
+        pprint->replay = (TidyPrintReplay*)
+            MemRealloc( pprint->replay, pprint->replaysize * sizeof(TidyPrintReplay) );
+    }
+    pprint->replay[ n ].kept = kept;
+    pprint->replay[ n ].splice = 0;
+    pprint->replay[ n ].offset = 0;
+    return n + 1;
+}
+
+/* Writes the kept output of node, and that of its splices */
+static void WriteKept( TidyDocImpl* doc, Node* node )
+{
+    TidyPrintImpl* pprint = &doc->pprint;
+    StreamOut* out = doc->docOut;
+    TidyBuffer* copy = out->copy;
+    uint n;
+
+    if ( pprint->keeping > 0 )
+        AddSplice( pprint, node, pprint->kept.size );
+    out->copy = NULL;
+
+    n = PushReplay( pprint, 0, node->printcache );
+    while ( n > 0 )
+    {
+        TidyPrintReplay* top = pprint->replay + n - 1;
+        TidyPrintKept* kept = top->kept;
+        uint end = kept->size;
+        Node* next = NULL;
+
+        if ( top->splice < kept->nsplices )
+        {
+            end = kept->splices[ top->splice ].offset;
+            next = kept->splices[ top->splice ].node;
+            ++top->splice;
+        }
+        TY_(WriteBytes)( kept->bytes + top->offset, end - top->offset, out );
+        top->offset = end;
+
+        if ( next )
+            n = PushReplay( pprint, n, next->printcache );
+        else
+            --n;
+    }
+    out->copy = copy;
+}
+
+/* The element of frame, the innermost, is about to be printed.
+** If its kept output can be used, writes it, pops the frame and
+** returns yes.  Otherwise starts keeping its output.
+*/
+static Bool PPrintKept( TidyDocImpl* doc, TidyPrintFrame* frame,
+                        Bool preserve )
+{
+    TidyPrintImpl* pprint = &doc->pprint;
+    Node* node = frame->node;
+    TidyPrintKept* kept = node->printcache;
+    TidyPrintKept key;
+
+    if ( !pprint->keep )
+        return no;
+
+    ClearMemory( &key, sizeof(key) );
+    key.gen = pprint->keepgen;
+    key.kind = frame->kind;
+    key.mode = frame->mode;
+    key.indent = frame->indent;
+    key.cindent = frame->cindent;
+    key.inPre = pprint->inPre;
+    key.wraplen = doc->optflags.wraplen;
+    key.head = frame->head;
+    key.preserve = preserve;
+    GetLineState( pprint, &key.start );
+
+    if ( kept && kept->gen == key.gen )
+    {
+        if ( !SameKept(kept, &key) )
+            return no;  /* printed elsewhere, maybe kept in a parent's */
+
+        --pprint->nframes;
+        WriteKept( doc, node );
+        SetLineState( pprint, &kept->end, kept->line );
+        return yes;
+    }
+
+    kept = (TidyPrintKept*) MemAlloc( sizeof(TidyPrintKept) );
+    *kept = key;
+    node->printkept = yes;
+    frame->keep = kept;
+    frame->keepstart = pprint->kept.size;
+    frame->splicestart = pprint->nsplices;
+    if ( pprint->keeping++ == 0 )
+        doc->docOut->copy = &pprint->kept;
+    return no;
+}
+
+/* The element of frame has been printed, keep its output */
+static void KeepOutput( TidyDocImpl* doc, TidyPrintFrame* frame )
+{
+    TidyPrintImpl* pprint = &doc->pprint;
+    TidyPrintKept* kept = frame->keep;
+    Node* node = frame->node;
+    uint size, nsplices, i;
+    PrintLineState end;
+
+    if ( kept == NULL )
+        return;
+
+    size = pprint->kept.size - frame->keepstart;
+    nsplices = pprint->nsplices - frame->splicestart;
+    GetLineState( pprint, &end );
+
+    kept = (TidyPrintKept*) MemRealloc( kept, sizeof(TidyPrintKept) +
+                                         nsplices * sizeof(TidyPrintSplice) +
+                                         size + end.linelen );
+    kept->splices = (TidyPrintSplice*)( kept + 1 );
+    kept->nsplices = nsplices;
+    kept->bytes = (tmbstr)( kept->splices + nsplices );
+    kept->size = size;
+    kept->line = kept->bytes + size;
+    kept->end = end;
+
+    for ( i = 0; i < nsplices; ++i )
+    {
+        kept->splices[i] = pprint->splices[ frame->splicestart + i ];
+        kept->splices[i].offset -= frame->keepstart;
+    }
+    if ( size > 0 )
+        memcpy( kept->bytes, pprint->kept.bp + frame->keepstart, size );
+    if ( end.linelen > 0 )
+        memcpy( kept->line, pprint->linebuf, end.linelen );
+
+    TY_(FreePrintCache)( node );
+    node->printcache = kept;
+
+    pprint->kept.size = frame->keepstart;
+    pprint->nsplices = frame->splicestart;
+    if ( --pprint->keeping > 0 )
+        AddSplice( pprint, node, pprint->kept.size );
+    else
+        doc->docOut->copy = NULL;
+}
+
+/* After a block or <pre> like element: the line breaks that depend
+** on what follows, and are not part of its kept output.
+*/
+static void PPrintBlockTail( TidyDocImpl* doc, uint kind, uint indent,
+                             Node* node )
+{
+    Bool indcont  = ( cfgAutoBool(doc, TidyIndentContent) != TidyNoState );
+    Bool hideend  = cfgBool( doc, TidyHideEndTags );
+    Bool classic  = cfgBool( doc, TidyVertSpace );
+
+    if ( kind == FRAME_PRE )
+    {
+        if ( !indcont && NextPrinted(doc, node) != NULL )
+            TY_(PFlushLine)( doc, indent );
+    }
+    else if (!indcont && !hideend && !nodeIsHTML(node) && !classic)
+        TY_(PFlushLine)( doc, indent );
+    else if (classic && NextPrinted(doc, node) != NULL && TY_(nodeHasCM)(node, CM_LIST|CM_DEFLIST|CM_TABLE|CM_BLOCK/*|CM_HEADING*/))
+        TY_(PFlushLine)( doc, indent );
+}
+
+/* Prints node, or if it has content, the start of it and a frame
+** for the rest.
+*/
+static void PPrintNode( TidyDocImpl* doc, uint mode, uint indent, Node *node )
 {
-    Node *content, *last;
+    Node *prev;
+    TidyPrintFrame* frame;
     uint spaces = (uint)cfg( doc, TidyIndentSpaces );
     Bool xhtml = cfgBool( doc, TidyXhtmlOut );
 
-    if ( node == NULL )
-        return;
+    if ( doc->pprint.keeping > 0 )
+        node->printkept = yes;
 
-    if (node->type == TextNode)
+    if ( IsSpaceNode(doc, node) )
+    {
+        CheckWrapIndent( doc, indent );
+        PPrintChar( doc, ' ', mode );
+    }
+    else if ( IsPrintedText(doc, node) )
     {
         PPrintText( doc, mode, indent, node );
     }
@@ -1964,8 +3160,7 @@ void TY_(PPrintTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
     }
     else if ( node->type == RootNode )
     {
-        for ( content = node->content; content; content = content->next )
-           TY_(PPrintTree)( doc, mode, indent, content );
+        PushFrame( doc, FRAME_CONTENT, node, mode, indent, mode, indent );
     }
     else if ( node->type == DocTypeTag )
         PPrintDocType( doc, indent, node );
@@ -1989,8 +3184,9 @@ void TY_(PPrintTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
         if ( ! TY_(nodeHasCM)(node, CM_INLINE) )
             PCondFlushLine( doc, indent );
 
-        if ( nodeIsBR(node) && node->prev &&
-             !(nodeIsBR(node->prev) || (mode & PREFORMATTED)) &&
+        prev = PrevPrinted( doc, node );
+        if ( nodeIsBR(node) && prev &&
+             !(nodeIsBR(prev) || (mode & PREFORMATTED)) &&
              cfgBool(doc, TidyBreakBeforeBR) )
             TY_(PFlushLine)( doc, indent );
 
@@ -1998,7 +3194,7 @@ void TY_(PPrintTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
         {
             /* insert extra newline for classic formatting */
             Bool classic = cfgBool( doc, TidyVertSpace );
-            if (classic && node->parent && node->parent->content != node)
+            if (classic && node->parent && prev)
             {
                 TY_(PFlushLine)( doc, indent );
             }
@@ -2006,7 +3202,7 @@ void TY_(PPrintTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
 
         PPrintTag( doc, mode, indent, node );
 
-        if (node->next)
+        if ( NextPrinted(doc, node) )
         {
           if (nodeIsPARAM(node) || nodeIsAREA(node))
               PCondFlushLine(doc, indent);
@@ -2017,45 +3213,48 @@ void TY_(PPrintTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
     }
     else /* some kind of container element */
     {
-        if ( node->type == StartEndTag )
-            node->type = StartTag;
-
         if ( node->tag && 
              (node->tag->parser == TY_(ParsePre) || nodeIsTEXTAREA(node)) )
         {
             Bool classic  = cfgBool( doc, TidyVertSpace );
-            uint indprev = indent;
+            Bool isPre    = ( node->tag->parser == TY_(ParsePre) );
             PCondFlushLine( doc, indent );
 
             PCondFlushLine( doc, indent );
 
             /* insert extra newline for classic formatting */
-            if (classic && node->parent && node->parent->content != node)
+            if (classic && node->parent && PrevPrinted(doc, node))
             {
                 TY_(PFlushLine)( doc, indent );
             }
-            PPrintTag( doc, mode, indent, node );
-
-            indent = 0;
-            TY_(PFlushLine)( doc, indent );
 
-            for ( content = node->content; content; content = content->next )
+            frame = PushFrame( doc, FRAME_PRE, node, mode, indent,
+                               (mode | PREFORMATTED | NOWRAP), 0 );
+            if ( PPrintKept(doc, frame, no) )
             {
-                TY_(PPrintTree)( doc, (mode | PREFORMATTED | NOWRAP),
-                                 indent, content );
+                PPrintBlockTail( doc, FRAME_PRE, indent, node );
+                return;
             }
-            PCondFlushLine( doc, indent );
-            indent = indprev;
-            PPrintEndTag( doc, mode, indent, node );
 
-            if ( cfgAutoBool(doc, TidyIndentContent) == TidyNoState
-                 && node->next != NULL )
-                TY_(PFlushLine)( doc, indent );
+            PPrintTag( doc, mode, indent, node );
+
+            PFlushContentLine( doc, 0 );
+
+            /* non-breaking spaces are printed as spaces in <pre> */
+            if ( isPre )
+                ++doc->pprint.inPre;
         }
         else if ( nodeIsSTYLE(node) || nodeIsSCRIPT(node) )
         {
-            PPrintScriptStyle( doc, (mode | PREFORMATTED | NOWRAP | CDATA),
-                               indent, node );
+            mode |= PREFORMATTED | NOWRAP | CDATA;
+            PPrintScriptStart( doc, mode, indent, node );
+
+            /*
+              This is a bit odd, with the current code there can only
+              be one child and the only caller of this function defines
+              all these modes already...
+            */
+            PushFrame( doc, FRAME_SCRIPT, node, mode, indent, mode, indent );
         }
         else if ( TY_(nodeCMIsInline)(node) )
         {
@@ -2064,10 +3263,8 @@ void TY_(PPrintTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
                 /* replace <nobr>...</nobr> by &nbsp; or &#160; etc. */
                 if ( nodeIsNOBR(node) )
                 {
-                    for ( content = node->content;
-                          content != NULL;
-                          content = content->next)
-                        TY_(PPrintTree)( doc, mode|NOWRAP, indent, content );
+                    PushFrame( doc, FRAME_CONTENT, node, mode, indent,
+                               mode|NOWRAP, indent );
                     return;
                 }
             }
@@ -2078,26 +3275,12 @@ void TY_(PPrintTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
             /* indent content for SELECT, TEXTAREA, MAP, OBJECT and APPLET */
             if ( ShouldIndent(doc, node) )
             {
-                indent += spaces;
-                PCondFlushLine( doc, indent );
-
-                for ( content = node->content;
-                      content != NULL;
-                      content = content->next )
-                    TY_(PPrintTree)( doc, mode, indent, content );
-
-                indent -= spaces;
-                PCondFlushLine( doc, indent );
-                /* PCondFlushLine( doc, indent ); */
+                PCondFlushLine( doc, indent + spaces );
+                PushFrame( doc, FRAME_INLINE, node, mode, indent,
+                           mode, indent + spaces );
             }
             else
-            {
-                for ( content = node->content;
-                      content != NULL;
-                      content = content->next )
-                    TY_(PPrintTree)( doc, mode, indent, content );
-            }
-            PPrintEndTag( doc, mode, indent, node );
+                PushFrame( doc, FRAME_INLINE, node, mode, indent, mode, indent );
         }
         else /* other tags */
         {
@@ -2108,7 +3291,7 @@ void TY_(PPrintTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
             uint contentIndent = indent;
 
             /* insert extra newline for classic formatting */
-            if (classic && node->parent && node->parent->content != node && !nodeIsHTML(node))
+            if (classic && node->parent && PrevPrinted(doc, node) && !nodeIsHTML(node))
             {
                 TY_(PFlushLine)( doc, indent );
             }
@@ -2117,9 +3300,18 @@ void TY_(PPrintTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
                 contentIndent += spaces;
 
             PCondFlushLine( doc, indent );
-            if ( indsmart && node->prev != NULL )
+            if ( indsmart && PrevPrinted(doc, node) != NULL )
                 TY_(PFlushLine)( doc, indent );
 
+            frame = PushFrame( doc, FRAME_BLOCK, node, mode, indent,
+                               mode, contentIndent );
+            frame->naked = !indcont;
+            if ( PPrintKept(doc, frame, no) )
+            {
+                PPrintBlockTail( doc, FRAME_BLOCK, indent, node );
+                return;
+            }
+
             /* do not omit elements with attributes */
             if ( !hideend || !TY_(nodeHasCM)(node, CM_OMITST) ||
                  node->attributes != NULL )
@@ -2130,7 +3322,7 @@ void TY_(PPrintTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
                 {
                     /* fix for bug 530791, don't wrap after */
                     /* <li> if first child is text node     */
-                    if (!(nodeIsLI(node) && TY_(nodeIsText)(node->content)))
+                    if (!(nodeIsLI(node) && IsPrintedText(doc, FirstPrinted(doc, node))))
                         PCondFlushLine( doc, contentIndent );
                 }
                 else if ( TY_(nodeHasCM)(node, CM_HTML) || nodeIsNOFRAMES(node) ||
@@ -2138,64 +3330,102 @@ void TY_(PPrintTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
                     TY_(PFlushLine)( doc, contentIndent );
             }
 
-            last = NULL;
-            for ( content = node->content; content; content = content->next )
+#if SUPPORT_PARALLEL_PRINT
+            if ( nodeIsBODY(node) )
             {
-                /* kludge for naked text before block level tag */
-                if ( last && !indcont && TY_(nodeIsText)(last) &&
-                     content->tag && !TY_(nodeHasCM)(content, CM_INLINE) )
-                {
-                    /* TY_(PFlushLine)(fout, indent); */
-                    TY_(PFlushLine)( doc, contentIndent );
-                }
-
-                TY_(PPrintTree)( doc, mode, contentIndent, content );
-                last = content;
+                Node* content = PPrintParallel( doc, mode, contentIndent,
+                                                FirstPrinted(doc, node),
+                                                !indcont );
+                frame = doc->pprint.frames + doc->pprint.nframes - 1;
+                frame->content = content;
+                frame->last = ( content ? PrevPrinted(doc, content) : NULL );
             }
+#endif
+        }
+    }
+}
+
+/* Prints the end of an element, after its content */
+static void PPrintNodeEnd( TidyDocImpl* doc, TidyPrintFrame* frame )
+{
+    Node* node = frame->node;
+    uint mode = frame->mode;
+    uint indent = frame->indent;
+
+    if ( frame->kind == FRAME_PRE )
+    {
+        if ( node->tag->parser == TY_(ParsePre) )
+            --doc->pprint.inPre;
+        PCondFlushLine( doc, 0 );
+        PPrintEndTag( doc, mode, indent, node );
 
-            /* don't flush line for td and th */
-            if ( ShouldIndent(doc, node) ||
-                 ( !hideend &&
-                   ( TY_(nodeHasCM)(node, CM_HTML) || 
-                     nodeIsNOFRAMES(node) ||
-                     (TY_(nodeHasCM)(node, CM_HEAD) && !nodeIsTITLE(node))
-                   )
-                 )
+        KeepOutput( doc, frame );
+        PPrintBlockTail( doc, FRAME_PRE, indent, node );
+    }
+    else if ( frame->kind == FRAME_SCRIPT )
+    {
+        PPrintScriptEnd( doc, mode, indent, node, frame->last );
+    }
+    else if ( frame->kind == FRAME_INLINE )
+    {
+        if ( ShouldIndent(doc, node) )
+        {
+            PCondFlushLine( doc, indent );
+            /* PCondFlushLine( doc, indent ); */
+        }
+        PPrintEndTag( doc, mode, indent, node );
+    }
+    else if ( frame->kind == FRAME_BLOCK )
+    {
+        Bool hideend  = cfgBool( doc, TidyHideEndTags );
+        Bool classic  = cfgBool( doc, TidyVertSpace );
+
+        /* don't flush line for td and th */
+        if ( ShouldIndent(doc, node) ||
+             ( !hideend &&
+               ( TY_(nodeHasCM)(node, CM_HTML) || 
+                 nodeIsNOFRAMES(node) ||
+                 (TY_(nodeHasCM)(node, CM_HEAD) && !nodeIsTITLE(node))
                )
+             )
+           )
+        {
+            PCondFlushLine( doc, indent );
+            if ( !hideend || !TY_(nodeHasCM)(node, CM_OPT) )
             {
-                PCondFlushLine( doc, indent );
-                if ( !hideend || !TY_(nodeHasCM)(node, CM_OPT) )
-                {
-                    PPrintEndTag( doc, mode, indent, node );
-                    /* TY_(PFlushLine)( doc, indent ); */
-                }
+                PPrintEndTag( doc, mode, indent, node );
+                /* TY_(PFlushLine)( doc, indent ); */
             }
-            else
+        }
+        else
+        {
+            if ( !hideend || !TY_(nodeHasCM)(node, CM_OPT) )
             {
-                if ( !hideend || !TY_(nodeHasCM)(node, CM_OPT) )
-                {
-                    /* newline before endtag for classic formatting */
-                    if ( classic && !HasMixedContent(node) )
-                        TY_(PFlushLine)( doc, indent );
-                    PPrintEndTag( doc, mode, indent, node );
-                }
+                /* newline before endtag for classic formatting */
+                if ( classic && !HasMixedContent(doc, node) )
+                    TY_(PFlushLine)( doc, indent );
+                PPrintEndTag( doc, mode, indent, node );
             }
-
-            if (!indcont && !hideend && !nodeIsHTML(node) && !classic)
-                TY_(PFlushLine)( doc, indent );
-            else if (classic && node->next != NULL && TY_(nodeHasCM)(node, CM_LIST|CM_DEFLIST|CM_TABLE|CM_BLOCK/*|CM_HEADING*/))
-                TY_(PFlushLine)( doc, indent );
         }
+
+        KeepOutput( doc, frame );
+        PPrintBlockTail( doc, FRAME_BLOCK, indent, node );
     }
 }
 
-void TY_(PPrintXMLTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
+static void PPrintXMLNode( TidyDocImpl* doc, uint mode, uint indent, Node *node )
 {
     Bool xhtmlOut = cfgBool( doc, TidyXhtmlOut );
-    if (node == NULL)
-        return;
 
-    if ( node->type == TextNode)
+    if ( doc->pprint.keeping > 0 )
+        node->printkept = yes;
+
+    if ( IsSpaceNode(doc, node) )
+    {
+        CheckWrapIndent( doc, indent );
+        PPrintChar( doc, ' ', mode );
+    }
+    else if ( IsPrintedText(doc, node) )
     {
         PPrintText( doc, mode, indent, node );
     }
@@ -2207,11 +3437,7 @@ void TY_(PPrintXMLTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
     }
     else if ( node->type == RootNode )
     {
-        Node *content;
-        for ( content = node->content;
-              content != NULL;
-              content = content->next )
-           TY_(PPrintXMLTree)( doc, mode, indent, content );
+        PushFrame( doc, FRAME_CONTENT, node, mode, indent, mode, indent );
     }
     else if ( node->type == DocTypeTag )
         PPrintDocType( doc, indent, node );
@@ -2241,11 +3467,15 @@ void TY_(PPrintXMLTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
         uint spaces = (uint)cfg( doc, TidyIndentSpaces );
         Node *content;
         Bool mixed = no;
+        Bool isPre = ( node->tag && node->tag->parser == TY_(ParsePre) );
+        Bool preserve = TY_(XMLPreserveWhiteSpace)( doc, node );
+        TidyPrintFrame* frame;
         uint cindent;
 
-        for ( content = node->content; content; content = content->next )
+        for ( content = FirstPrinted(doc, node); content;
+              content = NextPrinted(doc, content) )
         {
-            if ( TY_(nodeIsText)(content) )
+            if ( IsPrintedText(doc, content) )
             {
                 mixed = yes;
                 break;
@@ -2254,7 +3484,7 @@ void TY_(PPrintXMLTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
 
         PCondFlushLine( doc, indent );
 
-        if ( TY_(XMLPreserveWhiteSpace)(doc, node) )
+        if ( preserve )
         {
             indent = 0;
             mixed = no;
@@ -2265,21 +3495,108 @@ void TY_(PPrintXMLTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
         else
             cindent = indent + spaces;
 
+        frame = PushFrame( doc, FRAME_XML, node, mode, indent, mode, cindent );
+        frame->mixed = mixed;
+        if ( PPrintKept(doc, frame, preserve) )
+            return;
+
         PPrintTag( doc, mode, indent, node );
-        if ( !mixed && node->content )
+        if ( !mixed && FirstPrinted(doc, node) )
             TY_(PFlushLine)( doc, cindent );
  
-        for ( content = node->content; content; content = content->next )
-            TY_(PPrintXMLTree)( doc, mode, cindent, content );
+        if ( isPre )
+            ++doc->pprint.inPre;
+    }
+}
 
-        if ( !mixed && node->content )
-            PCondFlushLine( doc, indent );
+static void PPrintXMLNodeEnd( TidyDocImpl* doc, TidyPrintFrame* frame )
+{
+    Node* node = frame->node;
 
-        PPrintEndTag( doc, mode, indent, node );
+    if ( frame->kind == FRAME_XML )
+    {
+        if ( node->tag && node->tag->parser == TY_(ParsePre) )
+            --doc->pprint.inPre;
+
+        if ( !frame->mixed && FirstPrinted(doc, node) )
+            PCondFlushLine( doc, frame->indent );
+
+        PPrintEndTag( doc, frame->mode, frame->indent, node );
         /* PCondFlushLine( doc, indent ); */
+        KeepOutput( doc, frame );
+    }
+}
+
+/* Prints the content of the elements on the frame stack above base,
+** and the end of each element after its content.
+*/
+static void PPrintFrames( TidyDocImpl* doc, uint base, Bool xml )
+{
+    TidyPrintImpl* pprint = &doc->pprint;
+
+    while ( pprint->nframes > base )
+    {
+        TidyPrintFrame* frame = pprint->frames + pprint->nframes - 1;
+        Node* content = frame->content;
+
+        if ( content != NULL )
+        {
+            uint mode = frame->cmode;
+            uint indent = frame->cindent;
+
+            /* kludge for naked text before block level tag */
+            if ( frame->naked && frame->last &&
+                 IsPrintedText(doc, frame->last) &&
+                 content->tag && !TY_(nodeHasCM)(content, CM_INLINE) )
+            {
+                /* TY_(PFlushLine)(fout, indent); */
+                TY_(PFlushLine)( doc, indent );
+            }
+
+            frame->content = NextPrinted( doc, content );
+            frame->last = content;
+
+            /* may push a frame, frame is not valid after this */
+            if ( xml )
+                PPrintXMLNode( doc, mode, indent, content );
+            else
+                PPrintNode( doc, mode, indent, content );
+        }
+        else
+        {
+            TidyPrintFrame done = *frame;
+
+            --pprint->nframes;
+            if ( xml )
+                PPrintXMLNodeEnd( doc, &done );
+            else
+                PPrintNodeEnd( doc, &done );
+        }
     }
 }
 
+void TY_(PPrintTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
+{
+    uint base = doc->pprint.nframes;
+
+    if ( node == NULL )
+        return;
+
+    PPrintNode( doc, mode, indent, node );
+    PPrintFrames( doc, base, no );
+}
+
+void TY_(PPrintXMLTree)( TidyDocImpl* doc, uint mode, uint indent, Node *node )
+{
+    uint base = doc->pprint.nframes;
+
+    if ( node == NULL )
+        return;
+
+    PPrintXMLNode( doc, mode, indent, node );
+    PPrintFrames( doc, base, yes );
+}
+
 /*
  * local variables:
  * mode: c
@@ -14,6 +14,8 @@
 */
 
 #include "forward.h"
+#include "buffio.h"
+#include "config.h"
 
 /*
   Block-level and unknown elements are printed on
@@ -33,6 +35,16 @@
 #define NOWRAP        8u
 #define CDATA         16u
 
+/* Save-time transforms.  These are applied by the printer
+** instead of rewriting the tree, so saving leaves the document
+** untouched and may be repeated with the same result.
+*/
+#define PF_CDATA_AS_TEXT   1u   /* escape-cdata: CDATA sections as text */
+#define PF_DROP_COMMENTS   2u   /* hide-comments */
+#define PF_DROP_FONT       4u   /* clean: print <font> content only */
+#define PF_WBR_AS_SPACE    8u   /* clean: print <wbr> as a space */
+#define PF_ASCII_QUOTES   16u   /* ascii-chars: downgrade dashes, quotes */
+#define PF_NBSP_AS_SPACE  32u   /* bare: U+00A0 as space in all text */
 
 /* The pretty printer keeps at most two lines of text in the
 ** buffer before flushing output.  We need to capture the
@@ -43,6 +55,7 @@
 ** states at the _end_ of each line, 
 */
 
+/* attrValStart and attrStringStart are byte offsets into linebuf */
 typedef struct _TidyIndent
 {
     int spaces;
@@ -50,30 +63,102 @@ typedef struct _TidyIndent
     int attrStringStart;
 } TidyIndent;
 
+/* An element whose content is being printed */
+typedef struct _TidyPrintFrame
+{
+    Node* node;
+    Node* content;         /* next child to print */
+    Node* last;            /* child printed last */
+    uint  kind;            /* how the element is ended */
+    uint  mode;
+    uint  indent;
+    uint  cmode;           /* mode and indent for the content */
+    uint  cindent;
+    Bool  naked;           /* a block after text starts a new line */
+    Bool  mixed;           /* XML: text among the content */
+    Bool  head;            /* inside <head> */
+
+    TidyPrintKept* keep;   /* print-cache: output being kept, or NULL */
+    uint  keepstart;       /* where it starts in the kept buffer */
+    uint  splicestart;     /* its first splice */
+} TidyPrintFrame;
+
+/* Kept output of an element within that of its parent */
+typedef struct _TidyPrintSplice
+{
+    Node* node;
+    uint  offset;
+} TidyPrintSplice;
+
+/* Writing kept output: next splice and bytes written so far */
+typedef struct _TidyPrintReplay
+{
+    TidyPrintKept* kept;
+    uint  splice;
+    uint  offset;
+} TidyPrintReplay;
+
 typedef struct _TidyPrintImpl
 {
-    uint *linebuf;
+    tmbstr linebuf;        /* current line as UTF-8 */
     uint lbufsize;
-    uint linelen;
-    uint wraphere;
+    uint linelen;          /* bytes in linebuf */
+    uint wraphere;         /* byte offset of the wrap point */
+    uint linecols;         /* display columns of linebuf */
+    uint wrapcols;         /* display columns before wraphere */
     uint linecount;
   
     uint ixInd;
     TidyIndent indent[2];  /* Two lines worth of indent state */
 
-} TidyPrintImpl;
+    uint filters;          /* PF_* flags for the current save */
+    uint inPre;            /* nesting depth of <pre> like elements */
+    Bool minify;           /* no line breaks, indentation or wrapping */
+    Bool widecols;         /* language zh, ja: wide chars take 2 columns */
+    Bool dbcscols;         /* Big5, Shift_JIS output: chars are native codes */
+
+    uint entvers;          /* versions for named entities, 0: numeric only */
+    tmbstr escapes[256];   /* escapes rendered this save, by high byte */
+
+    TidyPrintFrame* frames;  /* elements being printed, innermost last */
+    uint nframes;
+    uint framesize;
+
+    Bool keep;             /* print-cache: keep the output of elements */
+    uint keepgen;          /* kept output of other generations is stale */
+    TidyOptionValue* keepcfg;  /* options of the current generation */
+    uint keepvers;         /* entvers and output of the generation */
+    int  keepenc;
+    uint keepnl;
+
+    uint keeping;          /* frames whose output is being kept */
+    TidyBuffer kept;       /* their output so far, less the splices */
+    TidyPrintSplice* splices;
+    uint nsplices;
+    uint splicesize;
+    TidyPrintReplay* replay;
+    uint replaysize;
 
+} TidyPrintImpl;
 
-#if 0 && SUPPORT_ASIAN_ENCODINGS
-/* #431953 - start RJ Wraplen adjusted for smooth international ride */
-uint CWrapLen( TidyDocImpl* doc, uint ind );
-#endif
 
 void TY_(InitPrintBuf)( TidyDocImpl* doc );
 void TY_(FreePrintBuf)( TidyDocImpl* doc );
 
 void TY_(PFlushLine)( TidyDocImpl* doc, uint indent );
 
+void TY_(InitPrintFilters)( TidyDocImpl* doc );
+
+/* print-cache: output kept from earlier saves is written again as
+** long as the element and its content are unchanged.  The tree
+** functions call PrintCacheChanged() for the element whose content
+** or attributes they change, and DropPrintCache() marks everything
+** kept so far as stale.
+*/
+void TY_(PrintCacheChanged)( Node* node );
+void TY_(FreePrintCache)( Node* node );
+void TY_(DropPrintCache)( TidyDocImpl* doc );
+
 
 /* print just the content of the body element.
 ** useful when you want to reuse material from
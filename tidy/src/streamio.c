@@ -64,7 +64,9 @@ static StreamOut stderrStreamOut =
     (ulong)NULL,
 #endif
     FileIO,
-    { 0, TY_(filesink_putByte) }
+    { 0, TY_(filesink_putByte) },
+    NULL, 0, 0,
+    NULL
 };
 
 static StreamOut stdoutStreamOut = 
@@ -76,13 +78,22 @@ static StreamOut stdoutStreamOut =
     (ulong)NULL,
 #endif
     FileIO,
-    { 0, TY_(filesink_putByte) }
+    { 0, TY_(filesink_putByte) },
+    NULL, 0, 0,
+    NULL
 };
 
+/* stderr is not a constant, so it is filled in on first use */
+static TidyOnce stderrOnce = TIDY_ONCE_INIT;
+
+static void InitStdErrOutput(void)
+{
+  stderrStreamOut.sink.sinkData = stderr;
+}
+
 StreamOut* TY_(StdErrOutput)(void)
 {
-  if ( stderrStreamOut.sink.sinkData == 0 )
-      stderrStreamOut.sink.sinkData = stderr;
+  TidyRunOnce( &stderrOnce, InitStdErrOutput );
   return &stderrStreamOut;
 }
 
@@ -276,7 +287,7 @@ void TY_(AddCharToOriginalText)(StreamIn *in, tchar c)
 uint TY_(ReadChar)( StreamIn *in )
 {
     uint c = EndOfStream;
-    uint tabsize = (uint)cfg( in->doc, TidyTabSize );
+    uint tabsize = in->doc->optflags.tabsize;
 #ifdef TIDY_STORE_ORIGINAL_TEXT
     Bool added = no;
 #endif
@@ -371,7 +382,7 @@ uint TY_(ReadChar)( StreamIn *in )
 #endif
 
         /* Form Feed is allowed in HTML */
-        if ( c == '\015' && !cfgBool(in->doc, TidyXmlTags) )
+        if ( c == '\015' && !cfgFlag(in->doc, OF_XML_TAGS) )
             break;
             
         if ( c < 32 )
@@ -573,6 +584,28 @@ StreamOut* TY_(UserOutput)( TidyOutputSink* sink, int encoding, uint nl )
     return out;
 }
 
+static void TIDY_CALL memsink_putByte( void* sinkData, byte bv )
+{
+    StreamOut* out = (StreamOut*) sinkData;
+    if ( out->memlen < out->memsize )
+        out->mem[ out->memlen ] = bv;
+    ++out->memlen;
+}
+
+/* Writes to size bytes of the caller's memory and counts what does
+** not fit, so with size 0 the output is only measured.
+*/
+StreamOut* TY_(MemoryOutput)( tmbstr mem, uint size, int encoding, uint nl )
+{
+    StreamOut* out = initStreamOut( encoding, nl );
+    out->sink.putByte = memsink_putByte;
+    out->sink.sinkData = out;
+    out->mem = mem;
+    out->memsize = ( mem ? size : 0 );
+    out->iotype = MemoryIO;
+    return out;
+}
+
 void TY_(WriteChar)( uint c, StreamOut* out )
 {
     /* Translate outgoing newlines */
@@ -603,10 +636,16 @@ void TY_(WriteChar)( uint c, StreamOut* out )
 
     else if (out->encoding == UTF8)
     {
-        int count = 0;
-        
-        TY_(EncodeCharToUTF8Bytes)( c, NULL, &out->sink, &count );
-        if (count <= 0)
+        tmbchar buf[10];
+        int ix, count = 0;
+
+        /* through PutByte(), so that out->copy gets the bytes, too */
+        if ( TY_(EncodeCharToUTF8Bytes)(c, buf, NULL, &count) == 0 )
+        {
+            for ( ix = 0; ix < count; ++ix )
+                PutByte( (byte) buf[ix], out );
+        }
+        else if (count <= 0)
         {
           /* TY_(ReportEncodingError)(in->lexer, INVALID_UTF8 | REPLACED_CHAR, c); */
             /* replacement char 0xFFFD encoded as UTF-8 */
@@ -724,6 +763,38 @@ void TY_(WriteChar)( uint c, StreamOut* out )
         PutByte( c, out );
 }
 
+/* Writes bytes that are already in the output encoding and need no
+** newline translation, e.g. runs of UTF-8 from the pretty printer.
+*/
+void TY_(WriteBytes)( ctmbstr buf, uint len, StreamOut* out )
+{
+    if ( len == 0 )
+        return;
+
+    if ( out->copy )
+        tidyBufAppend( out->copy, (void*) buf, len );
+
+    if ( out->iotype == BufferIO )
+        tidyBufAppend( (TidyBuffer*) out->sink.sinkData, (void*) buf, len );
+    else if ( out->iotype == FileIO )
+        fwrite( buf, 1, len, (FILE*) out->sink.sinkData );
+    else if ( out->iotype == MemoryIO )
+    {
+        if ( out->memlen < out->memsize )
+        {
+            uint n = out->memsize - out->memlen;
+            memcpy( out->mem + out->memlen, buf, n < len ? n : len );
+        }
+        out->memlen += len;
+    }
+    else
+    {
+        uint i;
+        for ( i = 0; i < len; ++i )
+            tidyPutByte( &out->sink, (byte) buf[i] );
+    }
+}
+
 
 
 /****************************
@@ -1071,6 +1142,8 @@ static void UngetByte( StreamIn* in, uint byteValue )
 }
 static void PutByte( uint byteValue, StreamOut* out )
 {
+    if ( out->copy )
+        tidyBufPutByte( out->copy, (byte) byteValue );
     tidyPutByte( &out->sink, byteValue );
 }
 
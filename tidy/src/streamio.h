@@ -31,7 +31,8 @@ typedef enum
 {
   FileIO,
   BufferIO,
-  UserIO
+  UserIO,
+  MemoryIO
 } IOType;
 
 /* states for ISO 2022
@@ -121,17 +122,27 @@ struct _StreamOut
 
     IOType iotype;
     TidyOutputSink sink;
+
+    tmbstr mem;       /* MemoryIO: caller's memory */
+    uint   memsize;   /* bytes available at mem */
+    uint   memlen;    /* bytes output, also those that did not fit */
+
+    TidyBuffer* copy; /* if set, gets a copy of the bytes output */
 };
 
 StreamOut* TY_(FileOutput)( FILE* fp, int encoding, uint newln );
 StreamOut* TY_(BufferOutput)( TidyBuffer* buf, int encoding, uint newln );
 StreamOut* TY_(UserOutput)( TidyOutputSink* sink, int encoding, uint newln );
+StreamOut* TY_(MemoryOutput)( tmbstr mem, uint size, int encoding, uint newln );
+
+void       TY_(BufReserve)( TidyBuffer* buf, uint allocSize );
 
 StreamOut* TY_(StdErrOutput)(void);
 /* StreamOut* StdOutOutput(void); */
 void       TY_(ReleaseStreamOut)( StreamOut* out );
 
 void TY_(WriteChar)( uint c, StreamOut* out );
+void TY_(WriteBytes)( ctmbstr buf, uint len, StreamOut* out );
 void TY_(outBOM)( StreamOut *out );
 
 ctmbstr TY_(GetEncodingNameFromTidyId)(uint id);
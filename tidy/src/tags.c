@@ -263,116 +263,205 @@ static const Dict tag_defs[] =
 };
 
 #if ELEMENT_HASH_LOOKUP
-static uint hash(ctmbstr s)
+/*
+ Name index of tag_defs, shared by all documents.  Bucket heads
+ and chain links are positions in tag_defs, 0 (the unknown entry)
+ ending a chain.  InitTagHash() builds it once, later it is only
+ read.  User declared tags are looked up per document.
+*/
+static unsigned short tagHashHead[ELEMENT_HASH_SIZE];
+static unsigned short tagHashNext[N_TIDY_TAGS];
+static TidyOnce tagHashOnce = TIDY_ONCE_INIT;
+
+static uint NameHash(ctmbstr s)
 {
     uint hashval;
 
     for (hashval = 0; *s != '\0'; s++)
         hashval = *s + 31*hashval;
 
-    return hashval % ELEMENT_HASH_SIZE;
+    return hashval;
 }
 
-static const Dict *install(TidyTagImpl* tags, const Dict* old)
+static uint hash(ctmbstr s)
 {
-    DictHash *np;
-    uint hashval;
+    return NameHash(s) % ELEMENT_HASH_SIZE;
+}
 
-    if (old)
-    {
-        np = (DictHash *)MemAlloc(sizeof(*np));
-        np->tag = old;
+static void InitTagHash(void)
+{
+    uint ix, h;
 
-        hashval = hash(old->name);
-        np->next = tags->hashtab[hashval];
-        tags->hashtab[hashval] = np;
+    for ( ix = N_TIDY_TAGS - 1; ix > 0; --ix )
+    {
+        h = hash( tag_defs[ix].name );
+        tagHashNext[ix] = tagHashHead[h];
+        tagHashHead[h] = (unsigned short) ix;
     }
+}
+
+/*
+ User declared tags are also found through an open addressed
+ table, kept at most half full.  Retired tags stay in it, marked,
+ so that declaring them again finds them without a list search.
+ It only shrinks when the retired tags are purged.
+*/
+static void HashDeclaredTag( TidyTagImpl* tags, Dict* np, Bool retired )
+{
+    uint mask = tags->declared_buckets - 1;
+    uint h = NameHash( np->name ) & mask;
 
-    return old;
+    while ( tags->declared_hash[h].tag != NULL )
+        h = (h + 1) & mask;
+    tags->declared_hash[h].tag = np;
+    tags->declared_hash[h].retired = retired;
 }
 
-static void removeFromHash( TidyTagImpl* tags, ctmbstr s )
+/* rebuild the table for declared_count entries, either from the
+** old table or, when purging, from declared_tag_list only
+*/
+static void RehashDeclaredTags( TidyTagImpl* tags, Bool purge )
 {
-    uint h = hash(s);
-    DictHash *p, *prev = NULL;
-    for (p = tags->hashtab[h]; p && p->tag; p = p->next)
+    DeclaredTag* old = tags->declared_hash;
+    uint oldBuckets = tags->declared_buckets;
+    uint buckets = DECLARED_TAG_HASH_SIZE;
+    uint ix;
+
+    tags->declared_hash = NULL;
+    tags->declared_buckets = 0;
+    if ( tags->declared_count > 0 )
     {
-        if (TY_(tmbstrcmp)(s, p->tag->name) == 0)
+        while ( buckets < 2 * tags->declared_count )
+            buckets *= 2;
+        tags->declared_hash = (DeclaredTag*) MemAlloc( buckets * sizeof(DeclaredTag) );
+        ClearMemory( tags->declared_hash, buckets * sizeof(DeclaredTag) );
+        tags->declared_buckets = buckets;
+    }
+
+    if ( purge )
+    {
+        Dict* np;
+        for ( np = tags->declared_tag_list; np; np = np->next )
+            HashDeclaredTag( tags, np, no );
+    }
+    else
+    {
+        for ( ix = 0; ix < oldBuckets; ++ix )
         {
-            DictHash* next = p->next;
-            if ( prev )
-                prev->next = next; 
-            else
-                tags->hashtab[h] = next;
-            MemFree(p);
-            return;
+            if ( old[ix].tag )
+                HashDeclaredTag( tags, old[ix].tag, old[ix].retired );
         }
-        prev = p;
     }
+    MemFree( old );
 }
 
-static void emptyHash( TidyTagImpl* tags )
+/* entry of a declared or retired tag */
+static DeclaredTag* FindDeclaredTag( TidyTagImpl* tags, ctmbstr s )
 {
-    uint i;
-    DictHash *prev, *next;
-
-    for (i = 0; i < ELEMENT_HASH_SIZE; ++i)
-    {
-        prev = NULL;
-        next = tags->hashtab[i];
+    uint mask = tags->declared_buckets - 1;
+    uint h;
 
-        while(next)
-        {
-            prev = next->next;
-            MemFree(next);
-            next = prev;
-        }
+    if ( tags->declared_buckets == 0 )
+        return NULL;
 
-        tags->hashtab[i] = NULL;
+    for ( h = NameHash(s) & mask; tags->declared_hash[h].tag != NULL;
+          h = (h + 1) & mask )
+    {
+        if ( TY_(tmbstrcmp)(s, tags->declared_hash[h].tag->name) == 0 )
+            return &tags->declared_hash[h];
     }
+    return NULL;
+}
+
+static const Dict* LookupDeclaredTag( TidyTagImpl* tags, ctmbstr s )
+{
+    const DeclaredTag* entry = FindDeclaredTag( tags, s );
+    return ( entry && !entry->retired ? entry->tag : NULL );
 }
 #endif /* ELEMENT_HASH_LOOKUP */
 
+/* link a new declared tag in front of declared_tag_list */
+static void AddDeclaredTag( TidyTagImpl* tags, Dict* np )
+{
+    np->next = tags->declared_tag_list;
+    tags->declared_tag_list = np;
+
+#if ELEMENT_HASH_LOOKUP
+    ++tags->declared_count;
+    if ( 2 * tags->declared_count > tags->declared_buckets )
+        RehashDeclaredTags( tags, no );
+    HashDeclaredTag( tags, np, no );
+#endif
+}
+
 static const Dict* lookup( TidyTagImpl* tags, ctmbstr s )
 {
-    const Dict *np;
 #if ELEMENT_HASH_LOOKUP
-    const DictHash* p;
+    uint ix;
+#else
+    const Dict *np;
 #endif
 
     if (!s)
         return NULL;
 
 #if ELEMENT_HASH_LOOKUP
-    /* this breaks if declared elements get changed between two   */
-    /* parser runs since Tidy would use the cached version rather */
-    /* than the new one.                                          */
-    /* However, as FreeDeclaredTags() correctly cleans the hash   */
-    /* this should not be true anymore.                           */
-    for (p = tags->hashtab[hash(s)]; p && p->tag; p = p->next)
-        if (TY_(tmbstrcmp)(s, p->tag->name) == 0)
-            return p->tag;
-
-    for (np = tag_defs + 1; np < tag_defs + N_TIDY_TAGS; ++np)
-        if (TY_(tmbstrcmp)(s, np->name) == 0)
-            return install(tags, np);
-
-    for (np = tags->declared_tag_list; np; np = np->next)
-        if (TY_(tmbstrcmp)(s, np->name) == 0)
-            return install(tags, np);
+    for (ix = tagHashHead[hash(s)]; ix != 0; ix = tagHashNext[ix])
+        if (TY_(tmbstrcmp)(s, tag_defs[ix].name) == 0)
+            return &tag_defs[ix];
 #else
-
     for (np = tag_defs + 1; np < tag_defs + N_TIDY_TAGS; ++np)
         if (TY_(tmbstrcmp)(s, np->name) == 0)
             return np;
+#endif /* ELEMENT_HASH_LOOKUP */
 
+#if ELEMENT_HASH_LOOKUP
+    return LookupDeclaredTag(tags, s);
+#else
     for (np = tags->declared_tag_list; np; np = np->next)
         if (TY_(tmbstrcmp)(s, np->name) == 0)
             return np;
 
-#endif /* ELEMENT_HASH_LOOKUP */
-
     return NULL;
+#endif
+}
+
+/* take a tag of that name back from the retired ones */
+static Dict* ReviveTag( TidyTagImpl* tags, ctmbstr name )
+{
+#if ELEMENT_HASH_LOOKUP
+    DeclaredTag* entry = FindDeclaredTag( tags, name );
+    Dict* np = NULL;
+
+    if ( entry && entry->retired )
+    {
+        entry->retired = no;
+        np = entry->tag;
+    }
+#else
+    Dict *np, *prev = NULL;
+
+    for ( np = tags->retired_tag_list; np; np = np->next )
+    {
+        if ( TY_(tmbstrcmp)(name, np->name) == 0 )
+        {
+            if ( prev )
+                prev->next = np->next;
+            else
+                tags->retired_tag_list = np->next;
+            break;
+        }
+        prev = np;
+    }
+#endif
+
+    if ( np )
+    {
+        np->model = 0;
+        np->next = tags->declared_tag_list;
+        tags->declared_tag_list = np;
+    }
+    return np;
 }
 
 
@@ -385,12 +474,16 @@ static void declare( TidyTagImpl* tags,
         Dict* np = (Dict*) lookup( tags, name );
         if ( np == NULL )
         {
-            np = (Dict*) MemAlloc( sizeof(Dict) );
-            ClearMemory( np, sizeof(Dict) );
-
-            np->name = TY_(tmbstrdup)( name );
-            np->next = tags->declared_tag_list;
-            tags->declared_tag_list = np;
+            /* reuse the entry of a tag declared again, so that
+               nodes referring to it stay valid */
+            np = ReviveTag( tags, name );
+            if ( np == NULL )
+            {
+                np = (Dict*) MemAlloc( sizeof(Dict) );
+                ClearMemory( np, sizeof(Dict) );
+                np->name = TY_(tmbstrdup)( name );
+                AddDeclaredTag( tags, np );
+            }
         }
 
         /* Make sure we are not over-writing predefined tags */
@@ -424,6 +517,32 @@ Bool TY_(FindTag)( TidyDocImpl* doc, Node *node )
     return no;
 }
 
+/* Element id for a tag name in any case, TidyTag_UNKNOWN
+   for names that are not HTML elements. Unlike FindTag()
+   this ignores TidyXmlTags, so that documents parsed as XML
+   can be matched against HTML element lists.
+*/
+TidyTagId TY_(LookupTagId)( TidyDocImpl* doc, ctmbstr name )
+{
+    tmbchar lcname[16];
+    const Dict *np;
+    uint i;
+
+    if ( !name )
+        return TidyTag_UNKNOWN;
+
+    for ( i = 0; name[i]; ++i )
+    {
+        if ( i + 1 >= sizeof(lcname) )
+            return TidyTag_UNKNOWN;
+        lcname[i] = (tmbchar) TY_(ToLower)( (byte) name[i] );
+    }
+    lcname[i] = '\0';
+
+    np = lookup( &doc->tags, lcname );
+    return np ? np->id : TidyTag_UNKNOWN;
+}
+
 const Dict* TY_(LookupTagDef)( TidyTagId tid )
 {
     const Dict *np;
@@ -522,29 +641,26 @@ ctmbstr        TY_(GetNextDeclaredTag)( TidyDocImpl* ARG_UNUSED(doc),
     return name;
 }
 
+/* dummy entry for all xml tags */
+static const Dict xml_tag_def =
+  { TidyTag_UNKNOWN,    NULL,         VERS_XML,             NULL,                       (CM_BLOCK),                                    NULL,          NULL,           NULL };
+
 void TY_(InitTags)( TidyDocImpl* doc )
 {
-    Dict* xml;
     TidyTagImpl* tags = &doc->tags;
 
     ClearMemory( tags, sizeof(TidyTagImpl) );
-
-    /* create dummy entry for all xml tags */
-    xml = (Dict*) MemAlloc( sizeof(Dict) );
-    ClearMemory( xml, sizeof(Dict) );
-    xml->name = NULL;
-    xml->versions = VERS_XML;
-    xml->model = CM_BLOCK;
-    xml->parser = NULL;
-    xml->chkattrs = NULL;
-    xml->attrvers = NULL;
-    tags->xml_tags = xml;
+#if ELEMENT_HASH_LOOKUP
+    TidyRunOnce( &tagHashOnce, InitTagHash );
+#endif
+    tags->xml_tags = &xml_tag_def;
 }
 
-/* By default, zap all of them.  But allow
-** an single type to be specified.
+/* Set aside the declared tags of a type, or all of them for
+** tagtype_null.  DefineTag() takes them back when they are
+** declared again, PurgeRetiredTags() frees the rest.
 */
-void TY_(FreeDeclaredTags)( TidyDocImpl* doc, UserTagType tagType )
+void TY_(RetireDeclaredTags)( TidyDocImpl* doc, UserTagType tagType )
 {
     TidyTagImpl* tags = &doc->tags;
     Dict *curr, *next = NULL, *prev = NULL;
@@ -579,30 +695,69 @@ void TY_(FreeDeclaredTags)( TidyDocImpl* doc, UserTagType tagType )
 
         if ( deleteIt )
         {
-#if ELEMENT_HASH_LOOKUP
-          removeFromHash( &doc->tags, curr->name );
-#endif
-          MemFree( curr->name );
-          MemFree( curr );
           if ( prev )
             prev->next = next;
           else
             tags->declared_tag_list = next;
+
+#if ELEMENT_HASH_LOOKUP
+          curr->next = NULL;
+          FindDeclaredTag( tags, curr->name )->retired = yes;
+#else
+          /* reversing the latest-first order puts them in
+             declaration order, the order they come back in */
+          curr->next = tags->retired_tag_list;
+          tags->retired_tag_list = curr;
+#endif
         }
         else
           prev = curr;
     }
 }
 
-void TY_(FreeTags)( TidyDocImpl* doc )
+void TY_(PurgeRetiredTags)( TidyDocImpl* doc )
 {
     TidyTagImpl* tags = &doc->tags;
-
 #if ELEMENT_HASH_LOOKUP
-    emptyHash( tags );
+    uint ix;
+
+    for ( ix = 0; ix < tags->declared_buckets; ++ix )
+    {
+        Dict* curr = tags->declared_hash[ix].tag;
+        if ( curr && tags->declared_hash[ix].retired )
+        {
+            MemFree( curr->name );
+            MemFree( curr );
+            --tags->declared_count;
+        }
+    }
+    RehashDeclaredTags( tags, yes );
+#else
+    Dict* curr;
+
+    while ( NULL != (curr = tags->retired_tag_list) )
+    {
+        tags->retired_tag_list = curr->next;
+        MemFree( curr->name );
+        MemFree( curr );
+    }
 #endif
+}
+
+/* By default, zap all of them.  But allow
+** an single type to be specified.
+*/
+void TY_(FreeDeclaredTags)( TidyDocImpl* doc, UserTagType tagType )
+{
+    TY_(RetireDeclaredTags)( doc, tagType );
+    TY_(PurgeRetiredTags)( doc );
+}
+
+void TY_(FreeTags)( TidyDocImpl* doc )
+{
+    TidyTagImpl* tags = &doc->tags;
+
     TY_(FreeDeclaredTags)( doc, tagtype_null );
-    MemFree( tags->xml_tags );
 
     /* get rid of dangling tag references */
     ClearMemory( tags, sizeof(TidyTagImpl) );
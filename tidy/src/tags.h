@@ -59,21 +59,33 @@ enum
     ELEMENT_HASH_SIZE=178u
 };
 
-struct _DictHash
-{
-    Dict const*         tag;
-    struct _DictHash*   next;
-};
+/* initial size of the declared tag table, a power of 2 */
+#if !defined(DECLARED_TAG_HASH_SIZE)
+#define DECLARED_TAG_HASH_SIZE 32u
+#endif
+#endif
 
-typedef struct _DictHash DictHash;
+#if ELEMENT_HASH_LOOKUP
+/* entry of the declared tag table */
+typedef struct _DeclaredTag
+{
+    Dict* tag;
+    Bool  retired;                 /* undeclared, until declared again */
+} DeclaredTag;
 #endif
 
+/* The built-in elements and their name index are shared by all
+   documents; only user declared tags are kept per document. */
 struct _TidyTagImpl
 {
-    Dict* xml_tags;                /* placeholder for all xml tags */
+    const Dict* xml_tags;          /* placeholder for all xml tags */
     Dict* declared_tag_list;       /* User declared tags */
 #if ELEMENT_HASH_LOOKUP
-    DictHash* hashtab[ELEMENT_HASH_SIZE];
+    DeclaredTag* declared_hash;    /* open addressed, by name, owns retired tags */
+    uint   declared_buckets;
+    uint   declared_count;         /* declared and retired */
+#else
+    Dict* retired_tag_list;        /* undeclared, until declared again */
 #endif
 };
 
@@ -82,9 +94,12 @@ typedef struct _TidyTagImpl TidyTagImpl;
 /* interface for finding tag by name */
 const Dict* TY_(LookupTagDef)( TidyTagId tid );
 Bool    TY_(FindTag)( TidyDocImpl* doc, Node *node );
+TidyTagId TY_(LookupTagId)( TidyDocImpl* doc, ctmbstr name );
 Parser* TY_(FindParser)( TidyDocImpl* doc, Node *node );
 void    TY_(DefineTag)( TidyDocImpl* doc, UserTagType tagType, ctmbstr name );
 void    TY_(FreeDeclaredTags)( TidyDocImpl* doc, UserTagType tagType ); /* tagtype_null to free all */
+void    TY_(RetireDeclaredTags)( TidyDocImpl* doc, UserTagType tagType );
+void    TY_(PurgeRetiredTags)( TidyDocImpl* doc );
 
 TidyIterator   TY_(GetDeclaredTagList)( TidyDocImpl* doc );
 ctmbstr        TY_(GetNextDeclaredTag)( TidyDocImpl* doc, UserTagType tagType,
@@ -29,15 +29,66 @@
 #define MIN(a,b) (((a) < (b))?(a):(b))
 #endif
 
+/* The indexes shared by all documents are built on first use by
+** TidyRunOnce(), exactly once.  With SUPPORT_THREADS that is
+** pthread_once(), so documents may be used on several threads;
+** otherwise a plain flag guards them and only one thread may use Tidy.
+*/
+#if SUPPORT_THREADS
+#include <pthread.h>
+typedef pthread_once_t TidyOnce;
+#define TIDY_ONCE_INIT           PTHREAD_ONCE_INIT
+#define TidyRunOnce(once, init)  pthread_once( (once), (init) )
+#else
+typedef Bool TidyOnce;
+#define TIDY_ONCE_INIT           no
+#define TidyRunOnce(once, init)  ( *(once) ? 0 : ( (init)(), *(once) = yes, 0 ) )
+#endif
+
+/* Per-pass clean and repair timings, for profiling builds.
+** Enable with -DTIDY_PASS_TIMING=1.
+*/
+#if !defined(TIDY_PASS_TIMING)
+#define TIDY_PASS_TIMING 0
+#endif
+
+#if TIDY_PASS_TIMING
+#include <time.h>
+#endif
+
+/* Message codes are below N_MESSAGE_CODES: those in message.h and,
+** from 1000, the accessibility codes in access.h
+*/
+#define N_MESSAGE_CODES  2048
+
+/* Passes run by tidyDocCleanAndRepair(), in schedule order */
+typedef enum
+{
+    TidyPass_NestedEmphasis,
+    TidyPass_List2BQ,
+    TidyPass_BQ2Div,
+    TidyPass_EmFromI,
+    TidyPass_DropSections,
+    TidyPass_CleanWord2000,
+    TidyPass_DropEmptyElements,
+    TidyPass_CleanDocument,
+    TidyPass_VerifyHTTPEquiv,
+    TidyPass_CheckIntegrity,
+    N_TIDY_CLEAN_PASSES
+} TidyCleanPassId;
+
 struct _TidyDocImpl
 {
     /* The Document Tree (and backing store buffer) */
     Node                root;       /* This MUST remain the first declared 
                                        variable in this structure */
     Lexer*              lexer;
+    Lexer*              spareLexer; /* cleared by tidyReset(), for the
+                                       next parse to reuse */
 
     /* Config + Markup Declarations */
     TidyConfigImpl      config;
+    TidyOptionFlags     optflags;   /* options of the hot paths */
     TidyTagImpl         tags;
     TidyAttribImpl      attribs;
 
@@ -54,6 +105,8 @@ struct _TidyDocImpl
     StreamOut*          docOut;
     StreamOut*          errout;
     TidyReportFilter    mssgFilt;
+    TidyMessageCallback mssgCallback;
+    uint                muted[ N_MESSAGE_CODES/32 ];  /* a bit per code in mute */
     TidyOptCallback     pOptCallback;
 
     /* Parse + Repair Results */
@@ -83,6 +136,10 @@ struct _TidyDocImpl
     struct utimbuf      filetimes;
 #endif
     tmbstr              givenDoctype;
+
+#if TIDY_PASS_TIMING
+    clock_t             passTime[ N_TIDY_CLEAN_PASSES ];
+#endif
 };
 
 
@@ -99,6 +156,12 @@ TidyAttr     tidyImplToAttr( AttVal* attval );
 
 const TidyOptionImpl* tidyOptionToImpl( TidyOption topt );
 TidyOption   tidyImplToOption( const TidyOptionImpl* option );
+
+TidyMessageImpl* tidyMessageToImpl( TidyMessage tmsg );
+TidyMessage  tidyImplToMessage( TidyMessageImpl* msg );
+
+TidyProfileImpl* tidyProfileToImpl( TidyProfile tprof );
+TidyProfile  tidyImplToProfile( TidyProfileImpl* profile );
 #else
 
 #define tidyDocToImpl( tdoc )       ((TidyDocImpl*)(tdoc))
@@ -113,11 +176,18 @@ TidyOption   tidyImplToOption( const TidyOptionImpl* option );
 #define tidyOptionToImpl( topt )    ((const TidyOptionImpl*)(topt))
 #define tidyImplToOption( option )  ((TidyOption)(option))
 
+#define tidyMessageToImpl( tmsg )   ((TidyMessageImpl*)(tmsg))
+#define tidyImplToMessage( msg )    ((TidyMessage)(msg))
+
+#define tidyProfileToImpl( tprof )  ((TidyProfileImpl*)(tprof))
+#define tidyImplToProfile( prof )   ((TidyProfile)(prof))
+
 #endif
 
 /* Create/Destroy a Tidy "document" object */
 TidyDocImpl* tidyDocCreate(void);
 void         tidyDocRelease( TidyDocImpl* impl );
+void         tidyDocReset( TidyDocImpl* impl );
 
 int          tidyDocStatus( TidyDocImpl* impl );
 
@@ -102,12 +102,17 @@ void TIDY_CALL          tidyRelease( TidyDoc tdoc )
   tidyDocRelease( impl );
 }
 
+void TIDY_CALL          tidyReset( TidyDoc tdoc )
+{
+  TidyDocImpl* impl = tidyDocToImpl( tdoc );
+  tidyDocReset( impl );
+}
+
 TidyDocImpl* tidyDocCreate(void)
 {
     TidyDocImpl* doc = (TidyDocImpl*)MemAlloc( sizeof(TidyDocImpl) );
     ClearMemory( doc, sizeof(*doc) );
 
-    TY_(InitMap)();
     TY_(InitTags)( doc );
     TY_(InitAttrs)( doc );
     TY_(InitConfig)( doc );
@@ -136,6 +141,9 @@ void          tidyDocRelease( TidyDocImpl* doc )
 
         TY_(FreePrintBuf)( doc );
         TY_(FreeLexer)( doc );
+        doc->lexer = doc->spareLexer;
+        doc->spareLexer = NULL;
+        TY_(FreeLexer)( doc );
         TY_(FreeNode)(doc, &doc->root);
         ClearMemory(&doc->root, sizeof(Node));
 
@@ -149,6 +157,58 @@ void          tidyDocRelease( TidyDocImpl* doc )
     }
 }
 
+/* Frees the document tree.  The lexer and the anchor table
+** are cleared rather than freed, so that their buffers are
+** reused by the next document.
+*/
+static void ClearDocument( TidyDocImpl* doc )
+{
+    TY_(ClearLexer)( doc );
+    TY_(ClearAnchors)( doc );
+
+    TY_(FreeNode)(doc, &doc->root);
+    ClearMemory(&doc->root, sizeof(Node));
+
+    if (doc->givenDoctype)
+        MemFree(doc->givenDoctype);
+
+    doc->givenDoctype = NULL;
+}
+
+void          tidyDocReset( TidyDocImpl* doc )
+{
+    /* not from a callback while the document is parsed or saved */
+    if ( doc && doc->docIn == NULL && doc->docOut == NULL )
+    {
+        ClearDocument( doc );
+
+        /* no lexer, as in a new document, until the next parse */
+        if ( doc->lexer )
+        {
+            doc->spareLexer = doc->lexer;
+            doc->lexer = NULL;
+        }
+
+        doc->errors = 0;
+        doc->warnings = 0;
+        doc->accessErrors = 0;
+        doc->infoMessages = 0;
+        doc->docErrors = 0;
+        doc->parseStatus = 0;
+
+        doc->badAccess = 0;
+        doc->badLayout = 0;
+        doc->badChars = 0;
+        doc->badForm = 0;
+
+        doc->nClassId = 0;
+        doc->inputHadBOM = no;
+#if PRESERVE_FILE_TIMES
+        ClearMemory( &doc->filetimes, sizeof(doc->filetimes) );
+#endif
+    }
+}
+
 /* Let application store a chunk of data w/ each Tidy tdocance.
 ** Useful for callbacks.
 */
@@ -202,6 +262,14 @@ int TIDY_CALL     tidyLoadConfigEnc( TidyDoc tdoc, ctmbstr cfgfil, ctmbstr chare
     return -EINVAL;
 }
 
+int TIDY_CALL     tidyLoadConfigBuffer( TidyDoc tdoc, TidyBuffer* cfgbuf, ctmbstr charenc )
+{
+    TidyDocImpl* impl = tidyDocToImpl( tdoc );
+    if ( impl && cfgbuf )
+        return TY_(ParseConfigBufferEnc)( impl, cfgbuf, charenc );
+    return -EINVAL;
+}
+
 int TIDY_CALL         tidySetCharEncoding( TidyDoc tdoc, ctmbstr encnam )
 {
     TidyDocImpl* impl = tidyDocToImpl( tdoc );
@@ -588,6 +656,33 @@ Bool TIDY_CALL tidyOptCopyConfig( TidyDoc to, TidyDoc from )
     return no;
 }
 
+TidyProfile TIDY_CALL tidyOptCompileProfile( TidyDoc tdoc )
+{
+    TidyDocImpl* impl = tidyDocToImpl( tdoc );
+    if ( impl )
+        return tidyImplToProfile( TY_(CompileProfile)(impl) );
+    return NULL;
+}
+
+Bool TIDY_CALL tidyOptApplyProfile( TidyDoc tdoc, TidyProfile tprof )
+{
+    TidyDocImpl* impl = tidyDocToImpl( tdoc );
+    TidyProfileImpl* profile = tidyProfileToImpl( tprof );
+    if ( impl && profile )
+    {
+        TY_(ApplyProfile)( impl, profile );
+        return yes;
+    }
+    return no;
+}
+
+void TIDY_CALL tidyOptReleaseProfile( TidyProfile tprof )
+{
+    TidyProfileImpl* profile = tidyProfileToImpl( tprof );
+    if ( profile )
+        TY_(FreeProfile)( profile );
+}
+
 
 /* I/O and Message handling interface
 **
@@ -617,6 +712,76 @@ Bool TIDY_CALL        tidySetReportFilter( TidyDoc tdoc, TidyReportFilter filt )
   return no;
 }
 
+/* Use TidyMessageCallback to handle messages from their code
+** and arguments.  Text is formatted only if it is asked for.
+*/
+Bool TIDY_CALL        tidySetMessageCallback( TidyDoc tdoc, TidyMessageCallback msgCallback )
+{
+  TidyDocImpl* impl = tidyDocToImpl( tdoc );
+  if ( impl )
+  {
+    impl->mssgCallback = msgCallback;
+    return yes;
+  }
+  return no;
+}
+
+uint TIDY_CALL        tidyMessageCode( TidyMessage tmsg )
+{
+  TidyMessageImpl* msg = tidyMessageToImpl( tmsg );
+  return ( msg ? msg->code : 0 );
+}
+
+TidyReportLevel TIDY_CALL tidyMessageLevel( TidyMessage tmsg )
+{
+  TidyMessageImpl* msg = tidyMessageToImpl( tmsg );
+  return ( msg ? msg->level : TidyInfo );
+}
+
+uint TIDY_CALL        tidyMessageLine( TidyMessage tmsg )
+{
+  TidyMessageImpl* msg = tidyMessageToImpl( tmsg );
+  return ( msg ? msg->line : 0 );
+}
+
+uint TIDY_CALL        tidyMessageColumn( TidyMessage tmsg )
+{
+  TidyMessageImpl* msg = tidyMessageToImpl( tmsg );
+  return ( msg ? msg->column : 0 );
+}
+
+uint TIDY_CALL        tidyMessageArgCount( TidyMessage tmsg )
+{
+  TidyMessageImpl* msg = tidyMessageToImpl( tmsg );
+  return ( msg ? msg->nargs : 0 );
+}
+
+ctmbstr TIDY_CALL     tidyMessageArg( TidyMessage tmsg, uint ix )
+{
+  TidyMessageImpl* msg = tidyMessageToImpl( tmsg );
+  ctmbstr arg = NULL;
+  if ( msg && ix < msg->nargs )
+  {
+    if ( msg->tagargs & (1u << ix) )
+      arg = ( msg->tags[ix] ? msg->tags[ix]->element : NULL );
+    else
+      arg = msg->args[ix];
+  }
+  return arg;
+}
+
+ctmbstr TIDY_CALL     tidyMessageFormat( TidyMessage tmsg )
+{
+  TidyMessageImpl* msg = tidyMessageToImpl( tmsg );
+  return ( msg ? msg->format : NULL );
+}
+
+ctmbstr TIDY_CALL     tidyMessageText( TidyMessage tmsg )
+{
+  TidyMessageImpl* msg = tidyMessageToImpl( tmsg );
+  return ( msg ? TY_(MessageText)( msg ) : NULL );
+}
+
 #if 0   /* Not yet */
 int         tidySetContentOutputSink( TidyDoc tdoc, TidyOutputSink* outp )
 {
@@ -1030,26 +1195,90 @@ int         tidyDocSaveStdout( TidyDocImpl* doc )
     return status;
 }
 
+static void PrintDocument( TidyDocImpl* doc, StreamOut* out );
+
+/* Output goes straight to the caller's buffer.  When it does not
+** fit, the rest is only counted, so one pass gives the size needed.
+** The options are then left as they are, so the retry prints the same.
+*/
 int         tidyDocSaveString( TidyDocImpl* doc, tmbstr buffer, uint* buflen )
 {
     uint outenc = (uint)cfg( doc, TidyOutCharEncoding );
     uint nl = (uint)cfg( doc, TidyNewline );
-    TidyBuffer outbuf = {0};
+    StreamOut* out = TY_(MemoryOutput)( buffer, *buflen, outenc, nl );
+    int status;
 
-    StreamOut* out = TY_(BufferOutput)( &outbuf, outenc, nl );
-    int status = tidyDocSaveStream( doc, out );
-
-    if ( outbuf.size > *buflen )
+    PrintDocument( doc, out );
+    if ( out->memlen > *buflen )
         status = -ENOMEM;
     else
-        memcpy( buffer, outbuf.bp, outbuf.size );
+    {
+        TY_(ResetConfigToSnapshot)( doc );
+        status = tidyDocStatus( doc );
+    }
 
-    *buflen = outbuf.size;
-    tidyBufFree( &outbuf );
+    *buflen = out->memlen;
     MemFree( out );
     return status;
 }
 
+/* A quick guess at the size of the output from the text and markup
+** in the tree, a little on the high side, so the output buffer can
+** be allocated once.
+*/
+static uint EstimateSaveSize( TidyDocImpl* doc )
+{
+    Bool indent = ( cfgAutoBool(doc, TidyIndentContent) != TidyNoState );
+    uint spaces = ( indent ? (uint)cfg(doc, TidyIndentSpaces) : 0 );
+    Node* node = &doc->root;
+    ulong size = 0;
+    uint depth = 0;
+
+    for (;;)
+    {
+        if ( node->type == TextNode )
+            size += node->end - node->start;
+        else if ( node->element )
+        {
+            AttVal* av;
+
+            size += 2 * TY_(tmbstrlen)( node->element ) + 6 + depth * spaces;
+            for ( av = node->attributes; av; av = av->next )
+                size += TY_(tmbstrlen)( av->attribute ) +
+                        TY_(tmbstrlen)( av->value ) + 4;
+        }
+        else if ( node->end > node->start )
+            size += node->end - node->start + 16;
+
+        if ( node->content )
+        {
+            node = node->content;
+            ++depth;
+        }
+        else
+        {
+            while ( node->next == NULL && node->parent )
+            {
+                node = node->parent;
+                --depth;
+            }
+            if ( node->next == NULL )
+                break;
+            node = node->next;
+        }
+    }
+
+    size += size / 8;
+#if SUPPORT_UTF16_ENCODINGS
+    {
+        uint outenc = (uint)cfg( doc, TidyOutCharEncoding );
+        if ( outenc == UTF16LE || outenc == UTF16BE || outenc == UTF16 )
+            size *= 2;
+    }
+#endif
+    return ( size < UINT_MAX / 2 ? (uint) size : UINT_MAX / 2 );
+}
+
 int         tidyDocSaveBuffer( TidyDocImpl* doc, TidyBuffer* outbuf )
 {
     int status = -EINVAL;
@@ -1058,7 +1287,10 @@ int         tidyDocSaveBuffer( TidyDocImpl* doc, TidyBuffer* outbuf )
         uint outenc = (uint)cfg( doc, TidyOutCharEncoding );
         uint nl = (uint)cfg( doc, TidyNewline );
         StreamOut* out = TY_(BufferOutput)( outbuf, outenc, nl );
-    
+
+        if ( cfgBool(doc, TidyShowMarkup) &&
+             (doc->errors == 0 || cfgBool(doc, TidyForceOutput)) )
+            TY_(BufReserve)( outbuf, outbuf->size + EstimateSaveSize(doc) );
         status = tidyDocSaveStream( doc, out );
         MemFree( out );
     }
@@ -1123,18 +1355,13 @@ int         tidyDocParseStream( TidyDocImpl* doc, StreamIn* in )
     doc->docIn = in;
 
     TY_(TakeConfigSnapshot)( doc );    /* Save config state */
-    TY_(FreeLexer)( doc );
-    TY_(FreeAnchors)( doc );
+    ClearDocument( doc );
 
-    TY_(FreeNode)(doc, &doc->root);
-    ClearMemory(&doc->root, sizeof(Node));
-
-    if (doc->givenDoctype)
-        MemFree(doc->givenDoctype);
-
-    doc->givenDoctype = NULL;
-
-    doc->lexer = TY_(NewLexer)( doc );
+    if ( doc->lexer == NULL )
+    {
+        doc->lexer = ( doc->spareLexer ? doc->spareLexer : TY_(NewLexer)( doc ) );
+        doc->spareLexer = NULL;
+    }
     /* doc->lexer->root = &doc->root; */
     doc->root.line = doc->lexer->lines;
     doc->root.column = doc->lexer->columns;
@@ -1206,66 +1433,251 @@ int         tidyDocRunDiagnostics( TidyDocImpl* doc )
      return tidyDocStatus( doc );
 }
 
-int         tidyDocCleanAndRepair( TidyDocImpl* doc )
+/* Clean and repair pass schedule
+**
+** Each transform run by tidyDocCleanAndRepair() is registered below
+** with the option test that enables it, the tags or node types it can
+** act on and the tags it may introduce.  Before the schedule is run a
+** single census walk records which tags and node types occur in the
+** tree, and passes that cannot fire are skipped.  The census is only
+** ever widened, by the tags a pass yields, so a skipped pass is one
+** that would have found nothing to do.
+**
+** The order of the table is significant: later passes depend on the
+** output of earlier ones, e.g. BQ2Div() on List2BQ().
+*/
+
+typedef struct _TreeCensus
 {
-    Bool word2K   = cfgBool( doc, TidyWord2000 );
-    Bool logical  = cfgBool( doc, TidyLogicalEmphasis );
-    Bool clean    = cfgBool( doc, TidyMakeClean );
-    Bool dropFont = cfgBool( doc, TidyDropFontTags );
-    Bool htmlOut  = cfgBool( doc, TidyHtmlOut );
-    Bool xmlOut   = cfgBool( doc, TidyXmlOut );
-    Bool xhtmlOut = cfgBool( doc, TidyXhtmlOut );
-    Bool xmlDecl  = cfgBool( doc, TidyXmlDecl );
-    Bool tidyMark = cfgBool( doc, TidyMark );
-    Bool tidyXmlTags = cfgBool( doc, TidyXmlTags );
-    Node* node;
+    byte tags[ (N_TIDY_TAGS + 7) / 8 ];
+    uint types;                         /* bit per NodeType */
+} TreeCensus;
 
-    if (tidyXmlTags)
-       return tidyDocStatus( doc );
+#define CensusHasTag(c, tid)  ((c)->tags[(tid) >> 3] & (1u << ((tid) & 7)))
+#define CensusAddTag(c, tid)  ((c)->tags[(tid) >> 3] |= (byte)(1u << ((tid) & 7)))
+#define NodeTypeBit(t)        (1u << (t))
+
+typedef void (CleanPassFn)( TidyDocImpl* doc );
+
+typedef struct _CleanPass
+{
+    TidyCleanPassId   id;
+    ctmbstr           name;
+    CleanPassFn*      run;
+    const TidyTagId*  fires;            /* NULL: any tree */
+    uint              firesOnTypes;     /* NodeTypeBit() mask */
+    const TidyTagId*  yields;
+} CleanPass;
 
+static void PassNestedEmphasis( TidyDocImpl* doc )
+{
     /* simplifies <b><b> ... </b> ...</b> etc. */
     TY_(NestedEmphasis)( doc, &doc->root );
+}
 
+static void PassList2BQ( TidyDocImpl* doc )
+{
     /* cleans up <dir>indented text</dir> etc. */
     TY_(List2BQ)( doc, &doc->root );
+}
+
+static void PassBQ2Div( TidyDocImpl* doc )
+{
     TY_(BQ2Div)( doc, &doc->root );
+}
 
+static void PassEmFromI( TidyDocImpl* doc )
+{
     /* replaces i by em and b by strong */
-    if ( logical )
-        TY_(EmFromI)( doc, &doc->root );
+    TY_(EmFromI)( doc, &doc->root );
+}
 
-    if ( word2K && TY_(IsWord2000)(doc) )
-    {
-        /* prune Word2000's <![if ...]> ... <![endif]> */
-        TY_(DropSections)( doc, &doc->root );
+static void PassDropSections( TidyDocImpl* doc )
+{
+    /* prune Word2000's <![if ...]> ... <![endif]> */
+    TY_(DropSections)( doc, &doc->root );
+}
 
-        /* drop style & class attributes and empty p, span elements */
-        TY_(CleanWord2000)( doc, &doc->root );
-        TY_(DropEmptyElements)(doc, &doc->root);
-    }
+static void PassCleanWord2000( TidyDocImpl* doc )
+{
+    /* drop style & class attributes and empty p, span elements */
+    TY_(CleanWord2000)( doc, &doc->root );
+}
+
+static void PassDropEmptyElements( TidyDocImpl* doc )
+{
+    TY_(DropEmptyElements)( doc, &doc->root );
+}
 
+static void PassCleanDocument( TidyDocImpl* doc )
+{
     /* replaces presentational markup by style rules */
-    if ( clean || dropFont )
-        TY_(CleanDocument)( doc );
+    TY_(CleanDocument)( doc );
+}
 
-    /*  Move terminating <br /> tags from out of paragraphs  */
-    /*!  Do we want to do this for all block-level elements?  */
+static void PassVerifyHTTPEquiv( TidyDocImpl* doc )
+{
+    /*  Reconcile http-equiv meta element with output encoding  */
+    TY_(VerifyHTTPEquiv)( doc, TY_(FindHEAD)( doc ));
+}
 
-    /* This is disabled due to http://tidy.sf.net/bug/681116 */
-#if 0
-    FixBrakes( doc, TY_(FindBody)( doc ));
-#endif
+static void PassCheckIntegrity( TidyDocImpl* doc )
+{
+    if ( !TY_(CheckNodeIntegrity)( &doc->root ) )
+        FatalError( integrity );
+}
 
-    /*  Reconcile http-equiv meta element with output encoding  */
-    if (cfg( doc, TidyOutCharEncoding) != RAW
+static const TidyTagId emphasisTags[] =
+  { TidyTag_B, TidyTag_I, TidyTag_UNKNOWN };
+static const TidyTagId listTags[] =
+  { TidyTag_DIR, TidyTag_MENU, TidyTag_OL, TidyTag_UL, TidyTag_UNKNOWN };
+static const TidyTagId blockquoteTags[] =
+  { TidyTag_BLOCKQUOTE, TidyTag_UNKNOWN };
+static const TidyTagId divTags[] =
+  { TidyTag_DIV, TidyTag_UNKNOWN };
+static const TidyTagId logicalTags[] =
+  { TidyTag_EM, TidyTag_STRONG, TidyTag_UNKNOWN };
+static const TidyTagId metaTags[] =
+  { TidyTag_META, TidyTag_UNKNOWN };
+static const TidyTagId word2000Yields[] =
+  { TidyTag_PRE, TidyTag_LI, TidyTag_UL, TidyTag_OL, TidyTag_UNKNOWN };
+
+static const CleanPass cleanPasses[] =
+{
+  { TidyPass_NestedEmphasis,    "NestedEmphasis",    PassNestedEmphasis,
+    emphasisTags,   0,                          NULL },
+  { TidyPass_List2BQ,           "List2BQ",           PassList2BQ,
+    listTags,       0,                          blockquoteTags },
+  { TidyPass_BQ2Div,            "BQ2Div",            PassBQ2Div,
+    blockquoteTags, 0,                          divTags },
+  { TidyPass_EmFromI,           "EmFromI",           PassEmFromI,
+    emphasisTags,   0,                          logicalTags },
+  { TidyPass_DropSections,      "DropSections",      PassDropSections,
+    NULL,           NodeTypeBit(SectionTag),    NULL },
+  { TidyPass_CleanWord2000,     "CleanWord2000",     PassCleanWord2000,
+    NULL,           0,                          word2000Yields },
+  { TidyPass_DropEmptyElements, "DropEmptyElements", PassDropEmptyElements,
+    NULL,           0,                          NULL },
+  { TidyPass_CleanDocument,     "CleanDocument",     PassCleanDocument,
+    NULL,           0,                          NULL },
+  { TidyPass_VerifyHTTPEquiv,   "VerifyHTTPEquiv",   PassVerifyHTTPEquiv,
+    metaTags,       0,                          NULL },
+  { TidyPass_CheckIntegrity,    "CheckNodeIntegrity", PassCheckIntegrity,
+    NULL,           0,                          NULL }
+};
+
+static void TakeCensus( TreeCensus* census, Node* node )
+{
+    for ( ; node; node = node->next )
+    {
+        census->types |= NodeTypeBit( node->type );
+        if ( node->tag )
+            CensusAddTag( census, node->tag->id );
+        if ( node->content )
+            TakeCensus( census, node->content );
+    }
+}
+
+static Bool PassCanFire( const CleanPass* pass, const TreeCensus* census )
+{
+    const TidyTagId* tid;
+
+    if ( pass->fires == NULL && pass->firesOnTypes == 0 )
+        return yes;
+
+    if ( census->types & pass->firesOnTypes )
+        return yes;
+
+    for ( tid = pass->fires; tid && *tid != TidyTag_UNKNOWN; ++tid )
+        if ( CensusHasTag(census, *tid) )
+            return yes;
+
+    return no;
+}
+
+/* Decide from the active config which passes are wanted at all */
+static void ScheduleCleanPasses( TidyDocImpl* doc, Bool* wanted )
+{
+    Bool word2K   = cfgBool( doc, TidyWord2000 ) && TY_(IsWord2000)( doc );
+    uint outenc   = (uint)cfg( doc, TidyOutCharEncoding );
+
+    wanted[TidyPass_NestedEmphasis]    = yes;
+    wanted[TidyPass_List2BQ]           = yes;
+    wanted[TidyPass_BQ2Div]            = yes;
+    wanted[TidyPass_EmFromI]           = cfgBool( doc, TidyLogicalEmphasis );
+    wanted[TidyPass_DropSections]      = word2K;
+    wanted[TidyPass_CleanWord2000]     = word2K;
+    wanted[TidyPass_DropEmptyElements] = word2K;
+    wanted[TidyPass_CleanDocument]     = ( cfgBool( doc, TidyMakeClean ) ||
+                                           cfgBool( doc, TidyDropFontTags ) );
+    wanted[TidyPass_VerifyHTTPEquiv]   = ( outenc != RAW
 #ifndef NO_NATIVE_ISO2022_SUPPORT
-        && cfg( doc, TidyOutCharEncoding) != ISO2022
+                                           && outenc != ISO2022
 #endif
-        )
-        TY_(VerifyHTTPEquiv)( doc, TY_(FindHEAD)( doc ));
+                                         );
+    wanted[TidyPass_CheckIntegrity]    = yes;
+}
 
-    if ( !TY_(CheckNodeIntegrity)( &doc->root ) )
-        FatalError( integrity );
+static void RunCleanPasses( TidyDocImpl* doc )
+{
+    Bool wanted[ N_TIDY_CLEAN_PASSES ];
+    TreeCensus census;
+    uint ix;
+
+    ScheduleCleanPasses( doc, wanted );
+
+    ClearMemory( &census, sizeof(census) );
+    TakeCensus( &census, &doc->root );
+
+    for ( ix = 0; ix < N_TIDY_CLEAN_PASSES; ++ix )
+    {
+        const CleanPass* pass = &cleanPasses[ ix ];
+        const TidyTagId* tid;
+#if TIDY_PASS_TIMING
+        clock_t start;
+
+        doc->passTime[ pass->id ] = 0;
+#endif
+        assert( pass->id == (TidyCleanPassId) ix );
+
+        if ( !wanted[pass->id] || !PassCanFire(pass, &census) )
+            continue;
+
+#if TIDY_PASS_TIMING
+        start = clock();
+#endif
+        pass->run( doc );
+#if TIDY_PASS_TIMING
+        doc->passTime[ pass->id ] = clock() - start;
+#endif
+
+        for ( tid = pass->yields; tid && *tid != TidyTag_UNKNOWN; ++tid )
+            CensusAddTag( &census, *tid );
+    }
+
+#if TIDY_PASS_TIMING
+    for ( ix = 0; ix < N_TIDY_CLEAN_PASSES; ++ix )
+        fprintf( stderr, "%-20s %10.3f ms\n", cleanPasses[ix].name,
+                 1000.0 * doc->passTime[ix] / CLOCKS_PER_SEC );
+#endif
+}
+
+int         tidyDocCleanAndRepair( TidyDocImpl* doc )
+{
+    Bool htmlOut  = cfgBool( doc, TidyHtmlOut );
+    Bool xmlOut   = cfgBool( doc, TidyXmlOut );
+    Bool xhtmlOut = cfgBool( doc, TidyXhtmlOut );
+    Bool xmlDecl  = cfgBool( doc, TidyXmlDecl );
+    Bool tidyMark = cfgBool( doc, TidyMark );
+    Bool tidyXmlTags = cfgBool( doc, TidyXmlTags );
+    Node* node;
+
+    if (tidyXmlTags)
+       return tidyDocStatus( doc );
+
+    /* the passes change the tree in place, kept output is stale */
+    TY_(DropPrintCache)( doc );
+    RunCleanPasses( doc );
 
     /* remember given doctype for reporting */
     node = TY_(FindDocType)(doc);
@@ -1317,7 +1729,7 @@ int         tidyDocCleanAndRepair( TidyDocImpl* doc )
     return tidyDocStatus( doc );
 }
 
-int         tidyDocSaveStream( TidyDocImpl* doc, StreamOut* out )
+static void PrintDocument( TidyDocImpl* doc, StreamOut* out )
 {
     Bool showMarkup  = cfgBool( doc, TidyShowMarkup );
     Bool forceOutput = cfgBool( doc, TidyForceOutput );
@@ -1329,35 +1741,6 @@ int         tidyDocSaveStream( TidyDocImpl* doc, StreamOut* out )
     Bool xhtmlOut    = cfgBool( doc, TidyXhtmlOut );
     Bool bodyOnly    = cfgBool( doc, TidyBodyOnly );
 
-    Bool dropComments = cfgBool(doc, TidyHideComments);
-    Bool makeClean    = cfgBool(doc, TidyMakeClean);
-    Bool asciiChars   = cfgBool(doc, TidyAsciiChars);
-    Bool makeBare     = cfgBool(doc, TidyMakeBare);
-    Bool escapeCDATA  = cfgBool(doc, TidyEscapeCdata);
-
-    if (escapeCDATA)
-        TY_(ConvertCDATANodes)(doc, &doc->root);
-
-    if (dropComments)
-        TY_(DropComments)(doc, &doc->root);
-
-    if (makeClean)
-    {
-        /* noop */
-        TY_(DropFontElements)(doc, &doc->root, NULL);
-        TY_(WbrToSpace)(doc, &doc->root);
-    }
-
-    if ((makeClean && asciiChars) || makeBare)
-        TY_(DowngradeTypography)(doc, &doc->root);
-
-    if (makeBare)
-        /* Note: no longer replaces &nbsp; in */
-        /* attribute values / non-text tokens */
-        TY_(NormalizeSpaces)(doc->lexer, &doc->root);
-    else
-        TY_(ReplacePreformattedSpaces)(doc, &doc->root);
-
     if ( showMarkup && (doc->errors == 0 || forceOutput) )
     {
 #if SUPPORT_UTF16_ENCODINGS
@@ -1374,6 +1757,7 @@ int         tidyDocSaveStream( TidyDocImpl* doc, StreamOut* out )
         */
 
         doc->docOut = out;
+        TY_(InitPrintFilters)( doc );
         if ( xmlOut && !xhtmlOut )
             TY_(PPrintXMLTree)( doc, NORMAL, 0, &doc->root );
         else if ( bodyOnly )
@@ -1384,7 +1768,11 @@ int         tidyDocSaveStream( TidyDocImpl* doc, StreamOut* out )
         TY_(PFlushLine)( doc, 0 );
         doc->docOut = NULL;
     }
+}
 
+int         tidyDocSaveStream( TidyDocImpl* doc, StreamOut* out )
+{
+    PrintDocument( doc, out );
     TY_(ResetConfigToSnapshot)( doc );
     return tidyDocStatus( doc );
 }
@@ -1515,6 +1903,7 @@ Bool TIDY_CALL  tidyNodeGetText( TidyDoc tdoc, TidyNode tnod, TidyBuffer* outbuf
       Bool xhtmlOut   = cfgBool( doc, TidyXhtmlOut );
 
       doc->docOut = out;
+      TY_(InitPrintFilters)( doc );
       if ( xmlOut && !xhtmlOut )
           TY_(PPrintXMLTree)( doc, NORMAL, 0, nimp );
       else
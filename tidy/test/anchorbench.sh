@@ -0,0 +1,58 @@
+#! /bin/sh
+
+#
+# anchorbench.sh - time id/name anchor checking as the number
+#                  of anchors in a document grows
+#
+# usage: ./anchorbench.sh [count ...]
+#
+# Run time should grow linearly with the anchor count.
+#
+# See tidy.c for the copyright notice.
+#
+# <URL:http://tidy.sourceforge.net/>
+#
+# set -x
+
+TIDY=${TIDY:-../bin/tidy}
+INFILE=./tmp/anchors.html
+
+if [ $# -eq 0 ]
+then
+  set -- 1000 2000 4000 8000 16000 32000 64000
+fi
+
+# Make sure output directory exists.
+if [ ! -d ./tmp ]
+then
+  mkdir ./tmp
+fi
+
+echo "anchors    seconds"
+
+for COUNT in "$@"
+do
+  awk -v n=$COUNT 'BEGIN {
+    print "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.01//EN\">"
+    print "<html><head><title>anchors</title></head><body>"
+    for (i = 0; i < n; i++)
+      printf "<p id=\"p%d\"><a name=\"A%d\" href=\"#p%d\">%d</a></p>\n", i, i, i, i
+    print "</body></html>"
+  }' > $INFILE
+
+  if [ -x /usr/bin/time ]
+  then
+    ELAPSED=`( /usr/bin/time -p $TIDY -q -f /dev/null -o /dev/null $INFILE ) 2>&1 |
+             awk '$1 == "real" { print $2 }'`
+  else
+    # whole seconds only
+    START=`date +%s`
+    $TIDY -q -f /dev/null -o /dev/null $INFILE
+    END=`date +%s`
+    ELAPSED=`expr $END - $START`
+  fi
+  printf "%-10s %s\n" $COUNT $ELAPSED
+done
+
+rm -f $INFILE
+exit 0
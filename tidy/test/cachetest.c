@@ -0,0 +1,119 @@
+/*
+  cachetest.c - save each test case twice with print-cache
+
+  (c) 1998-2006 (W3C) MIT, ERCIM, Keio University
+  See tidy.h for the copyright notice.
+
+  usage: cachetest < cases
+
+  Each line of the input names a config file and an input file.
+  Every case is tidied twice, with and without print-cache, and
+  each document is saved twice, once in the encoding of its config
+  and once as UTF-8.  The second save with print-cache writes the
+  output kept by the first, and must match the second save of the
+  document without it.  Some documents do not print the same when
+  saved again, so the two saves are not compared with each other.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tidy.h"
+#include "buffio.h"
+
+typedef struct _Saves
+{
+    TidyBuffer first;
+    TidyBuffer second;
+    int status;
+} Saves;
+
+static int SameBuffer( const TidyBuffer* a, const TidyBuffer* b )
+{
+    return a->size == b->size
+        && ( a->size == 0 || memcmp(a->bp, b->bp, a->size) == 0 );
+}
+
+static void SaveTwice( ctmbstr cfgfile, ctmbstr infile, ctmbstr encoding,
+                       Bool cache, Saves* saves )
+{
+    TidyDoc tdoc = tidyCreate();
+    TidyBuffer errors;
+    int status;
+
+    tidyBufInit( &saves->first );
+    tidyBufInit( &saves->second );
+    tidyBufInit( &errors );
+    tidySetErrorBuffer( tdoc, &errors );
+
+    status = tidyLoadConfig( tdoc, cfgfile );
+    tidyOptSetBool( tdoc, TidyMark, no );
+    tidyOptSetBool( tdoc, TidyForceOutput, yes );
+    tidyOptSetBool( tdoc, TidyPrintCache, cache );
+    if ( encoding )
+        tidyOptSetValue( tdoc, TidyOutCharEncoding, encoding );
+    if ( status >= 0 )
+        status = tidyParseFile( tdoc, infile );
+    if ( status >= 0 )
+        status = tidyCleanAndRepair( tdoc );
+    if ( status >= 0 )
+        status = tidySaveBuffer( tdoc, &saves->first );
+    if ( status >= 0 )
+        status = tidySaveBuffer( tdoc, &saves->second );
+
+    saves->status = status;
+    tidyBufFree( &errors );
+    tidyRelease( tdoc );
+}
+
+static void FreeSaves( Saves* saves )
+{
+    tidyBufFree( &saves->first );
+    tidyBufFree( &saves->second );
+}
+
+/* returns 1 if print-cache changes the output */
+static int RunCase( ctmbstr cfgfile, ctmbstr infile, ctmbstr encoding )
+{
+    Saves cached, plain;
+    int failed = 0;
+
+    SaveTwice( cfgfile, infile, encoding, yes, &cached );
+    SaveTwice( cfgfile, infile, encoding, no, &plain );
+
+    if ( cached.status != plain.status
+         || !SameBuffer(&cached.first, &plain.first)
+         || !SameBuffer(&cached.second, &plain.second) )
+    {
+        fprintf( stderr, "== %s saved as %s differs with print-cache\n",
+                 infile, encoding ? encoding : "configured" );
+        failed = 1;
+    }
+
+    FreeSaves( &cached );
+    FreeSaves( &plain );
+    return failed;
+}
+
+int main( int argc, char** argv )
+{
+    char line[ 600 ], cfgfile[ 256 ], infile[ 256 ];
+    int ncases = 0, failures = 0;
+
+    while ( fgets(line, sizeof(line), stdin) )
+    {
+        if ( sscanf(line, "%255s %255s", cfgfile, infile) != 2 )
+            continue;
+        failures += RunCase( cfgfile, infile, NULL );
+        failures += RunCase( cfgfile, infile, "utf8" );
+        ++ncases;
+    }
+    if ( ncases == 0 )
+    {
+        fprintf( stderr, "%s: no cases\n", argv[0] );
+        return 2;
+    }
+
+    printf( "cases %d failures %d\n", ncases, failures );
+    return ( failures ? 1 : 0 );
+}
@@ -0,0 +1,56 @@
+#! /bin/sh
+
+#
+# cachetest.sh - save all test cases twice with print-cache
+#
+# usage: ./cachetest.sh
+#
+# Builds the library below ./tmp and runs cachetest.c over the
+# cases listed in testcases.txt.  A case whose output, saved once
+# and again with print-cache, differs from that without it fails
+# the test.
+#
+# See tidy.c for the copyright notice.
+#
+# <URL:http://tidy.sourceforge.net/>
+#
+# set -x
+
+CC=${CC:-cc}
+BUILD=`pwd`/tmp/cache
+CASES=$BUILD/cases.txt
+
+# Make sure output directory exists.
+if [ ! -d $BUILD ]
+then
+  mkdir -p $BUILD
+fi
+
+( cd ../build/gmake &&
+  make -s OBJDIR=$BUILD/obj LIBDIR=$BUILD/lib BINDIR=$BUILD/bin \
+       CC="$CC" $BUILD/lib/libtidy.a ) ||
+  exit 1
+
+$CC -g -I ../include -o $BUILD/cachetest cachetest.c $BUILD/lib/libtidy.a ||
+  exit 1
+
+# One line per case: its config file and input file.
+while read TESTNO EXPECTED
+do
+  CFGFILE=./input/cfg_${TESTNO}.txt
+  if [ ! -f $CFGFILE ]
+  then
+    CFGFILE=./input/cfg_default.txt
+  fi
+  for INFILE in ./input/in_${TESTNO}.*ml
+  do
+    if [ -r $INFILE ]
+    then
+      echo $CFGFILE $INFILE
+      break
+    fi
+  done
+done < testcases.txt > $CASES
+
+unset HTML_TIDY
+$BUILD/cachetest < $CASES
@@ -0,0 +1,215 @@
+/*
+  threadtest.c - tidy the test cases on several threads at once
+
+  (c) 1998-2006 (W3C) MIT, ERCIM, Keio University
+  See tidy.h for the copyright notice.
+
+  usage: threadtest threads rounds < cases
+
+  Each line of the input names a config file and an input file.
+  Each thread tidies all of them, each starting at a different
+  case, and the output and messages must match those of the main
+  thread.  Built with -fsanitize=thread by threadtest.sh, this
+  checks that documents on different threads share nothing they
+  write to.  The main thread creates a document per case, while
+  each thread reuses one with tidyReset(), which must not change
+  the result either.  Every other case is printed with
+  print-threads, whose workers run alongside the other threads.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "tidy.h"
+#include "buffio.h"
+
+typedef struct _Result
+{
+    TidyBuffer output;
+    TidyBuffer errors;
+    int status;
+} Result;
+
+typedef struct _Case
+{
+    char cfgfile[256];
+    char infile[256];
+    int printThreads;      /* print-threads, 0: print serially */
+} Case;
+
+typedef struct _Worker
+{
+    pthread_t thread;
+    int start;             /* first case tidied */
+    Result* results;       /* of the first round */
+} Worker;
+
+static Case* cases = NULL;
+static int ncases = 0;
+static int rounds = 1;
+
+static pthread_mutex_t failLock = PTHREAD_MUTEX_INITIALIZER;
+static int failures = 0;
+
+/* tidy a case with the given document, or a new one if NULL */
+static void RunCase( TidyDoc reuse, const Case* tc, Result* res )
+{
+    TidyDoc tdoc = ( reuse ? reuse : tidyCreate() );
+    int status;
+
+    tidyBufInit( &res->output );
+    tidyBufInit( &res->errors );
+    tidyOptResetAllToDefault( tdoc );
+    tidySetErrorBuffer( tdoc, &res->errors );
+
+    status = tidyLoadConfig( tdoc, tc->cfgfile );
+    tidyOptSetBool( tdoc, TidyMark, no );
+    tidyOptSetInt( tdoc, TidyPrintThreads, tc->printThreads );
+    if ( status >= 0 )
+        status = tidyParseFile( tdoc, tc->infile );
+    if ( status >= 0 )
+        status = tidyCleanAndRepair( tdoc );
+    if ( status >= 0 )
+        status = tidyRunDiagnostics( tdoc );
+    if ( status > 1 )
+        status = ( tidyOptGetBool(tdoc, TidyForceOutput) ? status : -1 );
+    if ( status >= 0 )
+        status = tidySaveBuffer( tdoc, &res->output );
+
+    if ( reuse )
+        tidyReset( tdoc );
+    else
+        tidyRelease( tdoc );
+    res->status = status;
+}
+
+static int SameBuffer( const TidyBuffer* a, const TidyBuffer* b )
+{
+    return a->size == b->size
+        && ( a->size == 0 || memcmp(a->bp, b->bp, a->size) == 0 );
+}
+
+static void CheckResult( const Case* tc, const Result* res,
+                         const Result* expect, int start )
+{
+    if ( res->status != expect->status
+         || !SameBuffer(&res->output, &expect->output)
+         || !SameBuffer(&res->errors, &expect->errors) )
+    {
+        pthread_mutex_lock( &failLock );
+        fprintf( stderr, "== %s differs on the thread starting at case %d\n",
+                 tc->infile, start );
+        ++failures;
+        pthread_mutex_unlock( &failLock );
+    }
+}
+
+static void FreeResult( Result* res )
+{
+    tidyBufFree( &res->output );
+    tidyBufFree( &res->errors );
+}
+
+/* Later rounds must repeat the first, which is checked
+** against the main thread once all workers are done.
+*/
+static void* RunWorker( void* arg )
+{
+    Worker* w = (Worker*) arg;
+    TidyDoc tdoc = tidyCreate();
+    int round, i;
+
+    for ( round = 0; round < rounds; ++round )
+    {
+        for ( i = 0; i < ncases; ++i )
+        {
+            int ix = ( w->start + i ) % ncases;
+            Result res;
+
+            if ( round == 0 )
+            {
+                RunCase( tdoc, &cases[ix], &w->results[ix] );
+                continue;
+            }
+            RunCase( tdoc, &cases[ix], &res );
+            CheckResult( &cases[ix], &res, &w->results[ix], w->start );
+            FreeResult( &res );
+        }
+    }
+    tidyRelease( tdoc );
+    return NULL;
+}
+
+int main( int argc, char** argv )
+{
+    int nthreads = ( argc > 1 ? atoi(argv[1]) : 4 );
+    char line[ 600 ];
+    int allocated = 0;
+    Worker* workers;
+    int i, j;
+
+    if ( argc > 2 )
+        rounds = atoi( argv[2] );
+    if ( nthreads < 1 || rounds < 1 )
+    {
+        fprintf( stderr, "usage: %s threads rounds < cases\n", argv[0] );
+        return 2;
+    }
+
+    while ( fgets(line, sizeof(line), stdin) )
+    {
+        if ( ncases == allocated )
+        {
+            allocated = ( allocated ? 2 * allocated : 64 );
+            cases = (Case*) realloc( cases, allocated * sizeof(Case) );
+        }
+        if ( sscanf(line, "%255s %255s", cases[ncases].cfgfile,
+                    cases[ncases].infile) == 2 )
+        {
+            cases[ncases].printThreads = ( ncases % 2 ? 4 : 0 );
+            ++ncases;
+        }
+    }
+    if ( ncases == 0 )
+    {
+        fprintf( stderr, "%s: no cases\n", argv[0] );
+        return 2;
+    }
+
+    /* No document is created before the threads start, so they
+    ** race to build the tables shared by all documents.
+    */
+    workers = (Worker*) calloc( nthreads, sizeof(Worker) );
+    for ( i = 0; i < nthreads; ++i )
+    {
+        workers[i].start = i * ncases / nthreads;
+        workers[i].results = (Result*) calloc( ncases, sizeof(Result) );
+        pthread_create( &workers[i].thread, NULL, RunWorker, &workers[i] );
+    }
+    for ( i = 0; i < nthreads; ++i )
+        pthread_join( workers[i].thread, NULL );
+
+    for ( j = 0; j < ncases; ++j )
+    {
+        Result expect;
+        RunCase( NULL, &cases[j], &expect );
+        for ( i = 0; i < nthreads; ++i )
+        {
+            CheckResult( &cases[j], &workers[i].results[j], &expect,
+                         workers[i].start );
+            FreeResult( &workers[i].results[j] );
+        }
+        FreeResult( &expect );
+    }
+
+    printf( "threads %d cases %d rounds %d failures %d\n",
+            nthreads, ncases, rounds, failures );
+
+    for ( i = 0; i < nthreads; ++i )
+        free( workers[i].results );
+    free( workers );
+    free( cases );
+    return ( failures ? 1 : 0 );
+}
@@ -0,0 +1,63 @@
+#! /bin/sh
+
+#
+# threadtest.sh - tidy all test cases on several threads at once
+#                 under ThreadSanitizer
+#
+# usage: ./threadtest.sh [threads [rounds]]
+#
+# Builds the library with SUPPORT_PARALLEL_PRINT (which includes
+# SUPPORT_THREADS) and -fsanitize=thread below ./tmp, then runs
+# threadtest.c over the cases listed in testcases.txt, every other
+# one printed with print-threads.  Any data race or difference in
+# the output of a case is reported and fails the test.
+#
+# See tidy.c for the copyright notice.
+#
+# <URL:http://tidy.sourceforge.net/>
+#
+# set -x
+
+THREADS=${1:-8}
+ROUNDS=${2:-2}
+CC=${CC:-cc}
+BUILD=`pwd`/tmp/thread
+CASES=$BUILD/cases.txt
+
+# Make sure output directory exists.
+if [ ! -d $BUILD ]
+then
+  mkdir -p $BUILD
+fi
+
+( cd ../build/gmake &&
+  make -s OBJDIR=$BUILD/obj LIBDIR=$BUILD/lib BINDIR=$BUILD/bin \
+       CC="$CC -fsanitize=thread" SUPPORT_PARALLEL_PRINT=1 \
+       $BUILD/lib/libtidy.a ) ||
+  exit 1
+
+$CC -fsanitize=thread -g -I ../include \
+    -o $BUILD/threadtest threadtest.c $BUILD/lib/libtidy.a -pthread ||
+  exit 1
+
+# One line per case: its config file and input file.
+while read TESTNO EXPECTED
+do
+  CFGFILE=./input/cfg_${TESTNO}.txt
+  if [ ! -f $CFGFILE ]
+  then
+    CFGFILE=./input/cfg_default.txt
+  fi
+  for INFILE in ./input/in_${TESTNO}.*ml
+  do
+    if [ -r $INFILE ]
+    then
+      echo $CFGFILE $INFILE
+      break
+    fi
+  done
+done < testcases.txt > $CASES
+
+unset HTML_TIDY
+TSAN_OPTIONS="halt_on_error=1 exitcode=66 $TSAN_OPTIONS" \
+  $BUILD/threadtest $THREADS $ROUNDS < $CASES